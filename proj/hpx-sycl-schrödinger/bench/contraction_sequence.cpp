@@ -0,0 +1,153 @@
+/* Benchmark of the pairwise contraction sequence planners.
+ *
+ * For each network and dimension the search is timed sequentially and with all threads.
+ * Running the executable also checks the planners against each other and fails if
+ *
+ *     - the parallel search gives a different sequence or cost than the sequential one,
+ *     - the tabulated optimal sequence is not as cheap as the searched one,
+ *     - an elimination sequence does not contract the whole network.
+ *
+ * Elimination sequences are also timed for a 20x20 grid, which is too large to search.
+ **/
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <format>
+#include <print>
+#include <ranges>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "idg/einsum_parser.hpp"
+#include "idg/einsum_plan.hpp"
+#include "idg/tensor_network.hpp"
+
+namespace {
+
+/// Returns result of \p f and the seconds it took.
+template<typename F>
+auto timed(F&& f) {
+    using clock      = std::chrono::steady_clock;
+    const auto start = clock::now();
+    auto result      = f();
+    return std::pair{ std::move(result),
+                      std::chrono::duration<double>(clock::now() - start).count() };
+}
+
+bool check_planners(const std::u8string_view estr) {
+    const auto name = std::string_view(reinterpret_cast<const char*>(estr.data()), estr.size());
+    const auto [_, net] = idg::einsum_network(idg::parsed_einsum(estr));
+    const auto cnet     = net.connected_components().front();
+    const auto table    = cnet.pairwise_contraction_sequence_table();
+
+    auto ok         = true;
+    const auto fail = [&](const std::size_t D, const std::string_view what) {
+        std::println("{} with D = {}: {}", name, D, what);
+        ok = false;
+    };
+
+    for (const auto D : { 2uz, 16uz, 256uz }) {
+        const auto [sequential, sequential_seconds] =
+            timed([&] { return cnet.pairwise_contraction_sequence(D); });
+        const auto [parallel, parallel_seconds] =
+            timed([&] { return cnet.parallel_pairwise_contraction_sequence(D); });
+        const auto elimination = cnet.elimination_contraction_sequence(D);
+        const auto [searched, searched_cost] = cnet.search_pairwise_contraction_sequence(D, {});
+
+        const auto cost = idg::contraction_cost(sequential, D);
+        std::println("{:>32} D = {:>3}: sequential {:.4f} s, parallel {:.4f} s, "
+                     "cost {}, elimination cost {}",
+                     name,
+                     D,
+                     sequential_seconds,
+                     parallel_seconds,
+                     cost,
+                     idg::contraction_cost(elimination, D));
+
+        if (parallel != sequential or idg::contraction_cost(parallel, D) != cost) {
+            fail(D, "parallel search differs from the sequential one");
+        }
+        if (idg::contraction_cost(table.optimal(D).sequence, D) != searched_cost) {
+            fail(D, "tabulated sequence is not optimal");
+        }
+        if (not cnet.is_valid_contraction_sequence(elimination)) {
+            fail(D, "elimination sequence is invalid");
+        }
+    }
+    return ok;
+}
+
+/// Closed \p L x \p L grid of tensors, each connected to its nearest neighbours.
+idg::connected_tensor_network grid(const std::size_t L) {
+    auto net  = idg::tensor_network{};
+    auto ids  = std::vector<idg::tensor_network::node_id>{};
+    auto used = std::vector<std::size_t>(L * L, 0uz);
+    for (const auto r : std::views::iota(0uz, L)) {
+        for (const auto c : std::views::iota(0uz, L)) {
+            const auto rank = static_cast<std::size_t>(r > 0uz) + (r + 1uz < L) + (c > 0uz)
+                              + (c + 1uz < L);
+            ids.push_back(net.add_node(rank));
+        }
+    }
+
+    const auto connect = [&](const std::size_t a, const std::size_t b) {
+        net.add_edge({ ids[a], used[a]++ }, { ids[b], used[b]++ });
+    };
+    for (const auto r : std::views::iota(0uz, L)) {
+        for (const auto c : std::views::iota(0uz, L)) {
+            if (c + 1uz < L) { connect(r * L + c, r * L + c + 1uz); }
+            if (r + 1uz < L) { connect(r * L + c, (r + 1uz) * L + c); }
+        }
+    }
+    return net.connected_components().front();
+}
+
+bool check_elimination(const std::size_t L) {
+    const auto name = std::format("{0}x{0} grid", L);
+    const auto net  = grid(L);
+
+    auto ok = true;
+    for (const auto heuristic :
+         { idg::elimination_heuristic::min_fill, idg::elimination_heuristic::min_degree }) {
+        const auto [sequence, seconds] =
+            timed([&] { return net.elimination_contraction_sequence(2uz, heuristic, false); });
+        const auto largest_step = std::ranges::max(
+            sequence | std::views::transform([](const auto& pc) {
+                return pc.cost_polynomial().degree();
+            }));
+        std::println("{:>32} {:>10}: elimination {:.4f} s, largest step D^{}",
+                     name,
+                     idg::to_string_view(heuristic),
+                     seconds,
+                     largest_step);
+
+        if (not net.is_valid_contraction_sequence(sequence)) {
+            std::println("{} with {}: elimination sequence is invalid",
+                         name,
+                         idg::to_string_view(heuristic));
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+} // namespace
+
+int
+main() {
+    auto ok = true;
+    for (const std::u8string_view estr : {
+             // Two sites of a matrix product state expectation value.
+             u8"ac,apb,cqd,pq,bre,dsf,rs,ef->",
+             // Ring of matrices.
+             u8"ab,bc,cd,de,ef,fg,gh,ha->",
+             // Ladder of two rows of four tensors.
+             u8"ag,abh,bci,cj,dg,deh,efi,fj->",
+         }) {
+        ok = check_planners(estr) and ok;
+    }
+    ok = check_elimination(20uz) and ok;
+    return ok ? 0 : 1;
+}
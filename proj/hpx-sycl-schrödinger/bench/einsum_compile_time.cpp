@@ -0,0 +1,93 @@
+/* Benchmark of compile-time cost of einsum instantiations.
+ *
+ * The measured thing is the compilation of this translation unit, which instantiates
+ * idg::einsum::operator() for a catalogue of einsum strings. The compiler reports
+ * where the time goes while building the target, with -ftime-report (GCC)
+ * or -ftime-trace (Clang, a trace file next to the object file):
+ *
+ *     cmake --build build --target bench-einsum-compile-time
+ *
+ * Running the executable checks that the catalogue also runs.
+ **/
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <print>
+#include <ranges>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <experimental/mdspan>
+
+#include "idg/einsum.hpp"
+#include "idg/einsum_parser.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+
+namespace {
+
+constexpr auto D = 3uz;
+
+template<idg::str::fixed_string estr, std::size_t F>
+constexpr auto factor_rank =
+    std::ranges::size(idg::parsed_einsum_v<estr>.factor_index_labels()[F]);
+
+template<idg::str::fixed_string estr>
+constexpr auto out_rank = std::ranges::size(idg::parsed_einsum_v<estr>.output_index_labels());
+
+/// Calls einsum \p estr with factors of ones and returns the sum of the output.
+template<idg::str::fixed_string estr>
+double instantiate() {
+    return std::invoke(
+        []<std::size_t... F>(std::index_sequence<F...>) {
+            const auto factor_buffs = std::tuple{ std::vector<double>(
+                idg::sstd::integer_pow(D, factor_rank<estr, F>), 1.0)... };
+            auto out_buff = std::vector<double>(idg::sstd::integer_pow(D, out_rank<estr>));
+
+            idg::einsum<estr>{}(
+                idg::sstd::geometric_mdspan<double, out_rank<estr>, D>(out_buff.data()),
+                idg::sstd::geometric_mdspan<const double, factor_rank<estr, F>, D>(
+                    std::get<F>(factor_buffs).data())...);
+
+            return std::ranges::fold_left(out_buff, 0.0, std::plus{});
+        },
+        std::make_index_sequence<idg::parsed_einsum_v<estr>.number_of_factors()>());
+}
+
+template<idg::str::fixed_string... estrs>
+void run_catalogue() {
+    const auto name = [](const std::u8string_view estr) {
+        return std::string_view(reinterpret_cast<const char*>(estr.data()), estr.size());
+    };
+    (std::println("{:>20}: {}", name(estrs.sv()), instantiate<estrs>()), ...);
+}
+
+} // namespace
+
+int
+main() {
+    run_catalogue<
+        // Permutations and direct loops.
+        u8"ij->ji",
+        u8"ii->",
+        u8"ijk,k->ij",
+        u8"ij,jk->ik",
+        u8"ij,jk",
+        // Chains, which are contracted pairwise.
+        u8"ij,jk,kl->il",
+        u8"ab,bc,cd,de,ef->af",
+        u8"ac,apb,cpd->bd",
+        u8"ijk,jkl,lmn->imn",
+        // Operators of matrix product states.
+        u8"qp,cpb->cqb",
+        u8"qtps,cpse->cqte",
+        // Self contractions and outer products of connected components.
+        u8"iij,k->jk",
+        u8"ij,kl->ijkl",
+        u8"ij,jk,lm,mn->ikln">();
+
+    return 0;
+}
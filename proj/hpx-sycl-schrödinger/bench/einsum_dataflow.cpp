@@ -0,0 +1,130 @@
+/* Benchmark of einsum executed as HPX dataflow graph.
+ *
+ * For a catalogue of einsum strings (direct loops, chains with independent branches,
+ * self contractions and outer products of several connected components) times
+ * idg::einsum_async against idg::einsum and fails if their outputs differ.
+ *
+ * Built only with -DIDG_WITH_HPX=ON.
+ **/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <print>
+#include <ranges>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <experimental/mdspan>
+
+#include <hpx/hpx_init.hpp>
+
+#include "idg/einsum.hpp"
+#include "idg/einsum_dataflow.hpp"
+#include "idg/einsum_parser.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+
+namespace {
+
+constexpr auto D = 24uz;
+
+template<idg::str::fixed_string estr, std::size_t F>
+constexpr auto factor_rank =
+    std::ranges::size(idg::parsed_einsum_v<estr>.factor_index_labels()[F]);
+
+template<idg::str::fixed_string estr>
+constexpr auto out_rank = std::ranges::size(idg::parsed_einsum_v<estr>.output_index_labels());
+
+/// Returns the seconds \p f took.
+template<typename F>
+double timed(F&& f) {
+    using clock      = std::chrono::steady_clock;
+    const auto start = clock::now();
+    f();
+    return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+/// Runs einsum \p estr synchronously and as dataflow graph and compares the outputs.
+template<idg::str::fixed_string estr>
+bool check() {
+    return std::invoke(
+        []<std::size_t... F>(std::index_sequence<F...>) {
+            // Distinct small values, so that wrongly paired operands change the result.
+            const auto filled = [](const std::size_t size, const std::size_t seed) {
+                return std::views::iota(0uz, size)
+                       | std::views::transform([=](const auto i) {
+                             return static_cast<double>((i * 7uz + seed) % 11uz) * 0.125 - 0.5;
+                         })
+                       | std::ranges::to<std::vector>();
+            };
+            const auto factor_buffs =
+                std::tuple{ filled(idg::sstd::integer_pow(D, factor_rank<estr, F>), F)... };
+            const auto factors = std::tuple{
+                idg::sstd::geometric_mdspan<const double, factor_rank<estr, F>, D>(
+                    std::get<F>(factor_buffs).data())...
+            };
+            const auto out_size = idg::sstd::integer_pow(D, out_rank<estr>);
+            auto expected_buff  = std::vector<double>(out_size);
+            auto dataflow_buff  = std::vector<double>(out_size);
+            const auto out_mdspan = [](std::vector<double>& buff) {
+                return idg::sstd::geometric_mdspan<double, out_rank<estr>, D>(buff.data());
+            };
+
+            const auto einsum_seconds = timed(
+                [&] { idg::einsum<estr>{}(out_mdspan(expected_buff), std::get<F>(factors)...); });
+            const auto dataflow_seconds = timed([&] {
+                idg::einsum_async<estr>(out_mdspan(dataflow_buff), std::get<F>(factors)...).get();
+            });
+
+            auto ok = true;
+            for (const auto [expected, computed] : std::views::zip(expected_buff, dataflow_buff)) {
+                const auto tolerance = 1e-12 * std::max(std::abs(expected), 1.0);
+                ok                   = ok and std::abs(expected - computed) <= tolerance;
+            }
+
+            const auto name = estr.sv();
+            std::println("{:>20}: einsum {:.4f} s, einsum_async {:.4f} s{}",
+                         std::string_view(reinterpret_cast<const char*>(name.data()), name.size()),
+                         einsum_seconds,
+                         dataflow_seconds,
+                         ok ? "" : ", outputs differ");
+            return ok;
+        },
+        std::make_index_sequence<idg::parsed_einsum_v<estr>.number_of_factors()>());
+}
+
+template<idg::str::fixed_string... estrs>
+bool check_catalogue() {
+    return (check<estrs>() & ...);
+}
+
+} // namespace
+
+int
+hpx_main(int, char**) {
+    const auto ok = check_catalogue<
+        // Direct loops, started as one task.
+        u8"ij->ji",
+        u8"ijk,k->ij",
+        // Chains, whose pairwise steps depend on each other.
+        u8"ij,jk,kl,lm->im",
+        u8"ac,apb,cpd->bd",
+        // Longer chain, whose plan has independent branches.
+        u8"ab,bc,cd,de,ef,fg->ag",
+        // Self contractions and outer products of connected components.
+        u8"iij,k->jk",
+        u8"ij,jk,lm,mn->ikln">();
+
+    hpx::finalize();
+    return ok ? 0 : 1;
+}
+
+int
+main(int argc, char* argv[]) {
+    return hpx::init(argc, argv);
+}
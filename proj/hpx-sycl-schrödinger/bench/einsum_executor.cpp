@@ -0,0 +1,149 @@
+/* Benchmark of einsum_executor.
+ *
+ * Evaluates a chain, whose first two factors are constant, repeatedly while changing
+ * one factor at a time, and times update() of the changed factor against a call
+ * recomputing every variable step and against einsum. Fails if
+ *
+ *     - a call recomputes the precontracted steps of the constant factors,
+ *     - update() computes other steps than the ones depending on the changed factor,
+ *     - outputs differ from the ones of einsum of the current factors.
+ **/
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <format>
+#include <functional>
+#include <print>
+#include <ranges>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <experimental/mdspan>
+
+#include "idg/einsum.hpp"
+#include "idg/einsum_executor.hpp"
+#include "idg/sstd.hpp"
+
+namespace {
+
+constexpr auto D = 96uz;
+
+constexpr auto number_of_factors = 5uz;
+
+using factor_mdspan = idg::sstd::geometric_mdspan<const double, 2uz, D>;
+using out_mdspan    = idg::sstd::geometric_mdspan<double, 2uz, D>;
+
+using estr_einsum = idg::einsum<u8"ab,bc,cd,de,ef->af">;
+
+using executor = idg::einsum_executor<u8"ab,bc,cd,de,ef->af",
+                                      idg::constant_factors<0, 1>,
+                                      out_mdspan,
+                                      factor_mdspan,
+                                      factor_mdspan,
+                                      factor_mdspan,
+                                      factor_mdspan,
+                                      factor_mdspan>;
+
+/// Returns the seconds \p f took.
+template<typename F>
+double timed(F&& f) {
+    using clock      = std::chrono::steady_clock;
+    const auto start = clock::now();
+    f();
+    return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+/// Distinct small values, so that stale intermediates change the result.
+void fill(std::vector<double>& buff, const std::size_t seed) {
+    for (const auto [i, x] : buff | std::views::enumerate) {
+        const auto k = static_cast<std::size_t>(i);
+        x            = static_cast<double>((k * 7uz + seed) % 13uz) * 0.0625 - 0.375;
+    }
+}
+
+} // namespace
+
+int
+main() {
+    auto ok         = true;
+    const auto fail = [&](const std::string_view what) {
+        std::println("{}", what);
+        ok = false;
+    };
+
+    auto factor_buffs = std::array<std::vector<double>, number_of_factors>{};
+    for (const auto f : std::views::iota(0uz, number_of_factors)) {
+        factor_buffs[f].resize(D * D);
+        fill(factor_buffs[f], f);
+    }
+    auto expected_buff = std::vector<double>(D * D);
+    auto computed_buff = std::vector<double>(D * D);
+    const auto expected_out = out_mdspan(expected_buff.data());
+    const auto out          = out_mdspan(computed_buff.data());
+
+    // Calls f with the current factors.
+    const auto with_factors = [&](auto&& f) {
+        std::invoke(
+            [&]<std::size_t... F>(std::index_sequence<F...>) {
+                f(factor_mdspan(factor_buffs[F].data())...);
+            },
+            std::make_index_sequence<number_of_factors>());
+    };
+    const auto compare = [&](const std::string_view what) {
+        with_factors([&](const auto... factors) { estr_einsum{}(expected_out, factors...); });
+        for (const auto [expected, computed] : std::views::zip(expected_buff, computed_buff)) {
+            if (std::abs(expected - computed) > 1e-10 * std::max(std::abs(expected), 1.0)) {
+                fail(std::format("{}: output differs from einsum", what));
+                return;
+            }
+        }
+    };
+
+    auto e = executor{};
+    with_factors([&](const auto... factors) { e(out, factors...); });
+    compare("first call");
+
+    // Later calls reuse the precontracted steps of the constant factors.
+    const auto all_steps = e.computed_steps();
+    if (executor::number_of_precontracted_steps() == 0uz) {
+        fail("plan has no precontracted steps");
+    }
+    const auto call_seconds =
+        timed([&] { with_factors([&](const auto... factors) { e(out, factors...); }); });
+    if (e.computed_steps() - all_steps != all_steps - executor::number_of_precontracted_steps()) {
+        fail("call recomputed precontracted steps");
+    }
+    compare("second call");
+
+    auto update_seconds = 0.0;
+    for (const auto f : std::views::iota(0uz, number_of_factors)) {
+        fill(factor_buffs[f], f + 17uz);
+
+        const auto before = e.computed_steps();
+        update_seconds += timed([&] {
+            with_factors([&](const auto... factors) { e.update({ f }, out, factors...); });
+        });
+        const auto steps = e.computed_steps() - before;
+        if (steps != executor::number_of_dependent_steps(f)) {
+            fail(std::format("update of factor {} computed {} steps instead of {}",
+                             f,
+                             steps,
+                             executor::number_of_dependent_steps(f)));
+        }
+        compare(std::format("update of factor {}", f));
+    }
+
+    const auto einsum_seconds = timed([&] {
+        with_factors([&](const auto... factors) { estr_einsum{}(expected_out, factors...); });
+    });
+
+    std::println("einsum {:.4f} s, call {:.4f} s, update of one factor {:.4f} s on average",
+                 einsum_seconds,
+                 call_seconds,
+                 update_seconds / static_cast<double>(number_of_factors));
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+/* Benchmark of lazy einsum expressions.
+ *
+ * Times assign of sums of lazy_einsums against einsum of each term added up afterwards,
+ * and fails if their outputs differ:
+ *
+ *     - T psi + V psi, i.e. one direct group with common factor psi,
+ *     - 0.5 A B - C^T, i.e. two direct groups,
+ *     - A B C + A E C, i.e. group contracted by einsum once with summed B + E.
+ **/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <print>
+#include <ranges>
+#include <string_view>
+#include <vector>
+
+#include <experimental/mdspan>
+
+#include "idg/einsum.hpp"
+#include "idg/einsum_expression.hpp"
+#include "idg/sstd.hpp"
+
+namespace {
+
+using idg::lazy_einsum;
+
+/// Returns the seconds \p f took.
+template<typename F>
+double timed(F&& f) {
+    using clock      = std::chrono::steady_clock;
+    const auto start = clock::now();
+    f();
+    return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+/// Distinct small values, so that wrongly paired factors change the result.
+std::vector<double> filled(const std::size_t size, const std::size_t seed) {
+    return std::views::iota(0uz, size) | std::views::transform([=](const auto i) {
+               return static_cast<double>((i * 7uz + seed) % 13uz) * 0.125 - 0.75;
+           })
+           | std::ranges::to<std::vector>();
+}
+
+/// Adds \p scale times \p term to \p sum.
+void add(std::vector<double>& sum, const std::vector<double>& term, const double scale = 1.0) {
+    for (const auto [s, t] : std::views::zip(sum, term)) { s += scale * t; }
+}
+
+bool compare(const std::string_view name,
+             const std::vector<double>& expected,
+             const std::vector<double>& computed,
+             const double einsum_seconds,
+             const double lazy_seconds) {
+    auto ok = true;
+    for (const auto [e, c] : std::views::zip(expected, computed)) {
+        ok = ok and std::abs(e - c) <= 1e-10 * std::max(std::abs(e), 1.0);
+    }
+    std::println("{:>16}: einsum {:.4f} s, assign {:.4f} s{}",
+                 name,
+                 einsum_seconds,
+                 lazy_seconds,
+                 ok ? "" : ", outputs differ");
+    return ok;
+}
+
+template<std::size_t rank, std::size_t D>
+auto view(std::vector<double>& buff) {
+    return idg::sstd::geometric_mdspan<double, rank, D>(buff.data());
+}
+
+template<std::size_t rank, std::size_t D>
+auto view(const std::vector<double>& buff) {
+    return idg::sstd::geometric_mdspan<const double, rank, D>(buff.data());
+}
+
+bool hamiltonian() {
+    constexpr auto D = 2048uz;
+
+    const auto T_buff   = filled(D * D, 1uz);
+    const auto V_buff   = filled(D * D, 2uz);
+    const auto psi_buff = filled(D, 3uz);
+    const auto T        = view<2, D>(T_buff);
+    const auto V        = view<2, D>(V_buff);
+    const auto psi      = view<1, D>(psi_buff);
+
+    auto expected = std::vector<double>(D);
+    auto computed = std::vector<double>(D);
+
+    const auto einsum_seconds = timed([&] {
+        auto V_psi = std::vector<double>(D);
+        idg::einsum<u8"ij,j->i">{}(view<1, D>(expected), T, psi);
+        idg::einsum<u8"ij,j->i">{}(view<1, D>(V_psi), V, psi);
+        add(expected, V_psi);
+    });
+    const auto lazy_seconds = timed([&] {
+        idg::assign(view<1, D>(computed),
+                    lazy_einsum<u8"ij,j->i">(T, psi) + lazy_einsum<u8"ij,j->i">(V, psi));
+    });
+    return compare("T psi + V psi", expected, computed, einsum_seconds, lazy_seconds);
+}
+
+bool two_groups() {
+    constexpr auto D = 128uz;
+
+    const auto A_buff = filled(D * D, 1uz);
+    const auto B_buff = filled(D * D, 2uz);
+    const auto C_buff = filled(D * D, 3uz);
+    const auto A      = view<2, D>(A_buff);
+    const auto B      = view<2, D>(B_buff);
+    const auto C      = view<2, D>(C_buff);
+
+    auto expected = std::vector<double>(D * D);
+    auto computed = std::vector<double>(D * D);
+
+    const auto einsum_seconds = timed([&] {
+        auto C_T = std::vector<double>(D * D);
+        idg::einsum<u8"ij,jk->ik">{}(view<2, D>(expected), A, B);
+        idg::einsum<u8"ki->ik">{}(view<2, D>(C_T), C);
+        for (auto& x : expected) { x *= 0.5; }
+        add(expected, C_T, -1.0);
+    });
+    const auto lazy_seconds = timed([&] {
+        idg::assign(view<2, D>(computed),
+                    0.5 * lazy_einsum<u8"ij,jk->ik">(A, B) - lazy_einsum<u8"ki->ik">(C));
+    });
+    return compare("0.5 A B - C^T", expected, computed, einsum_seconds, lazy_seconds);
+}
+
+bool summed_factor() {
+    constexpr auto D = 128uz;
+
+    const auto A_buff = filled(D * D, 1uz);
+    const auto B_buff = filled(D * D, 2uz);
+    const auto C_buff = filled(D * D, 3uz);
+    const auto E_buff = filled(D * D, 4uz);
+    const auto A      = view<2, D>(A_buff);
+    const auto B      = view<2, D>(B_buff);
+    const auto C      = view<2, D>(C_buff);
+    const auto E      = view<2, D>(E_buff);
+
+    auto expected = std::vector<double>(D * D);
+    auto computed = std::vector<double>(D * D);
+
+    const auto einsum_seconds = timed([&] {
+        auto AEC = std::vector<double>(D * D);
+        idg::einsum<u8"ij,jk,kl->il">{}(view<2, D>(expected), A, B, C);
+        idg::einsum<u8"ij,jk,kl->il">{}(view<2, D>(AEC), A, E, C);
+        add(expected, AEC);
+    });
+    const auto lazy_seconds = timed([&] {
+        idg::assign(view<2, D>(computed),
+                    lazy_einsum<u8"ij,jk,kl->il">(A, B, C)
+                        + lazy_einsum<u8"ij,jk,kl->il">(A, E, C));
+    });
+    return compare("A B C + A E C", expected, computed, einsum_seconds, lazy_seconds);
+}
+
+} // namespace
+
+int
+main() {
+    auto ok = hamiltonian();
+    ok      = two_groups() and ok;
+    ok      = summed_factor() and ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+/* Benchmark of quantized einsum.
+ *
+ * For int8 and int16 quantizations of a catalogue of einsum strings (dot products of
+ * contiguous operands and the integer einsum fallback) times idg::quantized_einsum with
+ * the kernel dispatched for the running CPU and with the portable kernel. Fails if
+ *
+ *     - dispatched and portable outputs are not identical, as both accumulate exactly,
+ *     - outputs differ from the double einsum of the dequantized factors.
+ *
+ * Contracted extent is not a multiple of the vector width, so the VNNI kernels
+ * also go through their scalar remainder.
+ **/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <print>
+#include <ranges>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <experimental/mdspan>
+
+#include "idg/cpu_dispatch.hpp"
+#include "idg/einsum.hpp"
+#include "idg/einsum_parser.hpp"
+#include "idg/einsum_quantized.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+
+namespace {
+
+constexpr auto D = 100uz;
+
+template<idg::str::fixed_string estr, std::size_t F>
+constexpr auto factor_rank =
+    std::ranges::size(idg::parsed_einsum_v<estr>.factor_index_labels()[F]);
+
+template<idg::str::fixed_string estr>
+constexpr auto out_rank = std::ranges::size(idg::parsed_einsum_v<estr>.output_index_labels());
+
+/// Returns the seconds \p f took.
+template<typename F>
+double timed(F&& f) {
+    using clock      = std::chrono::steady_clock;
+    const auto start = clock::now();
+    f();
+    return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+/// Quantizes factors of einsum \p estr to \p Int and compares the kernels.
+template<idg::str::fixed_string estr, typename Int>
+bool check() {
+    return std::invoke(
+        []<std::size_t... F>(std::index_sequence<F...>) {
+            // Distinct values of both signs, so that wrongly paired operands change the result.
+            const auto filled = [](const std::size_t size, const std::size_t seed) {
+                return std::views::iota(0uz, size)
+                       | std::views::transform([=](const auto i) {
+                             return static_cast<double>((i * 7uz + seed) % 23uz) * 0.09 - 1.0;
+                         })
+                       | std::ranges::to<std::vector>();
+            };
+            const auto factor_buffs =
+                std::tuple{ filled(idg::sstd::integer_pow(D, factor_rank<estr, F>), F)... };
+            auto quantized_buffs =
+                std::tuple{ std::vector<Int>(std::get<F>(factor_buffs).size())... };
+            auto dequantized_buffs =
+                std::tuple{ std::vector<double>(std::get<F>(factor_buffs).size())... };
+
+            const auto factors = std::tuple{ idg::quantize(
+                idg::sstd::geometric_mdspan<const double, factor_rank<estr, F>, D>(
+                    std::get<F>(factor_buffs).data()),
+                idg::sstd::geometric_mdspan<Int, factor_rank<estr, F>, D>(
+                    std::get<F>(quantized_buffs).data()))... };
+            (idg::dequantize(std::get<F>(factors),
+                             idg::sstd::geometric_mdspan<double, factor_rank<estr, F>, D>(
+                                 std::get<F>(dequantized_buffs).data())),
+             ...);
+
+            const auto out_size  = idg::sstd::integer_pow(D, out_rank<estr>);
+            auto expected_buff   = std::vector<double>(out_size);
+            auto dispatched_buff = std::vector<double>(out_size);
+            auto portable_buff   = std::vector<double>(out_size);
+            const auto out_mdspan = [](std::vector<double>& buff) {
+                return idg::sstd::geometric_mdspan<double, out_rank<estr>, D>(buff.data());
+            };
+
+            idg::einsum<estr>{}(out_mdspan(expected_buff),
+                                idg::sstd::geometric_mdspan<const double, factor_rank<estr, F>, D>(
+                                    std::get<F>(dequantized_buffs).data())...);
+
+            using qe                      = idg::quantized_einsum<estr>;
+            const auto dispatched_seconds = timed(
+                [&] { qe{}(out_mdspan(dispatched_buff), std::get<F>(factors)...); });
+            const auto portable_seconds = timed(
+                [&] { qe::portable(out_mdspan(portable_buff), std::get<F>(factors)...); });
+
+            auto ok = dispatched_buff == portable_buff;
+            for (const auto [expected, computed] : std::views::zip(expected_buff, portable_buff)) {
+                const auto tolerance = 1e-10 * std::max(std::abs(expected), 1.0);
+                ok                   = ok and std::abs(expected - computed) <= tolerance;
+            }
+
+            using out_type = decltype(out_mdspan(expected_buff));
+            constexpr auto dot_product = qe::template uses_dot_product_kernel<
+                out_type,
+                decltype(std::get<F>(factors).values)...>();
+
+            const auto name = estr.sv();
+            std::println("{:>12} int{:<2} {:>11}: dispatched {:.4f} s, portable {:.4f} s{}",
+                         std::string_view(reinterpret_cast<const char*>(name.data()), name.size()),
+                         8uz * sizeof(Int),
+                         dot_product ? "dot product" : "einsum",
+                         dispatched_seconds,
+                         portable_seconds,
+                         ok ? "" : ", outputs differ");
+            return ok;
+        },
+        std::make_index_sequence<idg::parsed_einsum_v<estr>.number_of_factors()>());
+}
+
+template<idg::str::fixed_string... estrs>
+bool check_catalogue() {
+    return (check<estrs, std::int8_t>() & ...) & (check<estrs, std::int16_t>() & ...);
+}
+
+} // namespace
+
+int
+main() {
+    std::println("dot product isa: {}",
+                 idg::cpu::to_string_view(idg::cpu::detected_dot_product_isa()));
+
+    const auto ok = check_catalogue<
+        // Dot products, i.e. "MK,NK->MN" with contiguous operands.
+        u8"ij,j->i",
+        u8"ik,jk->ij",
+        // Integer einsum.
+        u8"ij,jk->ik">();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+/* Benchmark of matrix product state sweeps.
+ *
+ * Sweeps the active site over a random MPS, changing it and evaluating an operator there,
+ * and times the sweep. Running the executable also checks and fails if
+ *
+ *     - expectation value of the identity is not 1,
+ *     - a step of the sweep recomputes other than one environment,
+ *     - expectation values from cached environments differ from recomputed ones.
+ **/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <format>
+#include <print>
+#include <random>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <experimental/mdspan>
+
+#include "idg/matrix_product_state.hpp"
+#include "idg/sstd.hpp"
+
+namespace {
+
+constexpr auto D = 8uz;
+constexpr auto n = 24uz;
+
+using mps = idg::matrix_product_state<double, D>;
+
+bool close_to(const double a, const double b) {
+    return std::abs(a - b) <= 1e-10 * std::max(std::abs(b), 1.0);
+}
+
+/// Single site operator with \p diagonal on the diagonal and \p off_diagonal next to it.
+std::vector<double> tridiagonal(const double diagonal, const double off_diagonal) {
+    auto buff     = std::vector<double>(D * D);
+    const auto op = idg::sstd::geometric_mdspan<double, 2uz, D>(buff.data());
+    for (const auto q : std::views::iota(0uz, D)) {
+        for (const auto p : std::views::iota(0uz, D)) {
+            op[q, p] = q == p ? diagonal : (q == p + 1uz or p == q + 1uz ? off_diagonal : 0.0);
+        }
+    }
+    return buff;
+}
+
+/// Identity as nearest neighbour operator, i.e. O[q, t, p, s] = delta_qp delta_ts.
+std::vector<double> two_site_identity() {
+    auto buff     = std::vector<double>(D * D * D * D);
+    const auto op = idg::sstd::geometric_mdspan<double, 4uz, D>(buff.data());
+    for (const auto p : std::views::iota(0uz, D)) {
+        for (const auto s : std::views::iota(0uz, D)) { op[p, s, p, s] = 1.0; }
+    }
+    return buff;
+}
+
+} // namespace
+
+int
+main() {
+    auto ok         = true;
+    const auto fail = [&](const std::size_t i, const std::string_view what) {
+        std::println("site {}: {}", i, what);
+        ok = false;
+    };
+
+    auto rng        = std::mt19937_64{ 42uz };
+    auto uniform    = std::uniform_real_distribution<double>(-1.0, 1.0);
+    const auto fill = [&](const mps::site_mdspan A) {
+        std::ranges::generate(std::span(A.data_handle(), A.mapping().required_span_size()),
+                              [&] { return uniform(rng); });
+    };
+
+    auto psi = mps(n);
+    for (const auto i : std::views::iota(0uz, n)) { fill(psi.site(i)); }
+
+    const auto identity_buff     = tridiagonal(1.0, 0.0);
+    const auto identity_two_buff = two_site_identity();
+    const auto identity          = mps::one_site_operator_mdspan(identity_buff.data());
+    const auto identity_two      = mps::two_site_operator_mdspan(identity_two_buff.data());
+    for (const auto i : std::views::iota(0uz, n)) {
+        if (not close_to(psi.expectation_value(i, identity), 1.0)) {
+            fail(i, "expectation value of identity is not 1");
+        }
+        if (i + 1uz < n and not close_to(psi.expectation_value(i, identity_two), 1.0)) {
+            fail(i, "expectation value of two site identity is not 1");
+        }
+    }
+
+    // Sweep changing the active site and evaluating op at it.
+    const auto op_buff = tridiagonal(0.5, 1.0);
+    const auto op      = mps::one_site_operator_mdspan(op_buff.data());
+
+    using clock      = std::chrono::steady_clock;
+    const auto start = clock::now();
+    for (const auto i : std::views::iota(0uz, n)) {
+        fill(psi.site(i));
+        const auto updates_before = psi.environment_updates();
+        static_cast<void>(psi.expectation_value(i, op));
+        const auto updates = psi.environment_updates() - updates_before;
+
+        // Changing site i keeps R_i+1, so after the first step only L_i is moved by one site.
+        if (i != 0uz and updates != 1uz) {
+            fail(i, std::format("{} environments were recomputed instead of one", updates));
+        }
+    }
+    const auto seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    // Same sites without cached environments.
+    auto fresh = mps(n);
+    for (const auto i : std::views::iota(0uz, n)) {
+        const auto site = std::as_const(psi).site(i);
+        std::ranges::copy(std::span(site.data_handle(), site.mapping().required_span_size()),
+                          fresh.site(i).data_handle());
+    }
+    for (const auto i : std::views::iota(0uz, n)) {
+        if (not close_to(psi.expectation_value(i, op), fresh.expectation_value(i, op))) {
+            fail(i, "expectation value differs from the one of recomputed environments");
+        }
+    }
+
+    std::println("sweep of {} sites with D = {}: {:.6f} s, {} environment updates",
+                 n,
+                 D,
+                 seconds,
+                 psi.environment_updates());
+    return ok ? 0 : 1;
+}
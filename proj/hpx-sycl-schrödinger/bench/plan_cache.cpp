@@ -0,0 +1,195 @@
+/* Benchmark of persisted einsum plans.
+ *
+ * Plans a catalogue of einsum strings, writes them to a plan cache file and maps it back
+ * as on a warm start. Times planning against lookup from the mapped cache and
+ * execute_plan of the loaded plans against idg::einsum, and fails if
+ *
+ *     - opening a missing cache file does not report a cold start,
+ *     - a plan is not found or is found for other extents,
+ *     - outputs of execute_plan differ from the ones of idg::einsum.
+ **/
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <print>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <experimental/mdspan>
+
+#include "idg/einsum.hpp"
+#include "idg/einsum_parser.hpp"
+#include "idg/einsum_plan.hpp"
+#include "idg/plan_cache.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+
+namespace {
+
+constexpr auto D = 12uz;
+
+template<idg::str::fixed_string estr, std::size_t F>
+constexpr auto factor_rank =
+    std::ranges::size(idg::parsed_einsum_v<estr>.factor_index_labels()[F]);
+
+template<idg::str::fixed_string estr>
+constexpr auto out_rank = std::ranges::size(idg::parsed_einsum_v<estr>.output_index_labels());
+
+/// Returns the seconds \p f took.
+template<typename F>
+double timed(F&& f) {
+    using clock      = std::chrono::steady_clock;
+    const auto start = clock::now();
+    f();
+    return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+/// Extents of every index of every factor of \p estr with dimension \p dim.
+template<idg::str::fixed_string estr>
+std::vector<std::size_t> extents_of(const std::size_t dim = D) {
+    auto rank = 0uz;
+    for (const auto& labels : idg::parsed_einsum_v<estr>.factor_index_labels()) {
+        rank += std::ranges::size(labels);
+    }
+    return std::vector<std::size_t>(rank, dim);
+}
+
+/// Plans \p estr with \p constant_factors and adds it to \p writer.
+template<idg::str::fixed_string estr>
+double add_plan(idg::plan_cache_writer& writer,
+                const std::span<const std::size_t> constant_factors = {}) {
+    const auto extents = extents_of<estr>();
+    auto plan          = std::optional<idg::einsum_plan>{};
+    const auto seconds = timed([&] { plan.emplace(estr.sv(), D, constant_factors); });
+    writer.add(estr.sv(), extents, plan.value());
+    return seconds;
+}
+
+/// Loads plan of \p estr from \p cache, executes it and compares the output with einsum.
+template<idg::str::fixed_string estr>
+bool check(const idg::mapped_plan_cache& cache, const double planning_seconds) {
+    const auto name = estr.sv();
+    const auto print_name =
+        std::string_view(reinterpret_cast<const char*>(name.data()), name.size());
+
+    const auto extents = extents_of<estr>();
+    auto plan          = std::optional<idg::einsum_plan>{};
+    const auto lookup_seconds = timed([&] { plan = cache.find(estr.sv(), extents); });
+    if (not plan) {
+        std::println("{:>20}: plan not found", print_name);
+        return false;
+    }
+    if (cache.find(estr.sv(), extents_of<estr>(D + 1uz))) {
+        std::println("{:>20}: plan found for other extents", print_name);
+        return false;
+    }
+
+    return std::invoke(
+        [&]<std::size_t... F>(std::index_sequence<F...>) {
+            // Distinct small values, so that wrongly paired operands change the result.
+            const auto filled = [](const std::size_t size, const std::size_t seed) {
+                return std::views::iota(0uz, size)
+                       | std::views::transform([=](const auto i) {
+                             return static_cast<double>((i * 7uz + seed) % 11uz) * 0.125 - 0.5;
+                         })
+                       | std::ranges::to<std::vector>();
+            };
+            const auto factor_buffs =
+                std::tuple{ filled(idg::sstd::integer_pow(D, factor_rank<estr, F>), F)... };
+            const auto factors = std::tuple{
+                idg::sstd::geometric_mdspan<const double, factor_rank<estr, F>, D>(
+                    std::get<F>(factor_buffs).data())...
+            };
+            const auto out_size = idg::sstd::integer_pow(D, out_rank<estr>);
+            auto expected_buff  = std::vector<double>(out_size);
+            auto plan_buff      = std::vector<double>(out_size);
+            const auto out_mdspan = [](std::vector<double>& buff) {
+                return idg::sstd::geometric_mdspan<double, out_rank<estr>, D>(buff.data());
+            };
+
+            const auto einsum_seconds = timed(
+                [&] { idg::einsum<estr>{}(out_mdspan(expected_buff), std::get<F>(factors)...); });
+            const auto plan_seconds = timed([&] {
+                idg::execute_plan(plan.value(),
+                                  estr.sv(),
+                                  out_mdspan(plan_buff),
+                                  std::get<F>(factors)...);
+            });
+
+            auto ok = true;
+            for (const auto [expected, computed] : std::views::zip(expected_buff, plan_buff)) {
+                const auto tolerance = 1e-12 * std::max(std::abs(expected), 1.0);
+                ok                   = ok and std::abs(expected - computed) <= tolerance;
+            }
+
+            std::println("{:>20}: planning {:.6f} s, lookup {:.6f} s, "
+                         "einsum {:.4f} s, execute_plan {:.4f} s{}",
+                         print_name,
+                         planning_seconds,
+                         lookup_seconds,
+                         einsum_seconds,
+                         plan_seconds,
+                         ok ? "" : ", outputs differ");
+            return ok;
+        },
+        std::make_index_sequence<idg::parsed_einsum_v<estr>.number_of_factors()>());
+}
+
+template<idg::str::fixed_string... estrs>
+bool check_catalogue(const std::filesystem::path& path) {
+    auto writer                 = idg::plan_cache_writer{};
+    const auto planning_seconds = std::array{ add_plan<estrs>(writer)... };
+    // Constant factors make the plan have a precontracted step.
+    static constexpr auto constant_factors = std::array{ 1uz, 2uz };
+    const auto constant_planning_seconds =
+        add_plan<u8"ij,jk,kl,l->i">(writer, constant_factors);
+    writer.write(path);
+
+    const auto cache = idg::mapped_plan_cache::open(path);
+    if (not cache or cache->size() != sizeof...(estrs) + 1uz) {
+        std::println("written plan cache could not be loaded");
+        return false;
+    }
+
+    auto ok = check<u8"ij,jk,kl,l->i">(cache.value(), constant_planning_seconds);
+    auto i  = 0uz;
+    ((ok = check<estrs>(cache.value(), planning_seconds[i++]) and ok), ...);
+    return ok;
+}
+
+} // namespace
+
+int
+main() {
+    const auto path = std::filesystem::temp_directory_path() / "idg_bench_plan_cache.bin";
+    std::filesystem::remove(path);
+
+    auto ok = not idg::mapped_plan_cache::open(path).has_value();
+    if (not ok) { std::println("missing plan cache was not a cold start"); }
+
+    ok = check_catalogue<
+             // Direct loops.
+             u8"ij->ji",
+             u8"ijk,k->ij",
+             // Chains of pairwise steps.
+             u8"ij,jk,kl,lm->im",
+             u8"ac,apb,cpd->bd",
+             u8"ab,bc,cd,de,ef,fg->ag",
+             // Self contractions and outer products of connected components.
+             u8"iij,k->jk",
+             u8"ij,jk,lm,mn->ikln">(path)
+         and ok;
+
+    std::filesystem::remove(path);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+/* Benchmark of huge page backed, first touched tensor storage.
+ *
+ * Contracts "ijk,k->ij" with 2.1 GB A, partitioned over i to threads,
+ * using std::vector (4 KiB pages, touched by the main thread) and
+ * idg::tensor_buffer (huge pages, touched by the threads computing the rows).
+ **/
+
+#include <chrono>
+#include <cstddef>
+#include <print>
+#include <ranges>
+#include <string_view>
+#include <vector>
+
+#include <experimental/mdspan>
+
+#include "idg/einsum.hpp"
+#include "idg/sstd.hpp"
+#include "idg/tensor_allocator.hpp"
+
+namespace {
+
+constexpr auto D           = 640uz;
+constexpr auto repetitions = 5uz;
+
+template<typename Buffer>
+void contract(const std::string_view name, Buffer& A_buff, Buffer& out_buff) {
+    using clock = std::chrono::steady_clock;
+
+    auto x_buff = std::vector<double>(D, 1.0);
+    const auto A   = idg::sstd::geometric_mdspan<double, 3, D>(A_buff.data());
+    const auto x   = idg::sstd::geometric_mdspan<double, 1, D>(x_buff.data());
+    const auto out = idg::sstd::geometric_mdspan<double, 2, D>(out_buff.data());
+
+    const auto start = clock::now();
+    for ([[maybe_unused]] const auto _ : std::views::iota(0uz, repetitions)) {
+        idg::parallel_blocks(D, 0uz, [&](const std::size_t first, const std::size_t last) {
+            for (const auto i : std::views::iota(first, last)) {
+                idg::einsum<u8"jk,k->j">{}(std::submdspan(out, i, std::full_extent),
+                                           std::submdspan(A, i, std::full_extent, std::full_extent),
+                                           x);
+            }
+        });
+    }
+    const auto seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    const auto bytes = static_cast<double>(repetitions * (A_buff.size() + out_buff.size()))
+                       * sizeof(double);
+    std::println("{:>14}: {:.3f} s, {:.2f} GB/s", name, seconds, bytes / seconds * 1e-9);
+}
+
+} // namespace
+
+int
+main() {
+    std::println("ijk,k->ij with D = {}, A is {:.2f} GB, {} threads",
+                 D,
+                 static_cast<double>(D * D * D * sizeof(double)) * 1e-9,
+                 idg::default_number_of_threads());
+
+    {
+        auto A   = std::vector<double>(D * D * D, 1.0);
+        auto out = std::vector<double>(D * D);
+        contract("std::vector", A, out);
+    }
+    {
+        auto A   = idg::make_tensor_buffer<double, 3, D>();
+        auto out = idg::make_tensor_buffer<double, 2, D>();
+        std::ranges::fill(A, 1.0);
+        contract("tensor_buffer", A, out);
+    }
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+#pragma once
+/// @file Runtime detection of instruction set extensions for kernel dispatch.
+/*
+ * Kernels are compiled in multiple variants with [[gnu::target]] and the best variant
+ * supported by the running CPU is chosen once. Portable variant is always available,
+ * so binaries do not have to be compiled with -march=native.
+ *
+ * IDG_X86_DISPATCH is 1 when x86 variants are compiled.
+ **/
+
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#    define IDG_X86_DISPATCH 1
+#else
+#    define IDG_X86_DISPATCH 0
+#endif
+
+namespace idg {
+namespace cpu {
+
+/// Instruction set variants of kernels in increasing order of preference.
+enum class isa : std::uint8_t { portable = 0, sse4_2 = 1, avx2 = 2, avx512 = 3 };
+
+[[nodiscard]] constexpr std::string_view to_string_view(const isa i) {
+    switch (i) {
+        case isa::portable: return "portable";
+        case isa::sse4_2: return "sse4.2";
+        case isa::avx2: return "avx2";
+        case isa::avx512: return "avx512";
+    }
+    throw std::logic_error{ "Unknown isa." };
+}
+
+/// Best isa supported by the running CPU. Detected once on the first call.
+[[nodiscard]] inline isa
+detected_isa() noexcept {
+    static const auto detected = []() noexcept {
+#if IDG_X86_DISPATCH
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") and __builtin_cpu_supports("avx512bw")
+            and __builtin_cpu_supports("avx512vl")) {
+            return isa::avx512;
+        }
+        if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma")) { return isa::avx2; }
+        if (__builtin_cpu_supports("sse4.2")) { return isa::sse4_2; }
+#endif
+        return isa::portable;
+    }();
+    return detected;
+}
+
+/// Integer dot-product instructions, which are detected separately from the isa variants,
+/// since they are used only by quantized kernels (see idg/einsum_quantized.hpp).
+enum class dot_product_isa : std::uint8_t { none = 0, avx_vnni = 1, avx512_vnni = 2 };
+
+[[nodiscard]] constexpr std::string_view to_string_view(const dot_product_isa i) {
+    switch (i) {
+        case dot_product_isa::none: return "none";
+        case dot_product_isa::avx_vnni: return "avx-vnni";
+        case dot_product_isa::avx512_vnni: return "avx512-vnni";
+    }
+    throw std::logic_error{ "Unknown dot product isa." };
+}
+
+/// Best integer dot-product instructions supported by the running CPU. Detected once.
+[[nodiscard]] inline dot_product_isa detected_dot_product_isa() noexcept {
+    static const auto detected = []() noexcept {
+#if IDG_X86_DISPATCH
+        if (detected_isa() == isa::avx512 and __builtin_cpu_supports("avx512vnni")) {
+            return dot_product_isa::avx512_vnni;
+        }
+        if (detected_isa() >= isa::avx2 and __builtin_cpu_supports("avxvnni")) {
+            return dot_product_isa::avx_vnni;
+        }
+#endif
+        return dot_product_isa::none;
+    }();
+    return detected;
+}
+
+} // namespace cpu
+} // namespace idg
@@ -2,15 +2,24 @@
 /// @file Implements numpy einsum inspired functionality for mdspans.
 
 #include <algorithm>
+#include <array>
 #include <iterator>
+#include <optional>
 #include <ranges>
+#include <stdexcept>
 #include <string>
 #include <tuple>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include <experimental/mdspan>
 
+#include "idg/cpu_dispatch.hpp"
+#include "idg/einsum_explain.hpp"
+#include "idg/einsum_instrumentation.hpp"
+#include "idg/einsum_parser.hpp"
+#include "idg/einsum_plan.hpp"
 #include "idg/generic_algorithm.hpp"
 #include "idg/sstd.hpp"
 #include "idg/string_manipulation.hpp"
@@ -22,144 +31,13 @@ namespace rn = std::ranges;
 namespace rv = std::views;
 using namespace std::literals;
 
-class einsum_parser {
-  public:
-    using index_label             = std::u8string;
-    using factor_index_labels_vec = std::vector<index_label>;
-
-    /// Cursor concept borrowed from flux c++ library.
-    struct index_cursor {
-        std::size_t factor, index;
-        [[nodiscard]] constexpr bool operator==(const index_cursor&) const = default;
-    };
-
-    // constexpr std::[flat_]set is not implemented
-    using contraction = sstd::constexpr_set<index_cursor>;
-
-  private:
-    std::vector<factor_index_labels_vec> factor_index_labels_{};
-    factor_index_labels_vec output_index_labels_{};
-
-    factor_index_labels_vec free_index_labels_{};
-    std::vector<contraction> contractions_{};
-
-    [[nodiscard]] constexpr auto iterate_index_labels_with_cursor(this auto&& self) {
-        return self.factor_index_labels_ | rv::enumerate | rv::transform([](const auto& t) {
-                   const auto factor_ordinal       = static_cast<std::size_t>(std::get<0>(t));
-                   const auto& factor_index_labels = std::get<1>(t);
-                   auto cursors                    = rv::iota(0uz, rn::size(factor_index_labels))
-                                  | rv::transform([=](const std::size_t i) {
-                                        return index_cursor{ factor_ordinal, i };
-                                    });
-                   return rv::zip(cursors, factor_index_labels);
-               })
-               | rv::join;
-    };
-
-    [[nodiscard]] static constexpr rn::view auto split_to_index_labels(rn::view auto const str) {
-        return rv::all(str) | rv::transform([](const auto x) { return std::u8string{ x }; });
-    }
-
-  public:
-    [[nodiscard]] constexpr einsum_parser(const std::u8string_view str) {
-        auto factor_and_maybe_output_index_labels =
-            str | rv::filter([](const char8_t c) { return not str::is_whitespace(c); })
-            | rv::split(u8"->"sv);
-
-        for (const auto factor_str :
-             *factor_and_maybe_output_index_labels.begin() | rv::split(u8',')) {
-            factor_index_labels_.push_back({});
-
-            for (const auto x : split_to_index_labels(factor_str)) {
-                factor_index_labels_.back().push_back(std::move(x));
-            }
-        }
-
-        // Fill contractions_:
-
-        // std::size_t represent the ordinal of the contraction corresponding to the index label.
-        // index_cursor stores the first time the label is encountered.
-        auto seen_labels = std::vector<std::tuple<index_label, std::size_t, index_cursor>>{};
-        // When label is encountered first time, this is used as contraction ordinal.
-        static constexpr std::size_t not_contraction = static_cast<std::size_t>(-1);
-
-        rn::for_each(iterate_index_labels_with_cursor(), [&](const auto t) {
-            const auto cursor = std::get<0>(t);
-            const auto label  = std::get<1>(t);
-
-            const auto get_label = [](const auto t) { return std::get<0>(t); };
-            const auto prev      = rn::find(seen_labels, label, get_label);
-
-            if (prev == seen_labels.end()) {
-                // First time.
-                seen_labels.push_back({ label, not_contraction, cursor });
-            } else {
-                const auto second_time = std::get<1>(*prev) == not_contraction;
-
-                if (second_time) {
-                    std::get<1>(*prev) = std::size(contractions_);
-                    contractions_.push_back({});
-                    std::ignore = contractions_.back().successfully_insert(std::get<2>(*prev));
-                }
-
-                if (not contractions_[std::get<1>(*prev)].successfully_insert(cursor)) {
-                    throw std::logic_error{ "Each cursor should only appear once." };
-                }
-            }
-        });
-
-        // Figure out free index labels.
-        rn::copy(seen_labels | rv::filter([](const auto t) {
-                     return not_contraction == std::get<1>(t);
-                 }) | rv::transform([](const auto t) { return std::get<0>(t); }),
-                 std::back_inserter(free_index_labels_));
-
-        if (rn::distance(factor_and_maybe_output_index_labels) == 1) {
-            // Implicit return indices.
-            output_index_labels_ = free_index_labels_;
-
-        } else if (rn::distance(factor_and_maybe_output_index_labels) == 2) {
-            // Explicit return indices.
-            const auto return_str = *rn::next(rn::begin(factor_and_maybe_output_index_labels));
-            rn::copy(split_to_index_labels(return_str), std::back_inserter(output_index_labels_));
-        } else {
-            // Error.
-            throw std::logic_error{ "-> can only appear once." };
-        }
-    }
-
-    [[nodiscard]] constexpr std::size_t number_of_factors(this auto&& self) {
-        return self.factor_index_labels_.size();
-    };
-
-    [[nodiscard]] constexpr std::span<factor_index_labels_vec const>
-        factor_index_labels(this auto&& self) {
-        return { self.factor_index_labels_ };
-    }
-
-    [[nodiscard]] constexpr std::span<const contraction> contractions(this auto&& self) {
-        return { self.contractions_ };
-    }
-
-    [[nodiscard]] constexpr std::span<const index_label> output_index_labels(this auto&& self) {
-        return { self.output_index_labels_ };
-    }
-
-    [[nodiscard]] constexpr std::span<const index_label> free_index_labels(this auto&& self) {
-        return { self.free_index_labels_ };
-    }
-};
-
 template<typename OutMDS>
-[[nodiscard]] constexpr bool einsum_valid_ouput_type(const std::u8string_view estr) {
-    const auto parser = einsum_parser(estr);
+[[nodiscard]] constexpr bool einsum_valid_ouput_type(const parsed_einsum& parser) {
     return rn::size(parser.output_index_labels()) == OutMDS::rank();
 }
 
 template<typename... MDS>
-[[nodiscard]] constexpr bool einsum_valid_factor_types(const std::u8string_view estr) {
-    const auto parser = einsum_parser(estr);
-
+[[nodiscard]] constexpr bool einsum_valid_factor_types(const parsed_einsum& parser) {
     if (sizeof...(MDS) != parser.number_of_factors()) { return false; }
 
     return std::invoke(
@@ -177,13 +55,16 @@ template<typename... MDS>
     };
 
     const auto mds_dim = [&]<typename M>(std::type_identity<M>) -> mds_dim_result {
-        if (M::rank() == 0) { return { .dim = std::nullopt, .consistent{ true } }; }
+        // Dynamic extents (e.g. of submdspan results) are checked at runtime.
+        auto static_extents = rv::iota(0uz, M::rank())
+                              | rv::transform([](const auto i) { return M::static_extent(i); })
+                              | rv::filter([](const auto e) { return e != std::dynamic_extent; });
 
-        const auto found_dim = M::static_extent(0);
-        for (const auto i : rv::iota(1uz, M::rank())) {
-            if (M::static_extent(i) != found_dim) {
-                return { .dim = std::nullopt, .consistent{ false } };
-            }
+        if (rn::empty(static_extents)) { return { .dim = std::nullopt, .consistent{ true } }; }
+
+        const auto found_dim = *rn::begin(static_extents);
+        if (not rn::all_of(static_extents, [&](const auto e) { return e == found_dim; })) {
+            return { .dim = std::nullopt, .consistent{ false } };
         }
 
         if (found_dim == 0) { return { .dim = 0, .consistent = false }; }
@@ -197,7 +78,8 @@ template<typename... MDS>
     auto found_dims_wout_rank0s =
         found_dims | rv::filter([](const auto x) { return x.has_value(); });
 
-    if (rn::distance(found_dims_wout_rank0s) == 0) { return true; }
+    // Dimension has to be known at compile time, so some extent has to be static.
+    if (rn::distance(found_dims_wout_rank0s) == 0) { return ((MDS::rank() == 0uz) and ...); }
     return rn::max(found_dims_wout_rank0s) == rn::min(found_dims_wout_rank0s);
 };
 
@@ -209,95 +91,195 @@ concept static_extent_mdspan =
                            | rv::transform([](const auto i) { return MDS::static_extent(i); }),
                        [](const auto e) { return e != std::dynamic_extent; }));
 
+/// Operands may be any mdspans (e.g. std::submdspan results with layout_stride),
+/// as long as the dimension can be deduced from their static extents.
 template<str::fixed_string estr, typename OutMDS, typename... MDS>
-concept einsum_compatible = (static_extent_mdspan<std::remove_cvref_t<OutMDS>> and ...
-                             and static_extent_mdspan<std::remove_cvref_t<MDS>>)
+concept einsum_compatible = (sstd::is_mdspan_v<std::remove_cvref_t<OutMDS>> and ...
+                             and sstd::is_mdspan_v<std::remove_cvref_t<MDS>>)
                             and (einsum_consistent_geometric_dimentions<OutMDS, MDS...>())
-                            and (einsum_valid_ouput_type<OutMDS>(estr.sv()))
-                            and (einsum_valid_factor_types<MDS...>(estr.sv()));
+                            and (einsum_valid_ouput_type<OutMDS>(parsed_einsum_v<estr>))
+                            and (einsum_valid_factor_types<MDS...>(parsed_einsum_v<estr>));
 
-template<str::fixed_string estr>
-class einsum {
-    static constexpr einsum_parser parser() { return einsum_parser(estr.sv()); }
-
-    [[nodiscard]] static constexpr std::pair<std::vector<tensor_network::node_id>, tensor_network>
-        network() {
-        auto net = tensor_network();
-        auto p   = parser();
+/// Every extent of \p mds is \p dim, which is needed to be checked only for dynamic extents.
+template<typename MDS>
+[[nodiscard]] constexpr bool has_geometric_extents(const MDS& mds, const std::size_t dim) {
+    return rn::all_of(rv::iota(0uz, MDS::rank()), [&](const auto i) {
+        return static_cast<std::size_t>(mds.extent(i)) == dim;
+    });
+}
 
-        const auto id_vec = p.factor_index_labels() | rv::transform(rn::size)
-                            | rv::transform([&](const auto r) { return net.add_node(r); })
-                            | rn::to<std::vector>();
+template<typename F>
+constexpr void with_specialized_inner_strides(F&& f) {
+    std::invoke(f);
+}
 
-        for (const auto& contraction : p.contractions()) {
-            const auto indices = contraction.get_data();
-            if (rn::size(indices) != 2) {
-                throw std::logic_error{ "Reuction has to have to connect two indices." };
-            }
-            const auto [lhs_factor, lhs_index] = indices[0];
-            const auto [rhs_factor, rhs_index] = indices[1];
+/// Calls \p f(head, tail...) such that layout_stride mdspans whose innermost stride is one
+/// are passed as sstd::layout_unit_inner_stride mdspans.
+///
+/// So kernels are instantiated for both cases and slices which are contiguous
+/// in their last index (e.g. submdspan(A, full_extent, t, full_extent))
+/// get the same innermost loop as contiguous tensors.
+template<typename F, typename Head, typename... Tail>
+constexpr void with_specialized_inner_strides(F&& f, Head head, Tail... tail) {
+    const auto rest = [&](const auto h) {
+        with_specialized_inner_strides([&](const auto... t) { std::invoke(f, h, t...); },
+                                       tail...);
+    };
 
-            net.add_edge({ id_vec[lhs_factor], lhs_index }, { id_vec[rhs_factor], rhs_index });
+    if constexpr (std::is_same_v<typename Head::layout_type, std::layout_stride>
+                  and Head::rank() != 0uz) {
+        if (head.stride(Head::rank() - 1uz) == 1) {
+            rest(sstd::with_unit_inner_stride(head));
+            return;
         }
-        return { id_vec, net };
+    }
+    rest(head);
+}
+
+/// Einsum of mdspans described by \p estr.
+///
+/// \p Instrumentation is a compile-time policy (see idg/einsum_instrumentation.hpp)
+/// which is used to record execution of each pairwise contraction and the outer product.
+template<str::fixed_string estr, typename Instrumentation = no_instrumentation>
+class einsum {
+    /// Structure of the einsum, parsed once for each estr.
+    static constexpr const parsed_einsum& parser() { return parsed_einsum_v<estr>; }
+
+    [[nodiscard]] static constexpr std::pair<std::vector<tensor_network::node_id>, tensor_network>
+        network() {
+        return einsum_network(parser());
     }
 
+  public:
     /// Deduce dimension from T... mdspans which are assumed to satisfy einsum_compatible.
     ///
-    /// Finds first non rank-0 mdspan and returns it's static_extent(0).
+    /// Finds first static extent of the mdspans, dynamic extents are skipped.
     /// If all mdspans are rank-0, choose the dimension to be 1.
     template<typename... T>
     static constexpr std::size_t deduce_dimension() {
-        return []<typename Head, typename... Tail>(this auto&& self,
-                                                   std::type_identity<Head>,
-                                                   std::type_identity<Tail>...) -> std::size_t {
-            if constexpr (Head::rank() != 0) {
-                return Head::static_extent(0);
-            } else if constexpr (0 == sizeof...(Tail)) {
-                // OutMDS and every MDS... (i.e. T...) is rank 0,
-                // so we set dimension to one.
-                return 1uz;
-            } else {
-                return self.template operator()(std::type_identity<Tail>{}...);
+        auto dim        = std::optional<std::size_t>{};
+        const auto find = [&]<typename M>(std::type_identity<M>) {
+            for (const auto i : rv::iota(0uz, M::rank())) {
+                if (not dim and M::static_extent(i) != std::dynamic_extent) {
+                    dim = M::static_extent(i);
+                }
             }
-        }(std::type_identity<T>{}...);
+        };
+        (find(std::type_identity<T>{}), ...);
+
+        // OutMDS and every MDS... (i.e. T...) is rank 0, so we set dimension to one.
+        return dim.value_or(1uz);
+    }
+
+    /// Einsums with at most two factors or without contractions are executed as one loop.
+    [[nodiscard]] static constexpr bool executes_directly() {
+        return parser().number_of_factors() <= 2uz or rn::empty(parser().contractions());
+    }
+
+    /// Einsums with one factor and no contractions (e.g. "ijk->kji") only permute indices.
+    [[nodiscard]] static constexpr bool is_permutation() {
+        const auto& p = parser();
+        return p.number_of_factors() == 1uz and rn::empty(p.contractions())
+               and rn::size(p.output_index_labels()) == rn::size(p.factor_index_labels()[0]);
     }
 
-  public:
     static constexpr std::size_t rank() {
-        return rn::distance(einsum_parser(estr.sv()).free_index_labels());
+        return rn::size(parser().free_index_labels());
     };
 
+    /// Number of connected components in the tensor network of the factors.
+    static constexpr std::size_t number_of_connected_components = std::invoke([] {
+        const auto [_, net] = network();
+        return rn::size(net.connected_components());
+    });
+
+    /// Einsum string of self contractions of factor \p F, which is one node connected component.
+    template<std::size_t F>
+    static constexpr auto self_contraction_estr = std::invoke([] {
+        const auto& p = parser();
+        auto s        = std::u8string{};
+        for (const auto& label : p.factor_index_labels()[F]) { s += label; }
+        return str::fixed_string{ s };
+    });
+
+    /// Einsum string of the outer product of the outputs of the connected components.
+    static constexpr auto outer_product_estr = std::invoke([] {
+        const auto& p                = parser();
+        const auto free_index_labels = p.free_index_labels();
+        const auto [_, net]          = network();
+        const auto components        = net.connected_components();
+
+        auto str        = std::u8string{};
+        auto next_label = 0uz;
+
+        // gcc 14 gives goto is not a constant expression error??
+        // for (const auto i : rv::iota(0uz, number_of_connected_components)) {
+        for (auto i = 0uz; i < number_of_connected_components; ++i) {
+            for (const auto _ : rv::iota(0uz, components[i].rank())) {
+                str += free_index_labels[next_label++];
+            }
+            if (i != number_of_connected_components - 1uz) { str += u8','; }
+        }
+
+        str += u8"->";
+        for (const auto& c : p.output_index_labels()) { str += c; }
+
+        return str::fixed_string{ str };
+    });
+
+    /// Explains how einsum is executed with dimension \p D, see idg/einsum_explain.hpp.
+    [[nodiscard]] static constexpr plan_explanation
+        explain(const std::size_t D, const std::size_t element_size = sizeof(double)) {
+        if constexpr (not executes_directly()) {
+            return idg::explain(einsum_plan(parser(), D), element_size);
+        } else {
+            const auto& p = parser();
+
+            auto s       = std::u8string{};
+            auto touched = 0uz;
+            for (const auto& factor_labels : p.factor_index_labels()) {
+                if (not s.empty()) { s += u8','; }
+                for (const auto& l : factor_labels) { s += l; }
+                touched += sstd::integer_pow(D, rn::size(factor_labels));
+            }
+            s += u8"->";
+            for (const auto& l : p.output_index_labels()) { s += l; }
+
+            const auto out_rank = rn::size(p.output_index_labels());
+            touched += sstd::integer_pow(D, out_rank);
+
+            auto e = plan_explanation{ .dimension = D };
+            e.steps.push_back(explain_impl::make_step(
+                einsum_operation::direct_loop,
+                0uz,
+                std::move(s),
+                out_rank,
+                sstd::integer_pow(D, out_rank + rn::size(p.contractions())),
+                p.number_of_factors() - 1uz,
+                touched,
+                D,
+                element_size,
+                is_permutation() ? contraction_kernel::permutation
+                                 : contraction_kernel::generic_loop));
+            // Permutation only copies.
+            if (is_permutation()) { e.steps.front().flops = 0uz; }
+            e.flops = e.steps.front().flops;
+            e.bytes = e.steps.front().bytes;
+            return e;
+        }
+    }
+
     // Given a element from output index space and a element from contraction index space,
     // which are concatted together. This tuple holds indices to the concatted elements
     // for each factor.
     static constexpr auto index_map = std::invoke([] {
-        static constexpr auto number_of_contractions = rn::size(parser().contractions());
-        const auto find_contraction =
-            [&](const std::size_t factor_ordinal,
-                const std::size_t index_rank) -> std::optional<std::size_t> {
-            for (const auto i : rv::iota(0uz, number_of_contractions)) {
-                if (parser().contractions()[i].contains({ factor_ordinal, index_rank })) {
-                    return i;
-                }
-            }
-            return {};
-        };
-
         const auto handle_factor = [&]<std::size_t J>(std::integral_constant<std::size_t, J>) {
             constexpr auto this_factor_rank = rn::size(parser().factor_index_labels()[J]);
             auto this_factor_index_map      = std::array<std::size_t, this_factor_rank>{};
 
-            for (const auto i : rv::iota(0uz, this_factor_rank)) {
-                if (const auto contraction_ordinal = find_contraction(J, i)) {
-                    this_factor_index_map[i] =
-                        rn::size(parser().output_index_labels()) + contraction_ordinal.value();
-                } else {
-                    // .value() should newer throw.
-                    this_factor_index_map[i] = alg::argfind(parser().output_index_labels(),
-                                                            parser().factor_index_labels()[J][i])
-                                                   .value();
-                }
+            rn::copy(parser().factor_index_map(J), this_factor_index_map.begin());
+            if (rn::contains(this_factor_index_map, parsed_einsum::not_mapped)) {
+                throw std::logic_error{ "Free index label does not appear in the output." };
             }
             return this_factor_index_map;
         };
@@ -342,76 +324,350 @@ class einsum {
             std::make_index_sequence<rn::size(parser().factor_index_labels())>());
     }
 
+    /// Single loop over output and contraction index spaces.
     template<typename OutMDS, typename... MDS>
-        requires einsum_compatible<estr, OutMDS, MDS...>
-    static constexpr void operator()(OutMDS out, MDS... factors) {
+    static constexpr void direct_loop(OutMDS out, MDS... factors) {
         static constexpr auto number_of_free_indices = OutMDS::rank();
         static constexpr auto dimension              = einsum::deduce_dimension<OutMDS, MDS...>();
 
-        [[maybe_unused]] static constexpr auto number_of_connected_components = std::invoke([] {
-            const auto [_, net] = network();
-            return rn::size(net.connected_components());
-        });
+        // static constexpr auto contraction_index_space =
+        //     sstd::geometric_index_space<rn::size(parser().contractions()), dimension>();
 
-        static constexpr auto needs_optimization =
-            sizeof...(factors) <= 2uz or rn::empty(parser().contractions());
-        if constexpr (needs_optimization) {
-            // static constexpr auto contraction_index_space =
-            //     sstd::geometric_index_space<rn::size(parser().contractions()), dimension>();
-
-            // static constexpr auto out_index_space =
-            //     sstd::geometric_index_space<number_of_free_indices, dimension>();
-
-            // Technically we could use std::execution::unseq policy with std::for_each,
-            // but it requires tbb dependency on gcc and
-            // the calculation gets optimized anyway.
-            // rn::for_each(out_index_space, handle_output_index_space_element);
-
-            static constexpr auto out_index_space_length =
-                sstd::integer_pow(dimension, number_of_free_indices);
-            static constexpr auto out_index_space_dividers = std::invoke(
-                []<std::size_t... I>(std::index_sequence<I...>) {
-                    return std::array<std::size_t, number_of_free_indices>{ sstd::integer_pow(
-                        dimension,
-                        static_cast<std::size_t>(number_of_free_indices - 1uz - I))... };
-                },
-                std::make_index_sequence<number_of_free_indices>());
-
-            static constexpr auto number_of_contractions = rn::size(parser().contractions());
-            static constexpr auto contraction_index_space_length =
-                sstd::integer_pow(dimension, number_of_contractions);
-            static constexpr auto contraction_index_space_dividers = std::invoke(
-                []<std::size_t... I>(std::index_sequence<I...>) {
-                    return std::array<std::size_t, number_of_contractions>{ sstd::integer_pow(
-                        dimension,
-                        static_cast<std::size_t>(number_of_contractions - 1uz - I))... };
-                },
-                std::make_index_sequence<number_of_contractions>());
+        // static constexpr auto out_index_space =
+        //     sstd::geometric_index_space<number_of_free_indices, dimension>();
+
+        // Technically we could use std::execution::unseq policy with std::for_each,
+        // but it requires tbb dependency on gcc and
+        // the calculation gets optimized anyway.
+        // rn::for_each(out_index_space, handle_output_index_space_element);
 
-            for (const auto i : rv::iota(0uz, out_index_space_length)) {
-                auto out_idx = std::array<std::size_t, number_of_free_indices>{};
-                for (const auto ii : rv::iota(0uz, out_idx.size())) {
-                    out_idx[ii] = (i / out_index_space_dividers[ii]) % dimension;
+        static constexpr auto out_index_space_length =
+            sstd::integer_pow(dimension, number_of_free_indices);
+        static constexpr auto out_index_space_dividers = std::invoke(
+            []<std::size_t... I>(std::index_sequence<I...>) {
+                return std::array<std::size_t, number_of_free_indices>{ sstd::integer_pow(
+                    dimension,
+                    static_cast<std::size_t>(number_of_free_indices - 1uz - I))... };
+            },
+            std::make_index_sequence<number_of_free_indices>());
+
+        static constexpr auto number_of_contractions = rn::size(parser().contractions());
+        static constexpr auto contraction_index_space_length =
+            sstd::integer_pow(dimension, number_of_contractions);
+        static constexpr auto contraction_index_space_dividers = std::invoke(
+            []<std::size_t... I>(std::index_sequence<I...>) {
+                return std::array<std::size_t, number_of_contractions>{ sstd::integer_pow(
+                    dimension,
+                    static_cast<std::size_t>(number_of_contractions - 1uz - I))... };
+            },
+            std::make_index_sequence<number_of_contractions>());
+
+        for (const auto i : rv::iota(0uz, out_index_space_length)) {
+            auto out_idx = std::array<std::size_t, number_of_free_indices>{};
+            for (const auto ii : rv::iota(0uz, out_idx.size())) {
+                out_idx[ii] = (i / out_index_space_dividers[ii]) % dimension;
+            }
+
+            out[out_idx] = typename OutMDS::value_type{};
+
+            for (const auto j : rv::iota(0uz, contraction_index_space_length)) {
+                auto contraction_idx = std::array<std::size_t, number_of_contractions>{};
+                for (const auto jj : rv::iota(0uz, contraction_idx.size())) {
+                    contraction_idx[jj] =
+                        (j / contraction_index_space_dividers[jj]) % dimension;
                 }
 
-                out[out_idx] = typename OutMDS::value_type{};
+                const auto sorted_indices = apply_index_map(out_idx, contraction_idx);
 
-                for (const auto j : rv::iota(0uz, contraction_index_space_length)) {
-                    auto contraction_idx = std::array<std::size_t, number_of_contractions>{};
-                    for (const auto jj : rv::iota(0uz, contraction_idx.size())) {
-                        contraction_idx[jj] =
-                            (j / contraction_index_space_dividers[jj]) % dimension;
+                out[out_idx] += std::invoke(
+                    [&]<std::size_t... I>(std::index_sequence<I...>) {
+                        return (factors[std::get<I>(sorted_indices)] * ...);
+                    },
+                    std::make_index_sequence<parser().number_of_factors()>());
+            }
+        }
+    }
+
+    /// Maps i:th index of the output to the index of the factor with the same label.
+    static constexpr auto permutation = std::invoke([] {
+        constexpr auto r = rn::size(parser().output_index_labels());
+        const auto& p    = parser();
+
+        auto perm = std::array<std::size_t, r>{};
+        if constexpr (is_permutation()) {
+            for (const auto i : rv::iota(0uz, r)) {
+                // .value() should never throw.
+                perm[i] =
+                    alg::argfind(p.factor_index_labels()[0], p.output_index_labels()[i]).value();
+            }
+        }
+        return perm;
+    });
+
+    /// Cache-oblivious permutation of \p in to \p out.
+    ///
+    /// Output index space is split recursively along its longest side until a block
+    /// of both the output and the input fits in L1, so neither of them is accessed
+    /// with large strides, whatever the permutation and the dimension are.
+    template<typename OutMDS, typename InMDS>
+    static constexpr void permute(OutMDS out, InMDS in) {
+        static constexpr auto r         = OutMDS::rank();
+        static constexpr auto dimension = einsum::deduce_dimension<OutMDS, InMDS>();
+        // Half of 32 KiB L1 for the block of the output and the other for the input.
+        static constexpr auto block_elements =
+            16uz * 1024uz / sizeof(typename OutMDS::element_type);
+
+        using index = std::array<std::size_t, r>;
+
+        const auto copy_block = [&](const index& lo, const index& hi) {
+            auto out_idx = lo;
+            auto in_idx  = index{};
+            for (auto done = false; not done;) {
+                for (const auto k : rv::iota(0uz, r)) { in_idx[permutation[k]] = out_idx[k]; }
+                out[out_idx] = in[in_idx];
+
+                // Next index in row-major order of the block.
+                done = true;
+                for (auto k = r; k-- > 0uz;) {
+                    if (++out_idx[k] < hi[k]) {
+                        done = false;
+                        break;
                     }
+                    out_idx[k] = lo[k];
+                }
+            }
+        };
 
-                    const auto sorted_indices = apply_index_map(out_idx, contraction_idx);
+        const auto split = [&](this auto&& self, const index& lo, const index& hi) -> void {
+            auto block_size = 1uz;
+            auto longest    = 0uz;
+            for (const auto k : rv::iota(0uz, r)) {
+                block_size *= hi[k] - lo[k];
+                if (hi[k] - lo[k] > hi[longest] - lo[longest]) { longest = k; }
+            }
 
-                    out[out_idx] += std::invoke(
-                        [&]<std::size_t... I>(std::index_sequence<I...>) {
-                            return (factors[std::get<I>(sorted_indices)] * ...);
-                        },
-                        std::make_index_sequence<parser().number_of_factors()>());
+            if (block_size <= block_elements) {
+                copy_block(lo, hi);
+                return;
+            }
+
+            const auto mid    = lo[longest] + (hi[longest] - lo[longest]) / 2uz;
+            auto lower_hi     = hi;
+            auto upper_lo     = lo;
+            lower_hi[longest] = mid;
+            upper_lo[longest] = mid;
+            self(lo, lower_hi);
+            self(upper_lo, hi);
+        };
+
+        auto whole = index{};
+        rn::fill(whole, dimension);
+        split(index{}, whole);
+    }
+
+#if IDG_X86_DISPATCH
+    // Variants of direct_loop for runtime dispatch, flatten inlines direct_loop to them.
+
+    template<typename OutMDS, typename... MDS>
+    [[gnu::target("sse4.2"), gnu::flatten]]
+    static void direct_loop_sse4_2(OutMDS out, MDS... factors) {
+        direct_loop(out, factors...);
+    }
+
+    template<typename OutMDS, typename... MDS>
+    [[gnu::target("avx2,fma"), gnu::flatten]]
+    static void direct_loop_avx2(OutMDS out, MDS... factors) {
+        direct_loop(out, factors...);
+    }
+
+    template<typename OutMDS, typename... MDS>
+    [[gnu::target("avx512f,avx512bw,avx512vl,avx2,fma"), gnu::flatten]]
+    static void direct_loop_avx512(OutMDS out, MDS... factors) {
+        direct_loop(out, factors...);
+    }
+#endif
+
+    /// Calls variant of direct_loop for cpu::detected_isa() chosen on the first call.
+    template<typename OutMDS, typename... MDS>
+    static void dispatched_direct_loop(OutMDS out, MDS... factors) {
+        using kernel_ptr               = void (*)(OutMDS, MDS...);
+        static const kernel_ptr kernel = []() -> kernel_ptr {
+#if IDG_X86_DISPATCH
+            switch (cpu::detected_isa()) {
+                case cpu::isa::avx512: return &direct_loop_avx512<OutMDS, MDS...>;
+                case cpu::isa::avx2: return &direct_loop_avx2<OutMDS, MDS...>;
+                case cpu::isa::sse4_2: return &direct_loop_sse4_2<OutMDS, MDS...>;
+                case cpu::isa::portable: break;
+            }
+#endif
+            return &direct_loop<OutMDS, MDS...>;
+        }();
+        kernel(out, factors...);
+    }
+
+    /// Fixes indices of \p mds whose labels are in \p outer_labels to the values in \p outer.
+    ///
+    /// Index with label \p labels[i] is fixed to outer[k] if it is \p outer_labels[k].
+    template<str::fixed_string labels, str::fixed_string outer_labels>
+    static constexpr auto slice_outer(const auto& mds, const auto& outer) {
+        static constexpr auto fixed = std::invoke([] {
+            auto arr = std::array<std::optional<std::size_t>, labels.sv().size()>{};
+            for (const auto [i, c] : labels.sv() | rv::enumerate) {
+                arr[i] = alg::argfind(outer_labels.sv(), c);
+            }
+            return arr;
+        });
+
+        return std::invoke(
+            [&]<std::size_t... I>(std::index_sequence<I...>) {
+                const auto slice = [&]<std::size_t J>() {
+                    if constexpr (fixed[J].has_value()) {
+                        return outer[fixed[J].value()];
+                    } else {
+                        return std::full_extent;
+                    }
+                };
+                return std::submdspan(mds, slice.template operator()<I>()...);
+            },
+            std::make_index_sequence<fixed.size()>());
+    }
+
+    struct connected_component_info {
+        std::size_t rank;
+        std::size_t number_of_contractions;
+        // Ordinal of the factor which corresponds to the one node connected component.
+        // Empty optional corresponds to case C) of operator().
+        std::optional<std::size_t> one_node_factor_ordinal;
+
+        [[nodiscard]] constexpr std::size_t out_buff_size(const std::size_t D) const {
+            if (number_of_contractions == 0uz) {
+                return 0uz;
+            } else {
+                return sstd::integer_pow(D, rank);
+            }
+        }
+        [[nodiscard]] constexpr bool case_A() const {
+            return one_node_factor_ordinal.has_value() and number_of_contractions == 0uz;
+        }
+
+        [[nodiscard]] constexpr bool case_B() const {
+            return one_node_factor_ordinal.has_value() and number_of_contractions != 0uz;
+        }
+
+        [[nodiscard]] constexpr bool case_C() const {
+            return not one_node_factor_ordinal.has_value();
+        }
+    };
+
+    /// Strings of step_fusion, stored to the second step of the fused pair.
+    struct fusion_info {
+        str::fixed_string first_estr{ u8"to be replaced" };
+        str::fixed_string second_estr{ u8"to be replaced" };
+        str::fixed_string first_lhs_labels{ u8"to be replaced" };
+        str::fixed_string first_rhs_labels{ u8"to be replaced" };
+        str::fixed_string first_outer_labels{ u8"to be replaced" };
+        str::fixed_string second_out_labels{ u8"to be replaced" };
+        str::fixed_string second_outer_labels{ u8"to be replaced" };
+    };
+
+    struct pairwise_contraction_info {
+        std::size_t out_register, out_register_rank, lhs_register, rhs_register;
+        str::fixed_string einsum_str{ u8"to be replaced" };
+        // Rank of the buffer of out register, which is smaller for fused steps.
+        std::size_t buffer_rank{ out_register_rank };
+        bool fused_with_next{ false };
+        bool fused_with_previous{ false };
+        fusion_info fusion{};
+    };
+
+    /// Connected component of multiple nodes has one pairwise contraction less than nodes.
+    static constexpr std::size_t max_pairwise_contractions =
+        std::max(2uz, parser().number_of_factors()) - 1uz;
+
+    /// Plan of operator() for dimension \p D in fixed size tables.
+    ///
+    /// Planned once per dimension and shared by all operand types,
+    /// so einsum_plan is evaluated once instead of once per connected component.
+    template<std::size_t D>
+    static constexpr auto compiled_plan = std::invoke([] {
+        using steps_array = std::array<pairwise_contraction_info, max_pairwise_contractions>;
+        struct {
+            std::array<connected_component_info, number_of_connected_components> components{};
+            std::array<steps_array, number_of_connected_components> steps{};
+        } compiled{};
+
+        const auto plan = einsum_plan(parser(), D);
+
+        for (const auto& [i, c] : plan.components() | rv::enumerate) {
+            compiled.components[i] = connected_component_info{
+                .rank                    = c.rank,
+                .number_of_contractions  = c.number_of_contractions,
+                .one_node_factor_ordinal = c.one_node_factor_ordinal
+            };
+
+            auto& arr = compiled.steps[i];
+            for (const auto& [n, step] : c.steps | rv::enumerate) {
+                const auto s = step.lhs_labels + u8"," + step.rhs_labels;
+                arr[n]       = { .out_register      = step.out_register,
+                                 .out_register_rank = step.out_rank,
+                                 .lhs_register      = step.lhs_register,
+                                 .rhs_register      = step.rhs_register,
+                                 .einsum_str        = str::fixed_string(s),
+                                 .buffer_rank       = step.out_rank,
+                                 .fused_with_next   = step.fused_with_next };
+
+                if (step.kernel == contraction_kernel::fused_loop) {
+                    const auto& prev = c.steps[static_cast<std::size_t>(n) - 1uz];
+                    const auto f     = fuse_steps(prev, step).value();
+
+                    auto& fusion               = arr[n].fusion;
+                    fusion.first_estr          = str::fixed_string(f.first_estr);
+                    fusion.second_estr         = str::fixed_string(f.second_estr);
+                    fusion.first_lhs_labels    = str::fixed_string(prev.lhs_labels);
+                    fusion.first_rhs_labels    = str::fixed_string(prev.rhs_labels);
+                    fusion.first_outer_labels  = str::fixed_string(f.first_outer_labels);
+                    fusion.second_out_labels   = str::fixed_string(f.second_out_labels);
+                    fusion.second_outer_labels = str::fixed_string(f.second_outer_labels);
+
+                    arr[n].fused_with_previous = true;
+                    arr[n - 1].buffer_rank     = f.intermediate_rank;
                 }
             }
+        }
+
+        return compiled;
+    });
+
+    template<typename OutMDS, typename... MDS>
+        requires einsum_compatible<estr, OutMDS, MDS...>
+    static constexpr void operator()(OutMDS out, MDS... factors) {
+        static constexpr auto dimension = einsum::deduce_dimension<OutMDS, MDS...>();
+
+        if constexpr (not(static_extent_mdspan<OutMDS> and ... and static_extent_mdspan<MDS>)) {
+            if (not(has_geometric_extents(out, dimension) and ...
+                    and has_geometric_extents(factors, dimension))) {
+                throw std::logic_error{ "Dynamic extent does not match the einsum dimension." };
+            }
+        }
+
+        if constexpr (is_permutation()) {
+            [[maybe_unused]] const auto scope =
+                typename Instrumentation::scope(einsum_operation::direct_loop, 0uz, estr.sv());
+
+            with_specialized_inner_strides(
+                [](const auto o, const auto... f) { permute(o, f...); }, out, factors...);
+        } else if constexpr (executes_directly()) {
+            [[maybe_unused]] const auto scope =
+                typename Instrumentation::scope(einsum_operation::direct_loop, 0uz, estr.sv());
+
+            if consteval {
+                direct_loop(out, factors...);
+            } else {
+                with_specialized_inner_strides(
+                    [](const auto o, const auto... f) { dispatched_direct_loop(o, f...); },
+                    out,
+                    factors...);
+            }
         } else {
             // There are three different connected component types:
             //
@@ -430,65 +686,17 @@ class einsum {
             // then its output mdspan will be the overall out mdspan
             // and the outer product of the components is not needed.
 
-            struct connected_component_info {
-                std::size_t rank;
-                std::size_t number_of_contractions;
-                // Ordinal of the factor which corresponds to the one node connected component.
-                // Empty optional corresponds to case C).
-                std::optional<std::size_t> one_node_factor_ordinal;
-
-                [[nodiscard]] constexpr std::size_t out_buff_size(const std::size_t D) const {
-                    if (number_of_contractions == 0uz) {
-                        return 0uz;
-                    } else {
-                        return sstd::integer_pow(D, rank);
-                    }
-                }
-                [[nodiscard]] constexpr bool case_A() const {
-                    return one_node_factor_ordinal.has_value() and number_of_contractions == 0uz;
-                }
-
-                [[nodiscard]] constexpr bool case_B() const {
-                    return one_node_factor_ordinal.has_value() and number_of_contractions != 0uz;
-                }
-
-                [[nodiscard]] constexpr bool case_C() const {
-                    return not one_node_factor_ordinal.has_value();
-                }
-            };
-
-            static constexpr auto connected_component_infos = std::invoke([&] {
-                const auto [id_vec, net] = network();
-                const auto cc_vec        = net.connected_components();
-
-                auto arr = std::array<connected_component_info, number_of_connected_components>{};
-
-                for (const auto& [i, cc] : cc_vec | rv::enumerate) {
-                    const auto pcs = cc.pairwise_contraction_sequence(dimension);
-
-                    const auto one_node = cc.size() == 1uz;
-                    const auto n        = one_node ? rn::size(cc.view_edges()) : rn::size(pcs);
-                    auto fac            = std::optional<std::size_t>{};
-                    if (one_node) { fac = alg::argfind(id_vec, cc.view_nodes()[0].id); }
-
-                    if (one_node and not rn::empty(pcs)) {
-                        throw std::logic_error{ "One node connected component should have"
-                                                "empty pairwise contraction sequence" };
-                    }
-
-                    arr[i] = connected_component_info{ .rank                    = cc.rank(),
-                                                       .number_of_contractions  = n,
-                                                       .one_node_factor_ordinal = fac };
-                }
-
-                return arr;
-            });
+            static constexpr auto& connected_component_infos =
+                compiled_plan<dimension>.components;
 
             auto connected_component_out_buffs = std::invoke(
                 [&]<std::size_t... I>(std::index_sequence<I...>) {
                     return std::tuple{
+                        // Single component writes directly to out.
                         std::array<typename OutMDS::element_type,
-                                   connected_component_infos[I].out_buff_size(dimension)>{}...
+                                   number_of_connected_components == 1uz
+                                       ? 0uz
+                                       : connected_component_infos[I].out_buff_size(dimension)>{}...
                     };
                 },
                 std::make_index_sequence<number_of_connected_components>());
@@ -522,14 +730,11 @@ class einsum {
                 if constexpr (info.case_A()) {
                     return;
                 } else if constexpr (info.case_B()) {
-                    static constexpr auto einsum_str = std::invoke([] {
-                        const auto p = parser();
-                        auto s       = std::u8string{};
-                        for (const auto& label : *rn::next(rn::begin(p.factor_index_labels()), N)) {
-                            s += label;
-                        }
-                        return str::fixed_string{ s };
-                    });
+                    static constexpr auto einsum_str =
+                        self_contraction_estr<info.one_node_factor_ordinal.value()>;
+
+                    [[maybe_unused]] const auto scope = typename Instrumentation::scope(
+                        einsum_operation::self_contraction, N, einsum_str.sv());
 
                     einsum<einsum_str>{}(std::get<N>(connected_component_out_mdspans),
                                          std::get<info.one_node_factor_ordinal.value()>(
@@ -537,43 +742,8 @@ class einsum {
 
                     return;
                 } else {
-                    struct pairwise_contraction_info {
-                        std::size_t out_register, out_register_rank, lhs_register, rhs_register;
-                        str::fixed_string einsum_str{ u8"to be replaced" };
-                    };
-
-                    static constexpr auto pairwise_contractions = std::invoke([] {
-                        auto arr =
-                            std::array<pairwise_contraction_info, info.number_of_contractions>{};
-                        if constexpr (info.number_of_contractions != 0uz) {
-                            auto [id_vec, net] = network();
-                            const auto cc      = net.connected_components()[N];
-
-                            if (rn::size(id_vec) < 3uz) {
-                                throw std::logic_error{ "There should be at least 3 nodes." };
-                            }
-
-                            for (const auto [n, c] :
-                                 cc.pairwise_contraction_sequence(dimension) | rv::enumerate) {
-                                // These should always be found.
-                                const auto lhs_reg = alg::argfind(id_vec, c.lhs_id()).value();
-                                const auto rhs_reg = alg::argfind(id_vec, c.rhs_id()).value();
-
-                                id_vec.push_back(c.out_id());
-                                const auto out_reg = rn::size(id_vec) - 1uz;
-
-                                const auto [lhs_str, rhs_str] = c.index_labels();
-
-                                const auto s = lhs_str + u8"," + rhs_str;
-                                arr[n]       = { .out_register      = out_reg,
-                                                 .out_register_rank = c.out_rank(),
-                                                 .lhs_register      = lhs_reg,
-                                                 .rhs_register      = rhs_reg,
-                                                 .einsum_str        = str::fixed_string(s) };
-                            }
-                        }
-                        return arr;
-                    });
+                    static constexpr auto& pairwise_contractions =
+                        compiled_plan<dimension>.steps[N];
 
                     auto tensor_register_buffs = std::invoke(
                         [&]<std::size_t... I>(std::index_sequence<I...>) {
@@ -581,7 +751,7 @@ class einsum {
                                 std::array<typename OutMDS::element_type,
                                            sstd::integer_pow(
                                                dimension,
-                                               pairwise_contractions[I].out_register_rank)>{}...
+                                               pairwise_contractions[I].buffer_rank)>{}...
                             };
                         },
                         std::make_index_sequence<info.number_of_contractions - 1uz>());
@@ -593,23 +763,74 @@ class einsum {
                                 [&]<std::size_t... I>(std::index_sequence<I...>) {
                                     return std::tuple{ sstd::geometric_mdspan<
                                         typename OutMDS::element_type,
-                                        pairwise_contractions[I].out_register_rank,
+                                        pairwise_contractions[I].buffer_rank,
                                         dimension>(std::get<I>(tensor_register_buffs).data())... };
                                 },
                                 std::make_index_sequence<info.number_of_contractions - 1uz>()),
                             std::tuple{ std::get<N>(connected_component_out_mdspans) });
                     });
 
+                    auto contract = [&]<std::size_t I>() {
+                        static constexpr auto c = pairwise_contractions[I];
+
+                        if constexpr (c.fused_with_next) {
+                            // Executed slice by slice in the loop of the next step.
+                            return;
+                        } else if constexpr (c.fused_with_previous) {
+                            [[maybe_unused]] const auto scope = typename Instrumentation::scope(
+                                einsum_operation::pairwise_contraction, N, c.einsum_str.sv());
+
+                            static constexpr auto p = pairwise_contractions[I - 1uz];
+                            static constexpr auto f = c.fusion;
+                            static constexpr auto outer_rank = f.first_outer_labels.sv().size();
+
+                            const auto& regs        = tensor_register_mdspans;
+                            const auto intermediate = std::get<p.out_register>(regs);
+
+                            // Intermediate of the first step is computed one slice at a time,
+                            // for each value of its outer labels (in row-major order).
+                            for (const auto o :
+                                 rv::iota(0uz, sstd::integer_pow(dimension, outer_rank))) {
+                                auto outer = std::array<std::size_t, outer_rank>{};
+                                auto t     = o;
+                                for (auto& i : outer | rv::reverse) {
+                                    i = t % dimension;
+                                    t /= dimension;
+                                }
+
+                                einsum<f.first_estr>{}(
+                                    intermediate,
+                                    slice_outer<f.first_lhs_labels, f.first_outer_labels>(
+                                        std::get<p.lhs_register>(regs), outer),
+                                    slice_outer<f.first_rhs_labels, f.first_outer_labels>(
+                                        std::get<p.rhs_register>(regs), outer));
+
+                                const auto out_slice =
+                                    slice_outer<f.second_out_labels, f.second_outer_labels>(
+                                        std::get<c.out_register>(regs), outer);
+
+                                if constexpr (c.lhs_register == p.out_register) {
+                                    einsum<f.second_estr>{}(
+                                        out_slice, intermediate, std::get<c.rhs_register>(regs));
+                                } else {
+                                    einsum<f.second_estr>{}(
+                                        out_slice, std::get<c.lhs_register>(regs), intermediate);
+                                }
+                            }
+                        } else {
+                            [[maybe_unused]] const auto scope = typename Instrumentation::scope(
+                                einsum_operation::pairwise_contraction, N, c.einsum_str.sv());
+
+                            einsum<c.einsum_str>{}(
+                                std::get<c.out_register>(tensor_register_mdspans),
+                                std::get<c.lhs_register>(tensor_register_mdspans),
+                                std::get<c.rhs_register>(tensor_register_mdspans));
+                        }
+                    };
+
                     std::invoke(
                         [&]<std::size_t... I>(std::index_sequence<I...>) {
-                            (einsum<pairwise_contractions[I].einsum_str>{}(
-                                 std::get<pairwise_contractions[I].out_register>(
-                                     tensor_register_mdspans),
-                                 std::get<pairwise_contractions[I].lhs_register>(
-                                     tensor_register_mdspans),
-                                 std::get<pairwise_contractions[I].rhs_register>(
-                                     tensor_register_mdspans)),
-                             ...);
+                            (contract.template operator()<I>(), ...);
                         },
                         std::make_index_sequence<info.number_of_contractions>());
                 }
@@ -623,29 +844,12 @@ class einsum {
 
             // What is left is to outer product connected components together.
             if constexpr (number_of_connected_components > 1uz) {
-                static constexpr auto connected_components_estr = std::invoke([] {
-                    const auto p                 = parser();
-                    const auto free_index_labels = p.free_index_labels();
-
-                    auto str        = std::u8string{};
-                    auto next_label = 0uz;
-
-                    // gcc 14 gives goto is not a constant expression error??
-                    // for (const auto i : rv::iota(0uz, number_of_connected_components)) {
-                    for (auto i = 0uz; i < number_of_connected_components; ++i) {
-                        for (const auto _ : rv::iota(0uz, connected_component_infos[i].rank)) {
-                            str += free_index_labels[next_label++];
-                        }
-                        if (i != number_of_connected_components - 1uz) { str += u8','; }
-                    }
-
-                    str += u8"->";
-                    for (const auto& c : p.output_index_labels()) { str += c; }
-
-                    return str::fixed_string{ str };
-                });
+                [[maybe_unused]] const auto scope =
+                    typename Instrumentation::scope(einsum_operation::outer_product,
+                                                    number_of_connected_components,
+                                                    outer_product_estr.sv());
 
-                std::apply(einsum<connected_components_estr>{},
+                std::apply(einsum<outer_product_estr>{},
                            std::tuple_cat(std::tuple{ out }, connected_component_out_mdspans));
             }
         }
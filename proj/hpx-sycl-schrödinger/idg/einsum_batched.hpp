@@ -0,0 +1,308 @@
+#pragma once
+/// @file Einsum of large batches of small tensors.
+/*
+ * Per-call overhead and scalar loops dominate when millions of tiny (D = 2..8, rank <= 4)
+ * einsums are evaluated one by one. batched_einsum evaluates the same einsum for a batch
+ * of N equally shaped factor sets, which are stored as structure of arrays:
+ * batch index is the last and contiguous index of each operand.
+ *
+ * ```cpp
+ * // A[i, j, n] is element (i, j) of the n:th matrix.
+ * const auto A = idg::batched_mdspan<double, 2, 4>(A_data, N);
+ * const auto B = idg::batched_mdspan<double, 2, 4>(B_data, N);
+ * const auto C = idg::batched_mdspan<double, 2, 4>(C_data, N);
+ * idg::batched_einsum<u8"ij,jk->ik">{}(C, A, B);
+ * ```
+ *
+ * Products contributing to each output element are enumerated at compile time
+ * and unrolled when there are at most max_unrolled_terms of them.
+ * The innermost loop goes over `lanes` consecutive batch entries, so it is vectorized
+ * (kernels are compiled for the isa variants of idg/cpu_dispatch.hpp)
+ * and chunks of lanes are split to threads with parallel_blocks.
+ **/
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <ranges>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <experimental/mdspan>
+
+#include "idg/cpu_dispatch.hpp"
+#include "idg/einsum.hpp"
+#include "idg/einsum_parser.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+#include "idg/tensor_allocator.hpp"
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+
+/// Extents of a batch of geometric tensors, where the last extent is the batch size.
+template<std::size_t rank, std::size_t dim>
+using batched_extents = decltype(std::invoke(
+    []<std::size_t... I>(std::index_sequence<I...>) {
+        return std::extents<std::size_t, (0 * I + dim)..., std::dynamic_extent>{};
+    },
+    std::make_index_sequence<rank>()));
+
+/// Batch of geometric tensors stored as structure of arrays.
+template<typename T, std::size_t rank, std::size_t dim>
+using batched_mdspan = std::mdspan<T, batched_extents<rank, dim>>;
+
+/// Geometric mdspan of one tensor of batched mdspan \p MDS.
+template<typename MDS>
+using unbatched_mdspan_t = sstd::geometric_mdspan<typename MDS::element_type,
+                                                  MDS::rank() - 1uz,
+                                                  MDS::rank() == 1uz ? 1uz : MDS::static_extent(0)>;
+
+template<typename MDS>
+concept batched_mdspan_type =
+    sstd::is_mdspan_v<MDS> and (MDS::rank() != 0uz)
+    and std::is_same_v<typename MDS::layout_type, std::layout_right>
+    and std::is_same_v<typename MDS::accessor_type,
+                       std::default_accessor<typename MDS::element_type>>
+    and std::is_same_v<
+        typename MDS::extents_type,
+        batched_extents<MDS::rank() - 1uz, MDS::rank() == 1uz ? 1uz : MDS::static_extent(0)>>;
+
+template<str::fixed_string estr, typename OutMDS, typename... MDS>
+concept batched_einsum_compatible =
+    (batched_mdspan_type<OutMDS> and ... and batched_mdspan_type<MDS>)
+    and einsum_compatible<estr, unbatched_mdspan_t<OutMDS>, unbatched_mdspan_t<MDS>...>;
+
+template<str::fixed_string estr>
+class batched_einsum {
+    static constexpr const parsed_einsum& parser() { return parsed_einsum_v<estr>; }
+
+    static constexpr auto number_of_factors      = parser().number_of_factors();
+    static constexpr auto out_rank               = rn::size(parser().output_index_labels());
+    static constexpr auto number_of_contractions = rn::size(parser().contractions());
+
+    /// One product of factor elements which is added to an output element.
+    ///
+    /// Offsets are row-major offsets of the elements within one tensor of the batch.
+    struct term {
+        std::size_t out_offset;
+        std::array<std::size_t, number_of_factors> factor_offsets;
+    };
+
+    /// Terms of each output element are consecutive and output elements are in row-major order.
+    template<std::size_t D>
+    static constexpr auto terms = std::invoke([] {
+        constexpr auto out_size         = sstd::integer_pow(D, out_rank);
+        constexpr auto contraction_size = sstd::integer_pow(D, number_of_contractions);
+
+        const auto unflatten = []<std::size_t r>(std::size_t flat) {
+            auto idx = std::array<std::size_t, r>{};
+            for (auto& i : idx | rv::reverse) {
+                i = flat % D;
+                flat /= D;
+            }
+            return idx;
+        };
+        const auto flatten = [](const auto& idx) {
+            auto flat = 0uz;
+            for (const auto i : idx) { flat = flat * D + i; }
+            return flat;
+        };
+
+        auto arr = std::array<term, out_size * contraction_size>{};
+        for (const auto o : rv::iota(0uz, out_size)) {
+            for (const auto c : rv::iota(0uz, contraction_size)) {
+                const auto factor_indices = einsum<estr>::apply_index_map(
+                    unflatten.template operator()<out_rank>(o),
+                    unflatten.template operator()<number_of_contractions>(c));
+
+                arr[o * contraction_size + c] = {
+                    .out_offset     = o,
+                    .factor_offsets = std::apply(
+                        [&](const auto&... idx) {
+                            return std::array<std::size_t, number_of_factors>{ flatten(idx)... };
+                        },
+                        factor_indices)
+                };
+            }
+        }
+        return arr;
+    });
+
+    /// Computes batch entries [b, b + L) of every output element.
+    template<std::size_t D, std::size_t L, typename T, typename... U>
+    [[gnu::always_inline]] static inline void
+        chunk(T* const out, const std::size_t n, const std::size_t b, U* const... factors) {
+        static constexpr auto& t                = terms<D>;
+        static constexpr auto contraction_size  = sstd::integer_pow(D, number_of_contractions);
+        static constexpr auto number_of_outputs = rn::size(t) / contraction_size;
+
+        const auto factor_ptrs = std::tuple{ factors... };
+
+        const auto add_term = [&](std::array<T, L>& acc, const term& k) {
+            for (const auto l : rv::iota(0uz, L)) {
+                acc[l] += std::invoke(
+                    [&]<std::size_t... F>(std::index_sequence<F...>) {
+                        return (std::get<F>(factor_ptrs)[k.factor_offsets[F] * n + b + l] * ...);
+                    },
+                    std::make_index_sequence<number_of_factors>());
+            }
+        };
+
+        const auto store = [&](const std::array<T, L>& acc, const std::size_t out_offset) {
+            for (const auto l : rv::iota(0uz, L)) { out[out_offset * n + b + l] = acc[l]; }
+        };
+
+        if constexpr (rn::size(t) <= max_unrolled_terms) {
+            // Offsets are compile-time constants, so only the batch stride is multiplied.
+            const auto element = [&]<std::size_t O>() {
+                auto acc = std::array<T, L>{};
+                std::invoke(
+                    [&]<std::size_t... C>(std::index_sequence<C...>) {
+                        (add_term(acc, t[O * contraction_size + C]), ...);
+                    },
+                    std::make_index_sequence<contraction_size>());
+                store(acc, O);
+            };
+            std::invoke(
+                [&]<std::size_t... O>(std::index_sequence<O...>) {
+                    (element.template operator()<O>(), ...);
+                },
+                std::make_index_sequence<number_of_outputs>());
+        } else {
+            for (const auto o : rv::iota(0uz, number_of_outputs)) {
+                auto acc = std::array<T, L>{};
+                for (const auto c : rv::iota(0uz, contraction_size)) {
+                    add_term(acc, t[o * contraction_size + c]);
+                }
+                store(acc, o);
+            }
+        }
+    }
+
+    /// Computes chunks [first, last) of lanes batch entries, the last chunk may be partial.
+    template<std::size_t D, std::size_t L, typename T, typename... U>
+    static void chunks(const std::size_t first,
+                       const std::size_t last,
+                       const std::size_t n,
+                       T* const out,
+                       U* const... factors) {
+        for (const auto c : rv::iota(first, last)) {
+            const auto b = c * L;
+            if (b + L <= n) {
+                chunk<D, L>(out, n, b, factors...);
+            } else {
+                for (const auto tail : rv::iota(b, n)) { chunk<D, 1uz>(out, n, tail, factors...); }
+            }
+        }
+    }
+
+#if IDG_X86_DISPATCH
+    // Variants of chunks for runtime dispatch, flatten inlines chunk to them.
+
+    template<std::size_t D, std::size_t L, typename T, typename... U>
+    [[gnu::target("sse4.2"), gnu::flatten]]
+    static void chunks_sse4_2(const std::size_t first,
+                              const std::size_t last,
+                              const std::size_t n,
+                              T* const out,
+                              U* const... factors) {
+        chunks<D, L>(first, last, n, out, factors...);
+    }
+
+    template<std::size_t D, std::size_t L, typename T, typename... U>
+    [[gnu::target("avx2,fma"), gnu::flatten]]
+    static void chunks_avx2(const std::size_t first,
+                            const std::size_t last,
+                            const std::size_t n,
+                            T* const out,
+                            U* const... factors) {
+        chunks<D, L>(first, last, n, out, factors...);
+    }
+
+    template<std::size_t D, std::size_t L, typename T, typename... U>
+    [[gnu::target("avx512f,avx512bw,avx512vl,avx2,fma"), gnu::flatten]]
+    static void chunks_avx512(const std::size_t first,
+                              const std::size_t last,
+                              const std::size_t n,
+                              T* const out,
+                              U* const... factors) {
+        chunks<D, L>(first, last, n, out, factors...);
+    }
+#endif
+
+    /// Variant of chunks for cpu::detected_isa() chosen on the first call.
+    template<std::size_t D, std::size_t L, typename T, typename... U>
+    [[nodiscard]] static auto dispatched_chunks() {
+        using kernel_ptr =
+            void (*)(std::size_t, std::size_t, std::size_t, T* const, U* const...);
+        static const kernel_ptr kernel = []() -> kernel_ptr {
+#if IDG_X86_DISPATCH
+            switch (cpu::detected_isa()) {
+                case cpu::isa::avx512: return &chunks_avx512<D, L, T, U...>;
+                case cpu::isa::avx2: return &chunks_avx2<D, L, T, U...>;
+                case cpu::isa::sse4_2: return &chunks_sse4_2<D, L, T, U...>;
+                case cpu::isa::portable: break;
+            }
+#endif
+            return &chunks<D, L, T, U...>;
+        }();
+        return kernel;
+    }
+
+  public:
+    /// Output elements with more terms are computed with loops over a term table.
+    static constexpr auto max_unrolled_terms = 4096uz;
+
+    /// Batches are not split to threads more finely than this many batch entries per thread.
+    static constexpr auto min_batch_per_thread = 4096uz;
+
+    /// Number of consecutive batch entries computed together, i.e. one cache line of output.
+    template<typename T>
+    static constexpr auto lanes = std::max(1uz, 64uz / sizeof(T));
+
+    /// Evaluates the einsum for each of the batch entries of the operands using \p threads.
+    ///
+    /// Batch sizes of the operands have to be equal.
+    /// If \p threads is zero, default_number_of_threads() is used.
+    template<typename OutMDS, typename... MDS>
+        requires batched_einsum_compatible<estr, OutMDS, MDS...>
+    static void operator()(const std::size_t threads, OutMDS out, MDS... factors) {
+        static constexpr auto D =
+            einsum<estr>::template deduce_dimension<unbatched_mdspan_t<OutMDS>,
+                                                    unbatched_mdspan_t<MDS>...>();
+        static constexpr auto L = lanes<typename OutMDS::element_type>;
+
+        const auto n = out.extent(OutMDS::rank() - 1uz);
+        if (not((factors.extent(MDS::rank() - 1uz) == n) and ...)) {
+            throw std::logic_error{ "Batch sizes of batched einsum operands differ." };
+        }
+
+        const auto number_of_chunks = (n + L - 1uz) / L;
+        const auto max_threads      = std::max(1uz, n / min_batch_per_thread);
+        const auto t =
+            std::min(threads == 0uz ? default_number_of_threads() : threads, max_threads);
+
+        const auto kernel = dispatched_chunks<D,
+                                              L,
+                                              typename OutMDS::element_type,
+                                              typename MDS::element_type...>();
+        parallel_blocks(number_of_chunks, t, [&](const std::size_t first, const std::size_t last) {
+            kernel(first, last, n, out.data_handle(), factors.data_handle()...);
+        });
+    }
+
+    /// Evaluates the einsum for each of the batch entries of the operands using all threads.
+    template<typename OutMDS, typename... MDS>
+        requires batched_einsum_compatible<estr, OutMDS, MDS...>
+    static void operator()(OutMDS out, MDS... factors) {
+        operator()(0uz, out, factors...);
+    }
+};
+
+} // namespace idg
@@ -0,0 +1,181 @@
+#pragma once
+/// @file Asynchronous einsum executed as HPX dataflow graph.
+/*
+ * einsum executes the pairwise contractions of its plan and its connected components
+ * one after another. einsum_dataflow turns the plan into a DAG of futures instead:
+ * each pairwise contraction is an hpx::dataflow of the futures of its operands,
+ * so independent branches of the contraction tree and independent connected components
+ * run concurrently on the work-stealing scheduler of HPX:
+ *
+ * ```cpp
+ * auto done = idg::einsum_async<u8"ij,jk,kl,lm->im">(out, A, B, C, E);
+ * // ... other work ...
+ * done.get();
+ * ```
+ *
+ * Factors and out have to stay valid until the returned future is ready.
+ * Intermediates are allocated for each call and freed when the future becomes ready.
+ *
+ * Requires HPX runtime to be running (e.g. called from hpx_main). Targets using this header
+ * are built with -DIDG_WITH_HPX=ON, see bench/einsum_dataflow.cpp.
+ **/
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <ranges>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <hpx/future.hpp>
+
+#include "idg/einsum.hpp"
+#include "idg/einsum_plan.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+
+template<str::fixed_string estr, typename OutMDS, typename... MDS>
+    requires einsum_compatible<estr, OutMDS, MDS...>
+class einsum_dataflow {
+    using element_type = typename OutMDS::element_type;
+
+    static constexpr auto dimension = einsum<estr>::template deduce_dimension<OutMDS, MDS...>();
+    static constexpr auto number_of_factors    = sizeof...(MDS);
+    static constexpr auto number_of_components = einsum<estr>::number_of_connected_components;
+
+    /// Steps of all components in one register file, see make_register_tables.
+    static constexpr auto tables = std::invoke([] {
+        using tables_type =
+            register_tables<std::max(number_of_factors, 1uz) - 1uz, number_of_components>;
+        if constexpr (einsum<estr>::executes_directly()) {
+            return tables_type{};
+        } else {
+            return make_register_tables<std::max(number_of_factors, 1uz) - 1uz,
+                                        number_of_components>(
+                einsum_plan(parsed_einsum_v<estr>, dimension), number_of_factors);
+        }
+    });
+
+    static constexpr auto number_of_steps = tables.number_of_steps;
+    static constexpr auto& steps          = tables.steps;
+    static constexpr auto& components     = tables.components;
+
+    /// Intermediates of one call, kept alive until the returned future is ready.
+    struct workspace {
+        std::array<std::vector<element_type>, number_of_steps> step_buffers{};
+        std::array<std::vector<element_type>, number_of_components> component_buffers{};
+    };
+
+    using register_future = hpx::shared_future<void>;
+
+  public:
+    /// Starts the einsum, the returned future is ready when \p out is written.
+    [[nodiscard]] static hpx::future<void> operator()(OutMDS out, MDS... factors) {
+        if constexpr (einsum<estr>::executes_directly()) {
+            return hpx::async([=] { einsum<estr>{}(out, factors...); });
+        } else {
+            auto ws = std::make_shared<workspace>();
+            for (const auto i : rv::iota(0uz, number_of_steps)) {
+                if (not steps[i].writes_out) {
+                    ws->step_buffers[i].resize(sstd::integer_pow(dimension, steps[i].out_rank));
+                }
+            }
+            for (const auto i : rv::iota(0uz, number_of_components)) {
+                if (components[i].case_B()) {
+                    ws->component_buffers[i].resize(
+                        sstd::integer_pow(dimension, components[i].rank));
+                }
+            }
+
+            const auto registers =
+                register_mdspans<tables, dimension>(out, ws->step_buffers, factors...);
+
+            // Factors are ready, outputs of the steps become ready when they are computed.
+            auto ready = std::array<register_future, number_of_factors + number_of_steps>{};
+            for (const auto f : rv::iota(0uz, number_of_factors)) {
+                ready[f] = hpx::make_ready_future();
+            }
+
+            const auto contract = [&]<std::size_t I>() {
+                static constexpr auto s = steps[I];
+                ready[s.out_register]   = hpx::dataflow(
+                    hpx::unwrapping([registers] {
+                        einsum<s.einsum_str>{}(std::get<s.out_register>(registers),
+                                               std::get<s.lhs_register>(registers),
+                                               std::get<s.rhs_register>(registers));
+                    }),
+                    ready[s.lhs_register],
+                    ready[s.rhs_register]);
+            };
+            std::invoke(
+                [&]<std::size_t... I>(std::index_sequence<I...>) {
+                    (contract.template operator()<I>(), ...);
+                },
+                std::make_index_sequence<number_of_steps>());
+
+            if constexpr (number_of_components == 1uz) {
+                return ready[components[0].out_register].then([ws](auto&& f) { f.get(); });
+            } else {
+                const auto component_out = [&]<std::size_t N>() {
+                    static constexpr auto info = components[N];
+                    if constexpr (info.case_A()) {
+                        return std::get<info.one_node_factor_ordinal.value()>(registers);
+                    } else if constexpr (info.case_B()) {
+                        return sstd::geometric_mdspan<element_type, info.rank, dimension>(
+                            ws->component_buffers[N].data());
+                    } else {
+                        return std::get<info.out_register>(registers);
+                    }
+                };
+
+                const auto component_ready = [&]<std::size_t N>() -> register_future {
+                    static constexpr auto info = components[N];
+                    if constexpr (info.case_A()) {
+                        return hpx::make_ready_future();
+                    } else if constexpr (info.case_B()) {
+                        static constexpr auto f = info.one_node_factor_ordinal.value();
+                        return hpx::async([self_out = component_out.template operator()<N>(),
+                                           factor   = std::get<f>(registers)] {
+                            einsum<einsum<estr>::template self_contraction_estr<f>>{}(self_out,
+                                                                                    factor);
+                        });
+                    } else {
+                        return ready[info.out_register];
+                    }
+                };
+
+                return std::invoke(
+                    [&]<std::size_t... N>(std::index_sequence<N...>) {
+                        const auto outs = std::tuple{ component_out.template operator()<N>()... };
+                        const auto outer_product = [ws, out, outs] {
+                            std::apply(
+                                [&](const auto... o) {
+                                    einsum<einsum<estr>::outer_product_estr>{}(out, o...);
+                                },
+                                outs);
+                        };
+                        return hpx::dataflow(hpx::unwrapping(outer_product),
+                                             component_ready.template operator()<N>()...);
+                    },
+                    std::make_index_sequence<number_of_components>());
+            }
+        }
+    }
+};
+
+/// Starts einsum \p estr as HPX dataflow graph, see einsum_dataflow.
+template<str::fixed_string estr, typename OutMDS, typename... MDS>
+    requires einsum_compatible<estr, OutMDS, MDS...>
+[[nodiscard]] hpx::future<void> einsum_async(OutMDS out, MDS... factors) {
+    return einsum_dataflow<estr, OutMDS, MDS...>{}(out, factors...);
+}
+
+} // namespace idg
@@ -0,0 +1,263 @@
+#pragma once
+/// @file Stateful execution of an einsum which is evaluated repeatedly.
+/*
+ * Iterative algorithms evaluate the same einsum many times while some factors
+ * (e.g. hamiltonian or fixed operators) stay the same. einsum_executor plans the einsum
+ * such that contractions between constant factors are free and keeps their results
+ * between calls:
+ *
+ * ```cpp
+ * // A and B are constant, x changes every iteration.
+ * using executor = idg::einsum_executor<u8"ij,jk,kl,l->i",
+ *                                       idg::constant_factors<0, 1>,
+ *                                       decltype(out),
+ *                                       decltype(A), decltype(B), decltype(C), decltype(x)>;
+ * auto e = executor{};
+ * for (...) { e(out, A, B, C, x); }
+ * ```
+ *
+ * Precontracted results are computed on the first call and after invalidate(),
+ * which has to be called if constant factors are modified.
+ *
+ * Intermediates are also tracked by the factors they depend on. If only some factors
+ * changed since the previous call (e.g. one site tensor during a sweep), update() recomputes
+ * only the steps which depend on them:
+ *
+ * ```cpp
+ * e.update({ 3 }, out, A, B, C, x); // Only x changed.
+ * ```
+ **/
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <ranges>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#include "idg/einsum.hpp"
+#include "idg/einsum_plan.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+#include "idg/tensor_allocator.hpp"
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+
+/// Ordinals of the factors which are not modified between calls of einsum_executor.
+template<std::size_t... I>
+struct constant_factors {};
+
+template<str::fixed_string estr, typename Constants, typename OutMDS, typename... MDS>
+class einsum_executor;
+
+template<str::fixed_string estr, std::size_t... C, typename OutMDS, typename... MDS>
+    requires einsum_compatible<estr, OutMDS, MDS...>
+class einsum_executor<estr, constant_factors<C...>, OutMDS, MDS...> {
+    using element_type = typename OutMDS::element_type;
+
+    static constexpr auto dimension = einsum<estr>::template deduce_dimension<OutMDS, MDS...>();
+    static constexpr auto number_of_factors    = sizeof...(MDS);
+    static constexpr auto number_of_components = einsum<estr>::number_of_connected_components;
+
+    static_assert(((C < number_of_factors) and ...), "Constant factor out of range.");
+    static_assert(number_of_factors <= 64uz, "Dependencies are tracked with 64 bit masks.");
+
+    /// Mask of factors, where i:th bit corresponds to the i:th factor.
+    using factor_mask = std::uint64_t;
+
+    static constexpr factor_mask constant_mask = ((factor_mask{ 1 } << C) | ... | factor_mask{ 0 });
+
+    static constexpr auto constant_factor_ordinals = std::array<std::size_t, sizeof...(C)>{ C... };
+
+    [[nodiscard]] static constexpr einsum_plan plan() {
+        return einsum_plan(parsed_einsum_v<estr>, dimension, constant_factor_ordinals);
+    }
+
+    /// Steps of all components in one register file, see make_register_tables.
+    static constexpr auto tables = std::invoke([] {
+        using tables_type =
+            register_tables<std::max(number_of_factors, 1uz) - 1uz, number_of_components>;
+        if constexpr (einsum<estr>::executes_directly()) {
+            return tables_type{};
+        } else {
+            return make_register_tables<std::max(number_of_factors, 1uz) - 1uz,
+                                        number_of_components>(plan(), number_of_factors);
+        }
+    });
+
+    static constexpr auto number_of_steps = tables.number_of_steps;
+    static constexpr auto& steps          = tables.steps;
+    static constexpr auto& components     = tables.components;
+
+    /// Factors which the output of each step depends on (transitively through other steps).
+    static constexpr auto step_dependencies = std::invoke([] {
+        auto registers = std::array<factor_mask, number_of_factors + number_of_steps>{};
+        for (const auto f : rv::iota(0uz, number_of_factors)) {
+            registers[f] = factor_mask{ 1 } << f;
+        }
+
+        auto dependencies = std::array<factor_mask, number_of_steps>{};
+        for (const auto i : rv::iota(0uz, number_of_steps)) {
+            const auto& s             = steps[i];
+            registers[s.out_register] = registers[s.lhs_register] | registers[s.rhs_register];
+            dependencies[i]           = registers[s.out_register];
+        }
+        return dependencies;
+    });
+
+    /// Workspaces are huge page backed and touched first by the thread which creates executor.
+    [[nodiscard]] static tensor_buffer<element_type> make_workspace(const std::size_t rank) {
+        return tensor_buffer<element_type>(sstd::integer_pow(dimension, rank),
+                                           hugepage_allocator<element_type>({ .threads = 1uz }));
+    }
+
+    /// Outputs of the steps, except the one writing to out.
+    std::array<tensor_buffer<element_type>, number_of_steps> step_buffers_ = std::invoke(
+        []<std::size_t... I>(std::index_sequence<I...>) {
+            return std::array<tensor_buffer<element_type>, number_of_steps>{
+                (steps[I].writes_out ? tensor_buffer<element_type>{}
+                                     : make_workspace(steps[I].out_rank))...
+            };
+        },
+        std::make_index_sequence<number_of_steps>());
+
+    /// Outputs of self contracted components, which exist only when there are multiple components.
+    std::array<tensor_buffer<element_type>, number_of_components> component_buffers_ = std::invoke(
+        []<std::size_t... I>(std::index_sequence<I...>) {
+            return std::array<tensor_buffer<element_type>, number_of_components>{
+                (components[I].case_B() ? make_workspace(components[I].rank)
+                                        : tensor_buffer<element_type>{})...
+            };
+        },
+        std::make_index_sequence<number_of_components>());
+
+    /// Steps and self contracted components whose buffers are up to date.
+    std::uint64_t valid_steps_{ 0 };
+    std::uint64_t valid_components_{ 0 };
+
+    std::size_t computed_steps_{ 0uz };
+
+    template<std::size_t N>
+    [[nodiscard]] auto component_out_mdspan(const auto& registers) {
+        static constexpr auto info = components[N];
+        if constexpr (info.case_A()) {
+            return std::get<info.one_node_factor_ordinal.value()>(registers);
+        } else if constexpr (info.case_B()) {
+            return sstd::geometric_mdspan<element_type, info.rank, dimension>(
+                component_buffers_[N].data());
+        } else {
+            return std::get<info.out_register>(registers);
+        }
+    }
+
+  public:
+    /// Number of pairwise contractions which are computed only once.
+    [[nodiscard]] static constexpr std::size_t number_of_precontracted_steps() {
+        return static_cast<std::size_t>(
+            rn::count_if(steps | rv::take(number_of_steps), [](const register_step& s) {
+                return s.precontracted and not s.writes_out;
+            }));
+    }
+
+    /// Number of steps which update() of factor \p f recomputes once every step is valid,
+    /// i.e. the steps depending on it and the one writing to the output, if there is one.
+    [[nodiscard]] static constexpr std::size_t number_of_dependent_steps(const std::size_t f) {
+        return static_cast<std::size_t>(
+            rn::count_if(rv::iota(0uz, number_of_steps), [&](const std::size_t i) {
+                return steps[i].writes_out or (step_dependencies[i] & (factor_mask{ 1 } << f));
+            }));
+    }
+
+    /// Number of pairwise steps computed so far, which excludes the reused ones.
+    [[nodiscard]] std::size_t computed_steps() const noexcept { return computed_steps_; }
+
+    /// Recompute all intermediates on the next call.
+    void invalidate() noexcept {
+        valid_steps_      = 0;
+        valid_components_ = 0;
+    }
+
+    /// Evaluates the einsum assuming that every non-constant factor has changed.
+    void operator()(OutMDS out, MDS... factors) { execute(~constant_mask, out, factors...); }
+
+    /// Evaluates the einsum assuming that only \p changed_factors have changed since the last call.
+    ///
+    /// Intermediates which do not depend on them are reused,
+    /// so only the affected branches of the contraction tree are recomputed.
+    void update(const std::initializer_list<std::size_t> changed_factors,
+                OutMDS out,
+                MDS... factors) {
+        auto changed = factor_mask{ 0 };
+        for (const auto f : changed_factors) {
+            if (f >= number_of_factors) {
+                throw std::logic_error{ "Changed factor out of range." };
+            }
+            changed |= factor_mask{ 1 } << f;
+        }
+        execute(changed, out, factors...);
+    }
+
+  private:
+    void execute(const factor_mask changed, OutMDS out, MDS... factors) {
+        if constexpr (einsum<estr>::executes_directly()) {
+            einsum<estr>{}(out, factors...);
+        } else {
+            const auto registers =
+                register_mdspans<tables, dimension>(out, step_buffers_, factors...);
+
+            auto contract = [&]<std::size_t I>() {
+                static constexpr auto s   = steps[I];
+                static constexpr auto bit = std::uint64_t{ 1 } << I;
+                if constexpr (not s.writes_out) {
+                    if ((valid_steps_ & bit) and not(step_dependencies[I] & changed)) { return; }
+                }
+                einsum<s.einsum_str>{}(std::get<s.out_register>(registers),
+                                       std::get<s.lhs_register>(registers),
+                                       std::get<s.rhs_register>(registers));
+                valid_steps_ |= bit;
+                ++computed_steps_;
+            };
+
+            std::invoke(
+                [&]<std::size_t... I>(std::index_sequence<I...>) {
+                    (contract.template operator()<I>(), ...);
+                },
+                std::make_index_sequence<number_of_steps>());
+
+            if constexpr (number_of_components > 1uz) {
+                auto self_contract = [&]<std::size_t N>() {
+                    static constexpr auto info = components[N];
+                    if constexpr (info.case_B()) {
+                        static constexpr auto f   = info.one_node_factor_ordinal.value();
+                        static constexpr auto bit = std::uint64_t{ 1 } << N;
+                        if ((valid_components_ & bit) and not(changed & (factor_mask{ 1 } << f))) {
+                            return;
+                        }
+                        einsum<einsum<estr>::template self_contraction_estr<f>>{}(
+                            component_out_mdspan<N>(registers),
+                            std::get<f>(registers));
+                        valid_components_ |= bit;
+                    }
+                };
+
+                std::invoke(
+                    [&]<std::size_t... I>(std::index_sequence<I...>) {
+                        (self_contract.template operator()<I>(), ...);
+                        std::invoke(einsum<einsum<estr>::outer_product_estr>{},
+                                    out,
+                                    component_out_mdspan<I>(registers)...);
+                    },
+                    std::make_index_sequence<number_of_components>());
+            }
+        }
+    }
+};
+
+} // namespace idg
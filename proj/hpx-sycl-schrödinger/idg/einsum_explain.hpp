@@ -0,0 +1,261 @@
+#pragma once
+/// @file Introspection of einsum plans: contraction sequence and its costs.
+/*
+ * Explanations are constexpr, so they can be used to guard plans with static_asserts:
+ *
+ * ```cpp
+ * static_assert(idg::einsum<u8"ij,jk,kl->il">::explain(8).flops <= 2 * 2 * 8 * 8 * 8);
+ * ```
+ *
+ * and printed at runtime with plan_explanation::to_string.
+ **/
+
+#include <algorithm>
+#include <cstddef>
+#include <format>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "idg/cpu_dispatch.hpp"
+#include "idg/einsum_parser.hpp"
+#include "idg/einsum_plan.hpp"
+#include "idg/sstd.hpp"
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+
+enum class einsum_operation {
+    /// Whole einsum as a single loop over output and contraction index spaces.
+    direct_loop,
+    /// Contractions of a connected component consisting of one factor (e.g. traces).
+    self_contraction,
+    pairwise_contraction,
+    /// Outer product of outputs of the connected components.
+    outer_product
+};
+
+[[nodiscard]] constexpr std::string_view to_string_view(const einsum_operation op) {
+    switch (op) {
+        case einsum_operation::direct_loop: return "direct loop";
+        case einsum_operation::self_contraction: return "self contraction";
+        case einsum_operation::pairwise_contraction: return "pairwise contraction";
+        case einsum_operation::outer_product: return "outer product";
+    }
+    throw std::logic_error{ "Unknown einsum_operation." };
+}
+
+struct step_explanation {
+    einsum_operation operation;
+    std::size_t component;
+    /// Einsum string executed by the step, with explicit output labels.
+    std::u8string estr;
+    /// Rank of the intermediate (or final output) written by the step.
+    std::size_t out_rank;
+    std::vector<std::size_t> out_shape;
+    /// Multiplications and additions.
+    std::size_t flops;
+    /// Bytes read from the inputs and written to the output, assuming no reuse from caches.
+    std::size_t bytes;
+    contraction_kernel kernel;
+};
+
+struct plan_explanation {
+    std::size_t dimension;
+    std::vector<step_explanation> steps{};
+    std::size_t flops{ 0uz };
+    std::size_t bytes{ 0uz };
+    /// Largest bytes of intermediate buffers which are alive at the same time during execution.
+    std::size_t peak_workspace{ 0uz };
+
+    /// Kernel isa is not part of the (constexpr) plan, as it is chosen at runtime.
+    [[nodiscard]] std::string to_string() const {
+        auto s = std::format("einsum plan: D = {}, {} FLOPs, {} bytes, peak workspace {} bytes, "
+                             "kernel isa {}\n",
+                             dimension,
+                             flops,
+                             bytes,
+                             peak_workspace,
+                             cpu::to_string_view(cpu::detected_isa()));
+        for (const auto& [i, step] : steps | rv::enumerate) {
+            const auto estr_view = std::string_view(reinterpret_cast<const char*>(step.estr.data()),
+                                                    step.estr.size());
+            s += std::format("  {}: [component {}] {} \"{}\" -> shape {}, {} FLOPs, {} bytes, {}\n",
+                             i,
+                             step.component,
+                             to_string_view(step.operation),
+                             estr_view,
+                             step.out_shape,
+                             step.flops,
+                             step.bytes,
+                             to_string_view(step.kernel));
+        }
+        return s;
+    }
+};
+
+namespace explain_impl {
+
+/// Output labels of implicit einsum string \p estr, i.e. free labels in order of appearance.
+[[nodiscard]] constexpr std::u8string implicit_output_labels(const std::u8string_view estr) {
+    const auto p = einsum_parser(estr);
+    auto labels  = std::u8string{};
+    for (const auto& l : p.free_index_labels()) { labels += l; }
+    return labels;
+}
+
+/// Label strings a, b, c, ... for rank \p rank starting from label \p first.
+[[nodiscard]] constexpr std::u8string consecutive_labels(const char8_t first,
+                                                         const std::size_t rank) {
+    auto labels = std::u8string{};
+    for (const auto i : rv::iota(0uz, rank)) { labels += static_cast<char8_t>(first + i); }
+    return labels;
+}
+
+[[nodiscard]] constexpr step_explanation make_step(const einsum_operation op,
+                                                   const std::size_t component,
+                                                   std::u8string estr,
+                                                   const std::size_t out_rank,
+                                                   const std::size_t iterations,
+                                                   const std::size_t multiplications_per_iteration,
+                                                   const std::size_t elements_touched,
+                                                   const std::size_t D,
+                                                   const std::size_t element_size,
+                                                   const contraction_kernel kernel) {
+    return { .operation = op,
+             .component = component,
+             .estr      = std::move(estr),
+             .out_rank  = out_rank,
+             .out_shape = std::vector<std::size_t>(out_rank, D),
+             .flops     = iterations * (multiplications_per_iteration + 1uz),
+             .bytes     = elements_touched * element_size,
+             .kernel    = kernel };
+}
+
+} // namespace explain_impl
+
+/// Explains execution of \p plan with elements of size \p element_size.
+[[nodiscard]] constexpr plan_explanation explain(const einsum_plan& plan,
+                                                 const std::size_t element_size = sizeof(double)) {
+    using namespace explain_impl;
+    const auto D = plan.dimension();
+    auto e       = plan_explanation{ .dimension = D };
+
+    const auto pow = [&](const std::size_t exponent) { return sstd::integer_pow(D, exponent); };
+
+    for (const auto& [i, c] : plan.components() | rv::enumerate) {
+        const auto component = static_cast<std::size_t>(i);
+
+        if (c.one_node_factor_ordinal.has_value()) {
+            if (c.number_of_contractions == 0uz) { continue; }
+            // Self contracted labels are doubled after the free ones.
+            const auto free       = consecutive_labels(u8'a', c.rank);
+            const auto contracted = consecutive_labels(static_cast<char8_t>(u8'a' + c.rank),
+                                                       c.number_of_contractions);
+            const auto in_rank    = c.rank + 2uz * c.number_of_contractions;
+            e.steps.push_back(make_step(einsum_operation::self_contraction,
+                                        component,
+                                        free + contracted + contracted + u8"->" + free,
+                                        c.rank,
+                                        pow(c.rank + c.number_of_contractions),
+                                        0uz,
+                                        pow(in_rank) + pow(c.rank),
+                                        D,
+                                        element_size,
+                                        contraction_kernel::generic_loop));
+            continue;
+        }
+
+        for (const auto& [j, s] : c.steps | rv::enumerate) {
+            const auto step_str = s.lhs_labels + u8"," + s.rhs_labels;
+            const auto out      = implicit_output_labels(step_str);
+            const auto lhs_rank = rn::size(s.lhs_labels);
+            const auto rhs_rank = rn::size(s.rhs_labels);
+            const auto k        = (lhs_rank + rhs_rank - s.out_rank) / 2uz;
+
+            // Fused intermediate is neither written to nor read back from memory.
+            auto touched = pow(lhs_rank) + pow(rhs_rank) + pow(s.out_rank);
+            if (s.fused_with_next) { touched -= pow(s.out_rank); }
+            if (s.kernel == contraction_kernel::fused_loop) {
+                touched -= pow(c.steps[static_cast<std::size_t>(j) - 1uz].out_rank);
+            }
+
+            e.steps.push_back(make_step(einsum_operation::pairwise_contraction,
+                                        component,
+                                        step_str + u8"->" + out,
+                                        s.out_rank,
+                                        pow(s.out_rank + k),
+                                        1uz,
+                                        touched,
+                                        D,
+                                        element_size,
+                                        s.kernel));
+        }
+    }
+
+    const auto number_of_components = rn::size(plan.components());
+    if (number_of_components > 1uz) {
+        auto estr       = std::u8string{};
+        auto next_label = u8'a';
+        auto rank       = 0uz;
+        auto touched    = 0uz;
+        for (const auto& c : plan.components()) {
+            if (not estr.empty()) { estr += u8','; }
+            estr += consecutive_labels(next_label, c.rank);
+            next_label = static_cast<char8_t>(next_label + c.rank);
+            rank += c.rank;
+            touched += pow(c.rank);
+        }
+        estr += u8"->" + consecutive_labels(u8'a', rank);
+
+        // Outer product only multiplies, so remove the addition make_step counts.
+        auto step = make_step(einsum_operation::outer_product,
+                              number_of_components,
+                              std::move(estr),
+                              rank,
+                              pow(rank),
+                              number_of_components - 1uz,
+                              touched + pow(rank),
+                              D,
+                              element_size,
+                              contraction_kernel::generic_loop);
+        step.flops -= pow(rank);
+        e.steps.push_back(std::move(step));
+    }
+
+    // Outputs of contracted components (when there are multiple components) are alive until
+    // the outer product, but intermediates of a component are freed before the next one.
+    auto peak_intermediates = 0uz;
+    for (const auto& c : plan.components()) {
+        auto intermediates = 0uz;
+        if (not rn::empty(c.steps)) {
+            // Output of the last step is the output of the component.
+            for (const auto j : rv::iota(0uz, rn::size(c.steps) - 1uz)) {
+                const auto& s    = c.steps[j];
+                const auto slice = s.fused_with_next
+                                       ? fuse_steps(s, c.steps[j + 1uz]).value().intermediate_rank
+                                       : s.out_rank;
+                intermediates += pow(slice) * element_size;
+            }
+        }
+        peak_intermediates = std::max(peak_intermediates, intermediates);
+
+        if (number_of_components > 1uz and c.number_of_contractions != 0uz) {
+            e.peak_workspace += pow(c.rank) * element_size;
+        }
+    }
+    e.peak_workspace += peak_intermediates;
+
+    for (const auto& s : e.steps) {
+        e.flops += s.flops;
+        e.bytes += s.bytes;
+    }
+
+    return e;
+}
+
+} // namespace idg
@@ -0,0 +1,421 @@
+#pragma once
+/// @file Lazy einsum expressions, which fuse sums of einsums to one pass over the output.
+/*
+ * Sums of contractions, e.g. H psi = T psi + V psi, evaluated with einsum need a temporary
+ * for each term and load psi once per term. lazy_einsum only records the factors
+ * and the einsum string, and sums of them are evaluated on assignment to an output mdspan:
+ *
+ * ```cpp
+ * using idg::lazy_einsum;
+ * idg::assign(H_psi, lazy_einsum<u8"ij,j->i">(T, psi) + lazy_einsum<u8"ij,j->i">(V, psi));
+ * idg::assign(out, 0.5 * lazy_einsum<u8"ij,jk->ik">(A, B) - lazy_einsum<u8"ki->ik">(C));
+ * ```
+ *
+ * Terms with the same einsum string form a group. Factor which is the same mdspan
+ * (same data handle and mapping) in every term of a group is a common subexpression,
+ * which is factored out of the group by distributivity,
+ *
+ *     sum_t c_t A_t[i, j] psi[j] = sum_j psi[j] (sum_t c_t A_t[i, j]),
+ *
+ * so it is loaded once per element for all terms of the group.
+ *
+ * Groups which einsum executes directly (see einsum::executes_directly) are computed
+ * in a single pass over the output, which also adds up the groups, so no temporaries
+ * are needed. Other groups are contracted by einsum beforehand to a temporary:
+ * once per group, if at most one factor differs between the terms of the group.
+ *
+ * The single pass is a scalar loop, which unravels every output index, and not the
+ * vectorized direct loop einsum dispatches on CPU features. It saves the loads of common
+ * factors and the temporaries, but the loop itself is slower, so e.g. T psi + V psi, where
+ * only psi is shared, can be slower than two einsum calls. bench/einsum_expression.cpp
+ * times both.
+ *
+ * Output must not alias any of the factors.
+ **/
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <ranges>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <experimental/mdspan>
+
+#include "idg/einsum.hpp"
+#include "idg/einsum_parser.hpp"
+#include "idg/generic_algorithm.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+
+/// Unevaluated einsum \p Estr of \p factors scaled by \p coefficient, see lazy_einsum.
+template<str::fixed_string Estr, typename... MDS>
+struct einsum_term {
+    static constexpr auto estr = Estr;
+    using coefficient_type     = std::common_type_t<typename MDS::value_type...>;
+
+    template<typename OutMDS>
+    static constexpr bool compatible_output = einsum_compatible<Estr, OutMDS, MDS...>;
+
+    std::tuple<MDS...> factors;
+    coefficient_type coefficient{ 1 };
+};
+
+/// Unevaluated sum of einsum_terms.
+template<typename... Terms>
+struct einsum_sum {
+    template<typename OutMDS>
+    static constexpr bool compatible_output = (Terms::template compatible_output<OutMDS> and ...);
+
+    std::tuple<Terms...> terms;
+};
+
+namespace expression_impl {
+
+template<typename T>
+struct is_term : std::false_type {};
+
+template<str::fixed_string estr, typename... MDS>
+struct is_term<einsum_term<estr, MDS...>> : std::true_type {};
+
+template<typename T>
+struct is_sum : std::false_type {};
+
+template<typename... Terms>
+struct is_sum<einsum_sum<Terms...>> : std::true_type {};
+
+} // namespace expression_impl
+
+template<typename E>
+concept einsum_expression =
+    expression_impl::is_term<E>::value or expression_impl::is_sum<E>::value;
+
+/// Lazy einsum \p estr of \p factors, which is evaluated when assigned, see assign.
+template<str::fixed_string estr, typename... MDS>
+    requires(sstd::is_mdspan_v<MDS> and ...)
+[[nodiscard]] constexpr einsum_term<estr, MDS...> lazy_einsum(const MDS... factors) {
+    return { .factors = std::tuple{ factors... } };
+}
+
+namespace expression_impl {
+
+/// Terms of \p e as tuple.
+template<einsum_expression E>
+[[nodiscard]] constexpr auto as_terms(const E& e) {
+    if constexpr (is_term<E>::value) {
+        return std::tuple{ e };
+    } else {
+        return e.terms;
+    }
+}
+
+/// Single term is kept as a term and more as a sum.
+template<typename... Terms>
+[[nodiscard]] constexpr auto from_terms(const std::tuple<Terms...>& terms) {
+    if constexpr (sizeof...(Terms) == 1uz) {
+        return std::get<0>(terms);
+    } else {
+        return einsum_sum<Terms...>{ .terms = terms };
+    }
+}
+
+/// Same tensor, i.e. same elements in the same layout.
+template<typename A, typename B>
+[[nodiscard]] constexpr bool same_factor(const A& a, const B& b) {
+    if constexpr (std::is_same_v<A, B>) {
+        return a.data_handle() == b.data_handle() and a.mapping() == b.mapping();
+    } else {
+        return false;
+    }
+}
+
+/// i:th element is the ordinal of the first term with the same einsum string as the i:th term.
+///
+/// Terms with the same first term form a group, which is identified by the first term.
+template<typename... Terms>
+inline constexpr auto group_leaders = std::invoke([] {
+    const auto strs = std::array{ Terms::estr.sv()... };
+    auto leaders    = std::array<std::size_t, sizeof...(Terms)>{};
+    for (const auto i : rv::iota(0uz, rn::size(strs))) {
+        leaders[i] = alg::argfind(strs, strs[i]).value();
+    }
+    return leaders;
+});
+
+template<std::size_t L, typename... Terms>
+using term_t = std::tuple_element_t<L, std::tuple<Terms...>>;
+
+/// Types of the factors of every term in one tuple.
+template<typename... Terms>
+using factor_tuple_t = decltype(std::tuple_cat(std::declval<decltype(Terms::factors)>()...));
+
+template<std::size_t L, typename... Terms>
+inline constexpr auto number_of_factors =
+    std::tuple_size_v<decltype(term_t<L, Terms...>::factors)>;
+
+/// Calls \p f.template operator()<M>() for each term M of group \p L.
+template<std::size_t L, typename... Terms>
+constexpr void for_each_in_group(auto&& f) {
+    std::invoke(
+        [&]<std::size_t... M>(std::index_sequence<M...>) {
+            const auto call = [&]<std::size_t I>() {
+                if constexpr (group_leaders<Terms...>[I] == L) { f.template operator()<I>(); }
+            };
+            (call.template operator()<M>(), ...);
+        },
+        std::index_sequence_for<Terms...>());
+}
+
+/// i:th element tells if the i:th factor is the same mdspan for every term of group \p L,
+/// i.e. common subexpression of the group.
+template<std::size_t L, typename... Terms>
+[[nodiscard]] constexpr auto common_factors(const std::tuple<Terms...>& terms) {
+    auto common = std::array<bool, number_of_factors<L, Terms...>>{};
+    rn::fill(common, true);
+
+    for_each_in_group<L, Terms...>([&]<std::size_t M>() {
+        std::invoke(
+            [&]<std::size_t... F>(std::index_sequence<F...>) {
+                ((common[F] = common[F]
+                              and same_factor(std::get<F>(std::get<M>(terms).factors),
+                                              std::get<F>(std::get<L>(terms).factors))),
+                 ...);
+            },
+            std::make_index_sequence<number_of_factors<L, Terms...>>());
+    });
+    return common;
+}
+
+/// Index of \p i:th element of row-major geometric index space of rank \p rank.
+template<std::size_t rank, std::size_t D>
+[[nodiscard]] constexpr std::array<std::size_t, rank> unravel(std::size_t i) {
+    auto idx = std::array<std::size_t, rank>{};
+    for (auto& k : idx | rv::reverse) {
+        k = i % D;
+        i /= D;
+    }
+    return idx;
+}
+
+/// Element \p out_idx of group \p L, summed over the contraction index space of its einsum.
+///
+/// Common factors are loaded once and multiplied by the sum of the products
+/// of the other factors of each term.
+template<std::size_t L, std::size_t D, typename T, typename... Terms>
+[[nodiscard]] constexpr T direct_group_element(const std::tuple<Terms...>& terms,
+                                               const auto& common,
+                                               const auto& out_idx) {
+    static constexpr auto estr = term_t<L, Terms...>::estr;
+    static constexpr auto nf   = number_of_factors<L, Terms...>;
+    static constexpr auto nc   = rn::size(parsed_einsum_v<estr>.contractions());
+
+    const auto& lead = std::get<L>(terms).factors;
+
+    auto element = T{};
+    for (const auto j : rv::iota(0uz, sstd::integer_pow(D, nc))) {
+        const auto idx = einsum<estr>::apply_index_map(out_idx, unravel<nc, D>(j));
+
+        std::invoke(
+            [&]<std::size_t... F>(std::index_sequence<F...>) {
+                auto common_product = T{ 1 };
+                ((common_product *= common[F] ? T(std::get<F>(lead)[std::get<F>(idx)]) : T{ 1 }),
+                 ...);
+
+                auto sum = T{};
+                for_each_in_group<L, Terms...>([&]<std::size_t M>() {
+                    const auto& t = std::get<M>(terms);
+                    auto product  = T(t.coefficient);
+                    ((product *=
+                      common[F] ? T{ 1 } : T(std::get<F>(t.factors)[std::get<F>(idx)])),
+                     ...);
+                    sum += product;
+                });
+
+                element += common_product * sum;
+            },
+            std::make_index_sequence<nf>());
+    }
+    return element;
+}
+
+/// Contracts group \p L with einsum to \p buff of rank \p R.
+///
+/// If only one factor differs between the terms of the group, the sum of these
+/// (scaled by the coefficients) is computed first and contracted once.
+template<std::size_t L, std::size_t R, std::size_t D, typename T, typename... Terms>
+void contract_group(const std::tuple<Terms...>& terms, const auto& common, std::vector<T>& buff) {
+    using contraction = einsum<term_t<L, Terms...>::estr>;
+
+    buff.assign(sstd::integer_pow(D, R), T{});
+    const auto group_out = sstd::geometric_mdspan<T, R, D>(buff.data());
+    const auto& lead     = std::get<L>(terms).factors;
+
+    const auto contract_with_sum = [&]<std::size_t F>() {
+        using factor_mdspan   = std::tuple_element_t<F, std::remove_cvref_t<decltype(lead)>>;
+        constexpr auto rank_F = factor_mdspan::rank();
+
+        auto summed_buff  = std::vector<T>(sstd::integer_pow(D, rank_F));
+        const auto summed = sstd::geometric_mdspan<const T, rank_F, D>(summed_buff.data());
+        for (const auto i : rv::iota(0uz, rn::size(summed_buff))) {
+            const auto idx = unravel<rank_F, D>(i);
+            for_each_in_group<L, Terms...>([&]<std::size_t M>() {
+                const auto& t = std::get<M>(terms);
+                summed_buff[i] += T(t.coefficient) * T(std::get<F>(t.factors)[idx]);
+            });
+        }
+
+        std::invoke(
+            [&]<std::size_t... K>(std::index_sequence<K...>) {
+                const auto factor = [&]<std::size_t I>() {
+                    if constexpr (I == F) {
+                        return summed;
+                    } else {
+                        return std::get<I>(lead);
+                    }
+                };
+                contraction{}(group_out, factor.template operator()<K>()...);
+            },
+            std::make_index_sequence<number_of_factors<L, Terms...>>());
+    };
+
+    const auto differing = rn::count(common, false);
+    if (differing == 0) {
+        // Every term is the same up to the coefficient.
+        std::apply([&](const auto... f) { contraction{}(group_out, f...); }, lead);
+        auto c = T{};
+        for_each_in_group<L, Terms...>(
+            [&]<std::size_t M>() { c += T(std::get<M>(terms).coefficient); });
+        for (auto& x : buff) { x *= c; }
+    } else if (differing == 1) {
+        const auto d = alg::argfind(common, false).value();
+        std::invoke(
+            [&]<std::size_t... F>(std::index_sequence<F...>) {
+                ((F == d ? contract_with_sum.template operator()<F>() : void()), ...);
+            },
+            std::make_index_sequence<number_of_factors<L, Terms...>>());
+    } else {
+        auto scratch_buff  = std::vector<T>(rn::size(buff));
+        const auto scratch = sstd::geometric_mdspan<T, R, D>(scratch_buff.data());
+        for_each_in_group<L, Terms...>([&]<std::size_t M>() {
+            const auto& t = std::get<M>(terms);
+            std::apply([&](const auto... f) { contraction{}(scratch, f...); }, t.factors);
+            for (const auto i : rv::iota(0uz, rn::size(buff))) {
+                buff[i] += T(t.coefficient) * scratch_buff[i];
+            }
+        });
+    }
+}
+
+template<typename OutMDS, typename... Terms>
+void evaluate(const OutMDS out, const std::tuple<Terms...>& terms) {
+    using T                       = typename OutMDS::value_type;
+    static constexpr auto R       = OutMDS::rank();
+    static constexpr auto leaders = group_leaders<Terms...>;
+    static constexpr auto D       = std::invoke(
+        []<typename... MDS>(std::type_identity<std::tuple<MDS...>>) {
+            return einsum<term_t<0uz, Terms...>::estr>::template deduce_dimension<OutMDS, MDS...>();
+        },
+        std::type_identity<factor_tuple_t<Terms...>>{});
+
+    const auto geometric = [](const auto&... mds) {
+        return (has_geometric_extents(mds, D) and ...);
+    };
+    const auto all_geometric = geometric(out) and std::apply(
+        [&](const auto&... t) { return (std::apply(geometric, t.factors) and ...); }, terms);
+    if (not all_geometric) {
+        throw std::logic_error{ "Dynamic extent does not match the einsum dimension." };
+    }
+
+    const auto commons = std::invoke(
+        [&]<std::size_t... L>(std::index_sequence<L...>) {
+            return std::tuple{ common_factors<L>(terms)... };
+        },
+        std::index_sequence_for<Terms...>());
+
+    // Groups which are not executed directly are contracted to temporaries beforehand.
+    auto contracted = std::array<std::vector<T>, sizeof...(Terms)>{};
+    std::invoke(
+        [&]<std::size_t... L>(std::index_sequence<L...>) {
+            const auto contract = [&]<std::size_t I>() {
+                if constexpr (leaders[I] == I
+                              and not einsum<term_t<I, Terms...>::estr>::executes_directly()) {
+                    contract_group<I, R, D>(terms, std::get<I>(commons), contracted[I]);
+                }
+            };
+            (contract.template operator()<L>(), ...);
+        },
+        std::index_sequence_for<Terms...>());
+
+    // Single pass over the output, which adds up the groups.
+    for (const auto i : rv::iota(0uz, sstd::integer_pow(D, R))) {
+        const auto out_idx = unravel<R, D>(i);
+        auto element       = T{};
+        std::invoke(
+            [&]<std::size_t... L>(std::index_sequence<L...>) {
+                const auto add_group = [&]<std::size_t I>() {
+                    if constexpr (leaders[I] != I) {
+                        return;
+                    } else if constexpr (einsum<term_t<I, Terms...>::estr>::executes_directly()) {
+                        element +=
+                            direct_group_element<I, D, T>(terms, std::get<I>(commons), out_idx);
+                    } else {
+                        element += contracted[I][i];
+                    }
+                };
+                (add_group.template operator()<L>(), ...);
+            },
+            std::index_sequence_for<Terms...>());
+        out[out_idx] = element;
+    }
+}
+
+} // namespace expression_impl
+
+template<einsum_expression A, einsum_expression B>
+[[nodiscard]] constexpr auto operator+(const A& a, const B& b) {
+    return expression_impl::from_terms(
+        std::tuple_cat(expression_impl::as_terms(a), expression_impl::as_terms(b)));
+}
+
+/// Scales every term of \p e by \p s.
+template<typename S, einsum_expression E>
+    requires(std::is_arithmetic_v<S> or sstd::is_complex_v<S>)
+[[nodiscard]] constexpr auto operator*(const S s, const E& e) {
+    auto terms = expression_impl::as_terms(e);
+    std::apply([&](auto&... t) { ((t.coefficient *= s), ...); }, terms);
+    return expression_impl::from_terms(terms);
+}
+
+template<typename S, einsum_expression E>
+    requires(std::is_arithmetic_v<S> or sstd::is_complex_v<S>)
+[[nodiscard]] constexpr auto operator*(const E& e, const S s) {
+    return s * e;
+}
+
+template<einsum_expression E>
+[[nodiscard]] constexpr auto operator-(const E& e) {
+    return -1 * e;
+}
+
+template<einsum_expression A, einsum_expression B>
+[[nodiscard]] constexpr auto operator-(const A& a, const B& b) {
+    return a + -b;
+}
+
+/// Evaluates einsum expression \p e to \p out, see the top of idg/einsum_expression.hpp.
+template<typename OutMDS, einsum_expression E>
+    requires E::template compatible_output<OutMDS>
+void assign(const OutMDS out, const E& e) {
+    expression_impl::evaluate(out, expression_impl::as_terms(e));
+}
+
+} // namespace idg
@@ -0,0 +1,284 @@
+#pragma once
+/// @file Compile-time instrumentation policies of einsum.
+/*
+ * einsum<estr, Instrumentation> constructs Instrumentation::scope around every
+ * pairwise contraction, self contraction, direct loop and the final outer product:
+ *
+ * ```cpp
+ * idg::einsum<u8"ij,jk,kl->il", idg::perf_instrumentation>{}(out, A, B, C);
+ * std::print("{}", idg::trace_recorder::global().to_chrome_trace());
+ * ```
+ *
+ * no_instrumentation (the default) has empty constexpr scope, so it adds no overhead.
+ *
+ * Hardware counters (cycles, instructions and LLC misses) are read with perf_event_open.
+ * If it is not available (e.g. perf_event_paranoid or non-Linux) only wall time is recorded.
+ **/
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#    include <linux/perf_event.h>
+#    include <sys/ioctl.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+#include "idg/cpu_dispatch.hpp"
+#include "idg/einsum_explain.hpp"
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+
+struct no_instrumentation {
+    struct scope {
+        constexpr scope(einsum_operation, std::size_t, std::u8string_view) noexcept {}
+    };
+};
+
+struct hardware_counters {
+    std::uint64_t cycles, instructions, llc_misses;
+};
+
+struct trace_event {
+    einsum_operation operation;
+    std::size_t component;
+    std::string estr;
+    std::size_t thread;
+    /// Instruction set of the kernel variant which was dispatched.
+    cpu::isa kernel_isa;
+    /// Microseconds since the recorder was created.
+    double start_us, duration_us;
+    std::optional<hardware_counters> counters;
+};
+
+/// Thread safe collection of trace_events.
+class trace_recorder {
+    std::mutex mutex_{};
+    std::vector<trace_event> events_{};
+    std::chrono::steady_clock::time_point epoch_{ std::chrono::steady_clock::now() };
+
+    [[nodiscard]] static std::string escape_json(const std::string_view s) {
+        auto escaped = std::string{};
+        for (const auto c : s) {
+            if (c == '"' or c == '\\') { escaped += '\\'; }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    [[nodiscard]] static std::string counters_json(const trace_event& e) {
+        if (not e.counters) { return "{}"; }
+        return std::format(R"({{"cycles":{},"instructions":{},"llc_misses":{}}})",
+                           e.counters->cycles,
+                           e.counters->instructions,
+                           e.counters->llc_misses);
+    }
+
+  public:
+    [[nodiscard]] static trace_recorder& global() {
+        static auto recorder = trace_recorder{};
+        return recorder;
+    }
+
+    [[nodiscard]] std::chrono::steady_clock::time_point epoch() const { return epoch_; }
+
+    void record(trace_event e) {
+        const auto lock = std::scoped_lock{ mutex_ };
+        events_.push_back(std::move(e));
+    }
+
+    [[nodiscard]] std::vector<trace_event> events() {
+        const auto lock = std::scoped_lock{ mutex_ };
+        return events_;
+    }
+
+    void clear() {
+        const auto lock = std::scoped_lock{ mutex_ };
+        events_.clear();
+    }
+
+    /// Events as JSON array.
+    [[nodiscard]] std::string to_json() {
+        const auto lock = std::scoped_lock{ mutex_ };
+        auto json       = std::string{ "[" };
+        for (const auto& [i, e] : events_ | rv::enumerate) {
+            if (i != 0) { json += ','; }
+            json += std::format(
+                R"({{"operation":"{}","component":{},"estr":"{}","thread":{},"isa":"{}",)"
+                R"("start_us":{},"duration_us":{},"counters":{}}})",
+                to_string_view(e.operation),
+                e.component,
+                escape_json(e.estr),
+                e.thread,
+                cpu::to_string_view(e.kernel_isa),
+                e.start_us,
+                e.duration_us,
+                counters_json(e));
+        }
+        return json + "]";
+    }
+
+    /// Events in Chrome trace event format (chrome://tracing, Perfetto).
+    [[nodiscard]] std::string to_chrome_trace() {
+        const auto lock = std::scoped_lock{ mutex_ };
+        auto json       = std::string{ R"({"traceEvents":[)" };
+        for (const auto& [i, e] : events_ | rv::enumerate) {
+            if (i != 0) { json += ','; }
+            json += std::format(
+                R"({{"name":"{} {}","cat":"einsum","ph":"X","ts":{},"dur":{},"pid":0,"tid":{},)"
+                R"("args":{{"component":{},"isa":"{}","counters":{}}}}})",
+                to_string_view(e.operation),
+                escape_json(e.estr),
+                e.start_us,
+                e.duration_us,
+                e.thread,
+                e.component,
+                cpu::to_string_view(e.kernel_isa),
+                counters_json(e));
+        }
+        return json + "]}";
+    }
+};
+
+/// Per thread perf_event_open group of cycles, instructions and LLC misses.
+class perf_counter_group {
+    std::array<int, 3> fds_{ -1, -1, -1 };
+
+#if defined(__linux__)
+    [[nodiscard]] static int open_counter(const std::uint64_t config, const int group_fd) {
+        auto attr           = perf_event_attr{};
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.size           = sizeof(perf_event_attr);
+        attr.config         = config;
+        attr.disabled       = group_fd == -1 ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_GROUP;
+        return static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+    }
+#endif
+
+  public:
+    perf_counter_group() {
+#if defined(__linux__)
+        fds_[0] = open_counter(PERF_COUNT_HW_CPU_CYCLES, -1);
+        if (fds_[0] < 0) { return; }
+        fds_[1] = open_counter(PERF_COUNT_HW_INSTRUCTIONS, fds_[0]);
+        fds_[2] = open_counter(PERF_COUNT_HW_CACHE_MISSES, fds_[0]);
+        if (fds_[1] < 0 or fds_[2] < 0) {
+            close_all();
+            return;
+        }
+        ::ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ::ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    perf_counter_group(const perf_counter_group&)            = delete;
+    perf_counter_group& operator=(const perf_counter_group&) = delete;
+    ~perf_counter_group() { close_all(); }
+
+    void close_all() noexcept {
+#if defined(__linux__)
+        for (auto& fd : fds_) {
+            if (fd >= 0) { ::close(fd); }
+            fd = -1;
+        }
+#endif
+    }
+
+    [[nodiscard]] std::optional<hardware_counters> read() const {
+#if defined(__linux__)
+        if (fds_[0] < 0) { return std::nullopt; }
+        // PERF_FORMAT_GROUP: number of events followed by their values.
+        auto buf = std::array<std::uint64_t, 4>{};
+        if (::read(fds_[0], buf.data(), sizeof(buf)) != static_cast<ssize_t>(sizeof(buf))) {
+            return std::nullopt;
+        }
+        return hardware_counters{ .cycles = buf[1], .instructions = buf[2], .llc_misses = buf[3] };
+#else
+        return std::nullopt;
+#endif
+    }
+
+    [[nodiscard]] static perf_counter_group& this_thread() {
+        thread_local auto group = perf_counter_group{};
+        return group;
+    }
+};
+
+/// Records wall time (and hardware counters if \p with_counters) of each scope
+/// to trace_recorder::global().
+template<bool with_counters>
+struct recording_instrumentation {
+    class scope {
+        einsum_operation operation_;
+        std::size_t component_;
+        std::u8string_view estr_;
+        std::optional<hardware_counters> start_counters_{};
+        std::chrono::steady_clock::time_point start_;
+
+      public:
+        scope(const einsum_operation op, const std::size_t component, const std::u8string_view estr)
+            : operation_{ op },
+              component_{ component },
+              estr_{ estr } {
+            if constexpr (with_counters) {
+                start_counters_ = perf_counter_group::this_thread().read();
+            }
+            start_ = std::chrono::steady_clock::now();
+        }
+
+        scope(const scope&)            = delete;
+        scope& operator=(const scope&) = delete;
+
+        ~scope() {
+            const auto stop = std::chrono::steady_clock::now();
+
+            auto counters = std::optional<hardware_counters>{};
+            if constexpr (with_counters) {
+                const auto stop_counters = perf_counter_group::this_thread().read();
+                if (start_counters_ and stop_counters) {
+                    counters = hardware_counters{
+                        .cycles       = stop_counters->cycles - start_counters_->cycles,
+                        .instructions = stop_counters->instructions - start_counters_->instructions,
+                        .llc_misses   = stop_counters->llc_misses - start_counters_->llc_misses
+                    };
+                }
+            }
+
+            auto& recorder = trace_recorder::global();
+            using us       = std::chrono::duration<double, std::micro>;
+            auto estr      = std::string(reinterpret_cast<const char*>(estr_.data()), estr_.size());
+            recorder.record(
+                { .operation   = operation_,
+                  .component   = component_,
+                  .estr        = std::move(estr),
+                  .thread      = std::hash<std::thread::id>{}(std::this_thread::get_id()),
+                  .kernel_isa  = cpu::detected_isa(),
+                  .start_us    = us(start_ - recorder.epoch()).count(),
+                  .duration_us = us(stop - start_).count(),
+                  .counters    = counters });
+        }
+    };
+};
+
+using timing_instrumentation = recording_instrumentation<false>;
+using perf_instrumentation   = recording_instrumentation<true>;
+
+} // namespace idg
@@ -0,0 +1,278 @@
+#pragma once
+/// @file Tiled einsum execution for tensors which do not fit in memory.
+/*
+ * out_of_core_einsum fixes the leading output labels of the einsum and executes
+ * the remaining einsum (using the usual pairwise decomposition) for each value of them:
+ *
+ * ```cpp
+ * auto psi = idg::mapped_storage<double>::open("psi.bin", idg::map_mode::read_only);
+ * auto out = idg::mapped_storage<double>::create("out.bin", 256uz * 256 * 256 * 256);
+ * idg::out_of_core_einsum<u8"ijkl,lm->ijkm">{}(1uz << 30,
+ *                                              out.mdspan<4, 256>(),
+ *                                              psi.mdspan<4, 256>(),
+ *                                              U);
+ * ```
+ *
+ * Number of fixed labels is the smallest one for which the working set of a tile
+ * (slices of the factors and the output, and intermediates of the tile einsum)
+ * fits the memory budget. Tiles are visited in row-major order of the output,
+ * so output is written sequentially. For mapped factors (see idg/mapped_tensor.hpp)
+ * whose slices are contiguous, i.e. the fixed labels are the leading indices of a row-major
+ * factor in output order, next tile is prefetched with MADV_WILLNEED and slices which are
+ * not visited again are dropped with MADV_DONTNEED. Pages of a strided slice span almost
+ * the whole file (e.g. a tile of "ji->ij" is a column), so other factors get only
+ * MADV_RANDOM, if they are sliced by every fixed label, and MADV_NORMAL otherwise.
+ **/
+
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <sys/mman.h>
+
+#include <experimental/mdspan>
+
+#include "idg/einsum.hpp"
+#include "idg/einsum_parser.hpp"
+#include "idg/generic_algorithm.hpp"
+#include "idg/mapped_tensor.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+
+template<str::fixed_string estr>
+class out_of_core_einsum {
+    static constexpr const parsed_einsum& parser() { return parsed_einsum_v<estr>; }
+
+    static constexpr auto out_rank = rn::size(parser().output_index_labels());
+
+    /// Einsum string of a tile where the first \p M output labels are fixed.
+    template<std::size_t M>
+    static constexpr auto tile_estr = std::invoke([] {
+        const auto& p    = parser();
+        const auto fixed = p.output_index_labels().first(M);
+
+        auto s = std::u8string{};
+        for (const auto& [f, labels] : p.factor_index_labels() | rv::enumerate) {
+            if (f != 0) { s += u8','; }
+            for (const auto& l : labels) {
+                if (not rn::contains(fixed, l)) { s += l; }
+            }
+        }
+        s += u8"->";
+        for (const auto& l : p.output_index_labels().subspan(M)) { s += l; }
+
+        return str::fixed_string{ s };
+    });
+
+    /// i:th element is the ordinal of the fixed output label
+    /// corresponding to the i:th index of factor \p F, when \p M labels are fixed.
+    template<std::size_t M, std::size_t F>
+    static constexpr auto fixed_indices = std::invoke([] {
+        constexpr auto factor_rank = rn::size(parser().factor_index_labels()[F]);
+        const auto& p              = parser();
+
+        auto arr = std::array<std::optional<std::size_t>, factor_rank>{};
+        for (const auto i : rv::iota(0uz, factor_rank)) {
+            const auto k = alg::argfind(p.output_index_labels(), p.factor_index_labels()[F][i]);
+            if (k.has_value() and k.value() < M) { arr[i] = k; }
+        }
+        return arr;
+    });
+
+    /// Factor \p F contains every fixed label, so its slices are not visited again.
+    template<std::size_t M, std::size_t F>
+    static constexpr bool sliced_by_every_label =
+        static_cast<std::size_t>(
+            rn::count_if(fixed_indices<M, F>, [](const auto k) { return k.has_value(); }))
+        == M;
+
+    /// Slices of factor \p F of type \p MDS are contiguous and visited in order, as it is
+    /// row-major and the fixed labels are its leading indices in output order.
+    template<std::size_t M, std::size_t F, typename MDS>
+    static constexpr bool contiguous_slices =
+        std::same_as<typename MDS::layout_type, std::layout_right> and sliced_by_every_label<M, F>
+        and rn::all_of(rv::iota(0uz, M), [](const std::size_t i) {
+                return fixed_indices<M, F>[i] == i;
+            });
+
+    /// Tiles of row-major output are contiguous.
+    template<typename OutMDS>
+    static constexpr bool contiguous_out = std::same_as<typename OutMDS::layout_type,
+                                                        std::layout_right>;
+
+    template<std::size_t M, std::size_t F>
+    [[nodiscard]] static auto slice_factor(const auto& mds,
+                                           const std::array<std::size_t, M>& tile) {
+        static constexpr auto fixed = fixed_indices<M, F>;
+        return std::invoke(
+            [&]<std::size_t... I>(std::index_sequence<I...>) {
+                const auto slice = [&]<std::size_t J>() {
+                    if constexpr (fixed[J].has_value()) {
+                        return tile[fixed[J].value()];
+                    } else {
+                        return std::full_extent;
+                    }
+                };
+                return std::submdspan(mds, slice.template operator()<I>()...);
+            },
+            std::make_index_sequence<fixed.size()>());
+    }
+
+    template<std::size_t M>
+    [[nodiscard]] static auto slice_out(const auto& mds, const std::array<std::size_t, M>& tile) {
+        return std::invoke(
+            [&]<std::size_t... I>(std::index_sequence<I...>) {
+                const auto slice = [&]<std::size_t J>() {
+                    if constexpr (J < M) {
+                        return tile[J];
+                    } else {
+                        return std::full_extent;
+                    }
+                };
+                return std::submdspan(mds, slice.template operator()<I>()...);
+            },
+            std::make_index_sequence<out_rank>());
+    }
+
+    template<typename MDS>
+    static void advise_if_mapped(const MDS& mds, const int advice) noexcept {
+        if constexpr (is_mapped_mdspan_v<MDS>) { advise_pages(mds, advice); }
+    }
+
+    /// Bytes of a tile when \p M labels are fixed.
+    template<std::size_t M, typename OutMDS, typename... MDS>
+    [[nodiscard]] static constexpr std::size_t tile_working_set() {
+        constexpr auto D = einsum<estr>::template deduce_dimension<OutMDS, MDS...>();
+        constexpr auto element_sizes =
+            std::array<std::size_t, sizeof...(MDS)>{ sizeof(typename MDS::element_type)... };
+        using out_type = typename OutMDS::element_type;
+
+        const auto& p = parser();
+        auto bytes   = sstd::integer_pow(D, out_rank - M) * sizeof(out_type);
+
+        for (const auto& [f, labels] : p.factor_index_labels() | rv::enumerate) {
+            const auto sliced_rank = rn::count_if(labels, [&](const auto& l) {
+                const auto k = alg::argfind(p.output_index_labels(), l);
+                return not(k.has_value() and k.value() < M);
+            });
+            bytes += sstd::integer_pow(D, static_cast<std::size_t>(sliced_rank)) * element_sizes[f];
+        }
+
+        return bytes + einsum<tile_estr<M>>::explain(D, sizeof(out_type)).peak_workspace;
+    }
+
+    template<std::size_t M, typename OutMDS, typename... MDS>
+    static void execute_tiles(OutMDS out, MDS... factors) {
+        static constexpr auto D = einsum<estr>::template deduce_dimension<OutMDS, MDS...>();
+        static constexpr auto number_of_tiles = sstd::integer_pow(D, M);
+
+        const auto tile_of = [](std::size_t t) {
+            auto tile = std::array<std::size_t, M>{};
+            for (auto& i : tile | rv::reverse) {
+                i = t % D;
+                t /= D;
+            }
+            return tile;
+        };
+
+        const auto factor_tuple    = std::forward_as_tuple(factors...);
+        const auto for_each_factor = [&](const auto f) {
+            std::invoke(
+                [&]<std::size_t... F>(std::index_sequence<F...>) {
+                    (f.template operator()<F>(std::get<F>(factor_tuple)), ...);
+                },
+                std::index_sequence_for<MDS...>());
+        };
+
+        if constexpr (contiguous_out<OutMDS>) { advise_if_mapped(out, MADV_SEQUENTIAL); }
+        for_each_factor([]<std::size_t F>(const auto& mds) {
+            if constexpr (contiguous_slices<M, F, std::remove_cvref_t<decltype(mds)>>) {
+                advise_if_mapped(mds, MADV_SEQUENTIAL);
+            } else if constexpr (sliced_by_every_label<M, F>) {
+                // Read-ahead would bring in pages of the other tiles.
+                advise_if_mapped(mds, MADV_RANDOM);
+            } else {
+                advise_if_mapped(mds, MADV_NORMAL);
+            }
+        });
+
+        for (const auto t : rv::iota(0uz, number_of_tiles)) {
+            const auto tile = tile_of(t);
+
+            // Read-ahead of the next tile while this one is computed.
+            if (t + 1uz < number_of_tiles) {
+                const auto next = tile_of(t + 1uz);
+                for_each_factor([&]<std::size_t F>(const auto& mds) {
+                    if constexpr (contiguous_slices<M, F, std::remove_cvref_t<decltype(mds)>>) {
+                        advise_if_mapped(slice_factor<M, F>(mds, next), MADV_WILLNEED);
+                    }
+                });
+            }
+
+            std::invoke(
+                [&]<std::size_t... F>(std::index_sequence<F...>) {
+                    einsum<tile_estr<M>>{}(
+                        slice_out<M>(out, tile),
+                        slice_factor<M, F>(std::get<F>(factor_tuple), tile)...);
+                },
+                std::index_sequence_for<MDS...>());
+
+            for_each_factor([&]<std::size_t F>(const auto& mds) {
+                if constexpr (M != 0uz
+                              and contiguous_slices<M, F, std::remove_cvref_t<decltype(mds)>>) {
+                    advise_if_mapped(slice_factor<M, F>(mds, tile), MADV_DONTNEED);
+                }
+            });
+            // Shared file mappings keep dirty pages in the page cache, so this only unmaps them.
+            if constexpr (M != 0uz and contiguous_out<OutMDS>) {
+                advise_if_mapped(slice_out<M>(out, tile), MADV_DONTNEED);
+            }
+        }
+    }
+
+  public:
+    /// Number of fixed output labels used for memory budget of \p budget bytes.
+    ///
+    /// Throws if even the smallest tiles do not fit the budget.
+    template<typename OutMDS, typename... MDS>
+        requires einsum_compatible<estr, OutMDS, MDS...>
+    [[nodiscard]] static constexpr std::size_t number_of_fixed_labels(const std::size_t budget) {
+        static constexpr auto working_sets = std::invoke(
+            []<std::size_t... M>(std::index_sequence<M...>) {
+                return std::array{ tile_working_set<M, OutMDS, MDS...>()... };
+            },
+            std::make_index_sequence<out_rank + 1uz>());
+
+        for (const auto [m, w] : working_sets | rv::enumerate) {
+            if (w <= budget) { return static_cast<std::size_t>(m); }
+        }
+        throw std::runtime_error{ "Einsum tile does not fit the memory budget." };
+    }
+
+    /// Executes einsum tile by tile such that working set of each tile is at most \p budget bytes.
+    template<typename OutMDS, typename... MDS>
+        requires einsum_compatible<estr, OutMDS, MDS...>
+    static void operator()(const std::size_t budget, OutMDS out, MDS... factors) {
+        const auto m = number_of_fixed_labels<OutMDS, MDS...>(budget);
+
+        std::invoke(
+            [&]<std::size_t... M>(std::index_sequence<M...>) {
+                std::ignore = ((m == M and (execute_tiles<M>(out, factors...), true)) or ...);
+            },
+            std::make_index_sequence<out_rank + 1uz>());
+    }
+};
+
+} // namespace idg
@@ -0,0 +1,209 @@
+#pragma once
+/// @file Multi-threaded einsum with selectable reduction order.
+/*
+ * parallel_einsum splits the output elements of an einsum to threads and, if there are
+ * fewer output elements than threads, also the contraction index space of each element.
+ * Reduction mode is selected per call:
+ *
+ * ```cpp
+ * idg::parallel_einsum<u8"ijk,ijk->">{}(idg::reduction_mode::deterministic, 0uz, out, A, B);
+ * ```
+ *
+ *     fast) Contraction sums are split to as many parts as there are threads
+ *           and the parts are added in order, so results depend on the number of threads.
+ *
+ *     deterministic) Contraction index space is split to fixed blocks of
+ *           deterministic_block_size indices, which are summed in row-major order and
+ *           then added with a fixed pairwise tree. Blocks do not depend on the number of
+ *           threads, so results are bitwise identical for any number of threads.
+ *
+ * Only einsums which execute directly (see einsum::executes_directly) are supported,
+ * since the reductions of the others happen in their pairwise contractions.
+ **/
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <numeric>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "idg/einsum.hpp"
+#include "idg/einsum_parser.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+#include "idg/tensor_allocator.hpp"
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+
+enum class reduction_mode { fast, deterministic };
+
+[[nodiscard]] constexpr std::string_view to_string_view(const reduction_mode m) {
+    switch (m) {
+        case reduction_mode::fast: return "fast";
+        case reduction_mode::deterministic: return "deterministic";
+    }
+    throw std::logic_error{ "Unknown reduction mode." };
+}
+
+/// Adds \p partials with a pairwise tree, which depends only on the number of partials.
+///
+/// Partials are overwritten.
+template<typename T>
+[[nodiscard]] constexpr T tree_sum(const std::span<T> partials) {
+    if (partials.empty()) { return T{}; }
+    for (auto width = 1uz; width < partials.size(); width *= 2uz) {
+        for (auto i = 0uz; i + width < partials.size(); i += 2uz * width) {
+            partials[i] += partials[i + width];
+        }
+    }
+    return partials.front();
+}
+
+template<str::fixed_string estr>
+class parallel_einsum {
+    static constexpr const parsed_einsum& parser() { return parsed_einsum_v<estr>; }
+
+    static constexpr auto out_rank               = rn::size(parser().output_index_labels());
+    static constexpr auto number_of_contractions = rn::size(parser().contractions());
+
+    template<std::size_t rank, std::size_t D>
+    [[nodiscard]] static constexpr std::array<std::size_t, rank> unflatten(std::size_t flat) {
+        auto idx = std::array<std::size_t, rank>{};
+        for (auto& i : idx | rv::reverse) {
+            i = flat % D;
+            flat /= D;
+        }
+        return idx;
+    }
+
+    /// Sum over contraction indices [first, last) (in row-major order) of element \p out_idx.
+    template<std::size_t D, typename T, typename... MDS>
+    [[nodiscard]] static T partial_sum(const std::array<std::size_t, out_rank>& out_idx,
+                                       const std::size_t first,
+                                       const std::size_t last,
+                                       const MDS&... factors) {
+        auto sum             = T{};
+        auto contraction_idx = unflatten<number_of_contractions, D>(first);
+
+        for ([[maybe_unused]] const auto _ : rv::iota(first, last)) {
+            const auto sorted_indices = einsum<estr>::apply_index_map(out_idx, contraction_idx);
+            sum += std::invoke(
+                [&]<std::size_t... I>(std::index_sequence<I...>) {
+                    return (factors[std::get<I>(sorted_indices)] * ...);
+                },
+                std::index_sequence_for<MDS...>());
+
+            for (auto k = number_of_contractions; k-- > 0uz;) {
+                if (++contraction_idx[k] < D) { break; }
+                contraction_idx[k] = 0uz;
+            }
+        }
+        return sum;
+    }
+
+  public:
+    /// Contraction indices summed in order before the pairwise tree in deterministic mode.
+    static constexpr auto deterministic_block_size = 1024uz;
+
+    /// Output of dimension \p D whose elements are touched first by the threads which
+    /// reduce them, when operator() is called with the same \p threads.
+    ///
+    /// Output elements are partitioned as in operator() (unless there are fewer outputs
+    /// than threads), so on NUMA machines each thread writes to its own node.
+    template<typename T, std::size_t D>
+    [[nodiscard]] static tensor_buffer<T> make_out_buffer(const std::size_t threads = 0uz) {
+        return tensor_buffer<T>(sstd::integer_pow(D, out_rank),
+                                hugepage_allocator<T>({ .threads = threads }));
+    }
+
+    /// Evaluates the einsum with \p threads threads using reduction \p mode.
+    ///
+    /// If \p threads is zero, default_number_of_threads() is used.
+    template<typename OutMDS, typename... MDS>
+        requires einsum_compatible<estr, OutMDS, MDS...>
+                 and (einsum<estr>::executes_directly())
+    static void operator()(const reduction_mode mode,
+                           const std::size_t threads,
+                           OutMDS out,
+                           MDS... factors) {
+        static constexpr auto D = einsum<estr>::template deduce_dimension<OutMDS, MDS...>();
+        static constexpr auto number_of_outputs = sstd::integer_pow(D, out_rank);
+        static constexpr auto contraction_size  = sstd::integer_pow(D, number_of_contractions);
+        static constexpr auto number_of_blocks =
+            (contraction_size + deterministic_block_size - 1uz) / deterministic_block_size;
+
+        using T = typename OutMDS::value_type;
+
+        const auto t           = threads == 0uz ? default_number_of_threads() : threads;
+        const auto block_range = [](const std::size_t b) {
+            return std::pair{ b * deterministic_block_size,
+                              std::min(contraction_size, (b + 1uz) * deterministic_block_size) };
+        };
+        const auto store = [&](const std::size_t o, const T value) {
+            out[unflatten<out_rank, D>(o)] = value;
+        };
+
+        const auto deterministic = mode == reduction_mode::deterministic;
+
+        if (number_of_outputs >= t or contraction_size == 1uz) {
+            // Each output element is reduced by one thread.
+            const auto reduce_outputs = [&](const std::size_t first, const std::size_t last) {
+                auto partials = std::vector<T>(deterministic ? number_of_blocks : 0uz);
+                for (const auto o : rv::iota(first, last)) {
+                    const auto out_idx = unflatten<out_rank, D>(o);
+                    if (not deterministic) {
+                        store(o, partial_sum<D, T>(out_idx, 0uz, contraction_size, factors...));
+                        continue;
+                    }
+                    for (const auto b : rv::iota(0uz, number_of_blocks)) {
+                        const auto [cf, cl] = block_range(b);
+                        partials[b]         = partial_sum<D, T>(out_idx, cf, cl, factors...);
+                    }
+                    store(o, tree_sum(std::span(partials)));
+                }
+            };
+            parallel_blocks(number_of_outputs, t, reduce_outputs);
+            return;
+        }
+
+        // Fewer output elements than threads, so contraction sums are split to parts too.
+        const auto parts = deterministic ? number_of_blocks : std::min(contraction_size, t);
+        auto partials    = std::vector<T>(number_of_outputs * parts);
+
+        const auto reduce_parts = [&](const std::size_t first, const std::size_t last) {
+            for (const auto task : rv::iota(first, last)) {
+                const auto [cf, cl] = deterministic
+                                          ? block_range(task % parts)
+                                          : block_partition(contraction_size, parts, task % parts);
+                partials[task] = partial_sum<D, T>(
+                    unflatten<out_rank, D>(task / parts), cf, cl, factors...);
+            }
+        };
+        parallel_blocks(rn::size(partials), t, reduce_parts);
+
+        for (const auto o : rv::iota(0uz, number_of_outputs)) {
+            const auto p = std::span(partials).subspan(o * parts, parts);
+            store(o, deterministic ? tree_sum(p) : std::accumulate(p.begin(), p.end(), T{}));
+        }
+    }
+
+    /// Evaluates the einsum with default_number_of_threads() threads using reduction \p mode.
+    template<typename OutMDS, typename... MDS>
+        requires einsum_compatible<estr, OutMDS, MDS...>
+                 and (einsum<estr>::executes_directly())
+    static void operator()(const reduction_mode mode, OutMDS out, MDS... factors) {
+        operator()(mode, 0uz, out, factors...);
+    }
+};
+
+} // namespace idg
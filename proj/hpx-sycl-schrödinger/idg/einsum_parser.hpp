@@ -0,0 +1,284 @@
+#pragma once
+/// @file Parser for einsum strings.
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <iterator>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "idg/generic_algorithm.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+using namespace std::literals;
+
+class einsum_parser {
+  public:
+    /// Labels are single code units, so they are compared and stored as integers.
+    using index_label             = char8_t;
+    using factor_index_labels_vec = std::vector<index_label>;
+
+    /// Cursor concept borrowed from flux c++ library.
+    struct index_cursor {
+        std::size_t factor, index;
+        [[nodiscard]] constexpr bool operator==(const index_cursor&) const = default;
+    };
+
+    // constexpr std::[flat_]set is not implemented
+    using contraction = sstd::constexpr_set<index_cursor>;
+
+    /// There can not be more distinct labels than values of index_label.
+    static constexpr auto max_labels = 256uz;
+    using label_set                  = std::bitset<max_labels>;
+
+  private:
+    std::vector<factor_index_labels_vec> factor_index_labels_{};
+    factor_index_labels_vec output_index_labels_{};
+
+    factor_index_labels_vec free_index_labels_{};
+    std::vector<contraction> contractions_{};
+
+    [[nodiscard]] static constexpr std::size_t to_key(const index_label label) {
+        return static_cast<std::size_t>(label);
+    }
+
+  public:
+    [[nodiscard]] constexpr einsum_parser(const std::u8string_view str) {
+        auto factor_and_maybe_output_index_labels =
+            str | rv::filter([](const char8_t c) { return not str::is_whitespace(c); })
+            | rv::split(u8"->"sv);
+
+        for (const auto factor_str :
+             *factor_and_maybe_output_index_labels.begin() | rv::split(u8',')) {
+            factor_index_labels_.push_back(factor_str | rn::to<factor_index_labels_vec>());
+        }
+
+        // Fill contractions_:
+
+        // Labels are interned to ids in the order of their first appearance. State of each
+        // label is looked up by its code unit, so each label is handled in constant time.
+        struct interned_label {
+            index_label label;
+            /// Cursor where the label is encountered first time.
+            index_cursor first;
+            /// Ordinal of the contraction, if the label has been encountered twice.
+            std::size_t contraction;
+        };
+        auto interned   = std::vector<interned_label>{};
+        auto ids        = std::array<std::size_t, max_labels>{};
+        auto seen       = label_set{};
+        auto contracted = label_set{};
+
+        for (const auto [f, labels] : factor_index_labels_ | rv::enumerate) {
+            for (const auto [i, label] : labels | rv::enumerate) {
+                const auto cursor = index_cursor{ static_cast<std::size_t>(f),
+                                                  static_cast<std::size_t>(i) };
+                const auto key    = to_key(label);
+
+                if (not seen.test(key)) {
+                    // First time.
+                    seen.set(key);
+                    ids[key] = rn::size(interned);
+                    interned.push_back({ .label = label, .first = cursor, .contraction = 0uz });
+                    continue;
+                }
+
+                auto& l = interned[ids[key]];
+                if (not contracted.test(key)) {
+                    // Second time.
+                    contracted.set(key);
+                    l.contraction = rn::size(contractions_);
+                    contractions_.push_back({});
+                    std::ignore = contractions_.back().successfully_insert(l.first);
+                }
+
+                if (not contractions_[l.contraction].successfully_insert(cursor)) {
+                    throw std::logic_error{ "Each cursor should only appear once." };
+                }
+            }
+        }
+
+        // Figure out free index labels.
+        for (const auto& l : interned) {
+            if (not contracted.test(to_key(l.label))) { free_index_labels_.push_back(l.label); }
+        }
+
+        if (rn::distance(factor_and_maybe_output_index_labels) == 1) {
+            // Implicit return indices.
+            output_index_labels_ = free_index_labels_;
+
+        } else if (rn::distance(factor_and_maybe_output_index_labels) == 2) {
+            // Explicit return indices.
+            const auto return_str = *rn::next(rn::begin(factor_and_maybe_output_index_labels));
+            output_index_labels_  = return_str | rn::to<factor_index_labels_vec>();
+        } else {
+            // Error.
+            throw std::logic_error{ "-> can only appear once." };
+        }
+    }
+
+    [[nodiscard]] constexpr std::size_t number_of_factors(this auto&& self) {
+        return self.factor_index_labels_.size();
+    };
+
+    [[nodiscard]] constexpr std::span<factor_index_labels_vec const>
+        factor_index_labels(this auto&& self) {
+        return { self.factor_index_labels_ };
+    }
+
+    [[nodiscard]] constexpr std::span<const contraction> contractions(this auto&& self) {
+        return { self.contractions_ };
+    }
+
+    [[nodiscard]] constexpr std::span<const index_label> output_index_labels(this auto&& self) {
+        return { self.output_index_labels_ };
+    }
+
+    [[nodiscard]] constexpr std::span<const index_label> free_index_labels(this auto&& self) {
+        return { self.free_index_labels_ };
+    }
+};
+
+/// Result of einsum_parser in fixed-capacity arrays, together with the index map.
+///
+/// Unlike einsum_parser it does not allocate, so it can be a constant, and parsed_einsum_v
+/// memoizes it for each einsum string. Everything that queries the structure of an einsum
+/// at compile time reads parsed_einsum_v, so each string is parsed once per translation unit.
+///
+/// Views returned by the member functions refer to the object they are called on.
+class parsed_einsum {
+  public:
+    using index_label  = einsum_parser::index_label;
+    using index_cursor = einsum_parser::index_cursor;
+
+    /// Einsum strings are fixed_strings, so no list of labels or cursors is longer.
+    static constexpr auto capacity = str::fixed_string::max_length;
+
+    /// Index map of a free label which does not appear in the output.
+    static constexpr auto not_mapped = static_cast<std::size_t>(-1);
+
+  private:
+    std::size_t number_of_factors_{ 0uz };
+    std::size_t number_of_contractions_{ 0uz };
+    std::size_t number_of_output_labels_{ 0uz };
+    std::size_t number_of_free_labels_{ 0uz };
+
+    /// Labels of the factors concatenated, factor F is [factor_offsets_[F], factor_offsets_[F+1]).
+    std::array<index_label, capacity> factor_labels_{};
+    std::array<std::size_t, capacity + 1uz> factor_offsets_{};
+    /// Index of each factor index (in the order of factor_labels_) in the concatenation
+    /// of the output index and the contraction index.
+    std::array<std::size_t, capacity> index_map_{};
+
+    std::array<index_label, capacity> output_labels_{};
+    std::array<index_label, capacity> free_labels_{};
+
+    /// Cursors of the contractions concatenated in the same way as the factor labels.
+    std::array<index_cursor, capacity> contraction_cursors_{};
+    std::array<std::size_t, capacity + 1uz> contraction_offsets_{};
+
+  public:
+    [[nodiscard]] constexpr explicit parsed_einsum(const einsum_parser& p)
+        : number_of_factors_{ p.number_of_factors() },
+          number_of_contractions_{ rn::size(p.contractions()) },
+          number_of_output_labels_{ rn::size(p.output_index_labels()) },
+          number_of_free_labels_{ rn::size(p.free_index_labels()) } {
+        rn::copy(p.output_index_labels(), output_labels_.begin());
+        rn::copy(p.free_index_labels(), free_labels_.begin());
+
+        for (const auto& [f, labels] : p.factor_index_labels() | rv::enumerate) {
+            const auto first = factor_offsets_[static_cast<std::size_t>(f)];
+            rn::copy(labels, rn::next(factor_labels_.begin(), first));
+            factor_offsets_[static_cast<std::size_t>(f) + 1uz] = first + rn::size(labels);
+        }
+
+        for (const auto& [c, contraction] : p.contractions() | rv::enumerate) {
+            const auto first   = contraction_offsets_[static_cast<std::size_t>(c)];
+            const auto cursors = contraction.get_data();
+            rn::copy(cursors, rn::next(contraction_cursors_.begin(), first));
+            contraction_offsets_[static_cast<std::size_t>(c) + 1uz] = first + rn::size(cursors);
+        }
+
+        // Free labels are mapped to their position in the output
+        // and contracted labels after the output index.
+        for (const auto f : rv::iota(0uz, number_of_factors_)) {
+            for (const auto i : rv::iota(factor_offsets_[f], factor_offsets_[f + 1uz])) {
+                const auto k  = alg::argfind(this->output_index_labels(), factor_labels_[i]);
+                index_map_[i] = k ? *k : not_mapped;
+            }
+        }
+        for (const auto c : rv::iota(0uz, number_of_contractions_)) {
+            for (const auto& cursor : this->contractions()[c]) {
+                index_map_[factor_offsets_[cursor.factor] + cursor.index] =
+                    number_of_output_labels_ + c;
+            }
+        }
+    }
+
+    [[nodiscard]] constexpr explicit parsed_einsum(const std::u8string_view str)
+        : parsed_einsum(einsum_parser(str)) {}
+
+    [[nodiscard]] constexpr std::size_t number_of_factors(this auto&& self) {
+        return self.number_of_factors_;
+    }
+
+    /// View of the label spans of the factors.
+    [[nodiscard]] constexpr rn::random_access_range auto
+        factor_index_labels(this const parsed_einsum& self) {
+        return rv::iota(0uz, self.number_of_factors_)
+               | rv::transform([&self](const std::size_t f) {
+                     return std::span(self.factor_labels_)
+                         .subspan(self.factor_offsets_[f],
+                                  self.factor_offsets_[f + 1uz] - self.factor_offsets_[f]);
+                 });
+    }
+
+    /// View of the cursor spans of the contractions.
+    [[nodiscard]] constexpr rn::random_access_range auto
+        contractions(this const parsed_einsum& self) {
+        return rv::iota(0uz, self.number_of_contractions_)
+               | rv::transform([&self](const std::size_t c) {
+                     return std::span(self.contraction_cursors_)
+                         .subspan(self.contraction_offsets_[c],
+                                  self.contraction_offsets_[c + 1uz]
+                                      - self.contraction_offsets_[c]);
+                 });
+    }
+
+    [[nodiscard]] constexpr std::span<const index_label>
+        output_index_labels(this const parsed_einsum& self) {
+        return std::span(self.output_labels_).first(self.number_of_output_labels_);
+    }
+
+    [[nodiscard]] constexpr std::span<const index_label>
+        free_index_labels(this const parsed_einsum& self) {
+        return std::span(self.free_labels_).first(self.number_of_free_labels_);
+    }
+
+    /// Index of each index of factor \p F in the concatenation of the output index
+    /// and the contraction index, or not_mapped.
+    [[nodiscard]] constexpr std::span<const std::size_t>
+        factor_index_map(this const parsed_einsum& self, const std::size_t F) {
+        const auto first = self.factor_offsets_[F];
+        return std::span(self.index_map_).subspan(first, self.factor_offsets_[F + 1uz] - first);
+    }
+};
+
+/// parsed_einsum of \p estr, which the compiler evaluates once per translation unit.
+template<str::fixed_string estr>
+inline constexpr auto parsed_einsum_v = parsed_einsum(estr.sv());
+
+} // namespace idg
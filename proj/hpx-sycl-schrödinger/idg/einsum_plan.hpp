@@ -0,0 +1,422 @@
+#pragma once
+/// @file Runtime representation of the pairwise contraction plan of an einsum.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "idg/einsum_parser.hpp"
+#include "idg/generic_algorithm.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+#include "idg/tensor_network.hpp"
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+
+/// Builds tensor network from \p p and returns it with the node ids of the factors.
+///
+/// i:th node id corresponds to the i:th factor of the einsum.
+[[nodiscard]] constexpr std::pair<std::vector<tensor_network::node_id>, tensor_network>
+    einsum_network(const parsed_einsum& p) {
+    auto net = tensor_network();
+
+    const auto id_vec = p.factor_index_labels() | rv::transform(rn::size)
+                        | rv::transform([&](const auto r) { return net.add_node(r); })
+                        | rn::to<std::vector>();
+
+    for (const auto indices : p.contractions()) {
+        if (rn::size(indices) != 2) {
+            throw std::logic_error{ "Reuction has to have to connect two indices." };
+        }
+        const auto [lhs_factor, lhs_index] = indices[0];
+        const auto [rhs_factor, rhs_index] = indices[1];
+
+        net.add_edge({ id_vec[lhs_factor], lhs_index }, { id_vec[rhs_factor], rhs_index });
+    }
+    return { id_vec, net };
+}
+
+/// Kernel used to execute a pairwise contraction.
+///
+/// permutation is used only by direct einsums with one factor and no contractions.
+/// fused_loop executes the step together with the previous one, see step_fusion.
+enum class contraction_kernel : std::uint8_t { generic_loop = 0, permutation = 1, fused_loop = 2 };
+
+[[nodiscard]] constexpr std::string_view to_string_view(const contraction_kernel k) {
+    switch (k) {
+        case contraction_kernel::generic_loop: return "generic loop";
+        case contraction_kernel::permutation: return "cache-oblivious permutation";
+        case contraction_kernel::fused_loop: return "fused loop";
+    }
+    throw std::logic_error{ "Unknown contraction_kernel." };
+}
+
+/// One pairwise contraction of a connected component.
+///
+/// Registers are numbered as in einsum: first come the factors of the einsum
+/// and then the outputs of the pairwise contractions in the order of execution.
+/// Output of the last step of a component is the output of the component.
+struct pairwise_step {
+    std::size_t lhs_register, rhs_register, out_register, out_rank;
+    /// Index labels of lhs and rhs which form einsum string "lhs_labels,rhs_labels".
+    std::u8string lhs_labels, rhs_labels;
+    contraction_kernel kernel{ contraction_kernel::generic_loop };
+    /// Step depends only on constant factors, so its output can be computed once and reused.
+    bool precontracted{ false };
+    /// Output is not materialized, but computed slice by slice in the loop of the next step.
+    bool fused_with_next{ false };
+
+    [[nodiscard]] friend constexpr bool operator==(const pairwise_step&,
+                                                   const pairwise_step&) = default;
+};
+
+/// Free labels of einsum string "lhs,rhs" in order of appearance, i.e. labels of its output.
+[[nodiscard]] constexpr std::u8string pairwise_output_labels(const std::u8string_view lhs,
+                                                             const std::u8string_view rhs) {
+    auto labels    = std::u8string{};
+    const auto all = std::u8string(lhs) + std::u8string(rhs);
+    for (const auto c : all) {
+        if (rn::count(all, c) == 1) { labels += c; }
+    }
+    return labels;
+}
+
+/// Loop fusion of pairwise step \p first into the next step \p second, which consumes its output.
+///
+/// Labels of the intermediate which are not contracted by the second step (outer labels)
+/// form an outer loop. For each value of them, slices of both steps are executed
+/// and only a slice of the intermediate is kept in a buffer of rank intermediate_rank.
+///
+/// Outer labels are given in the label alphabets of both steps, k:th label being the k:th loop.
+struct step_fusion {
+    std::u8string first_outer_labels, second_outer_labels;
+    /// Labels of the output of the second step.
+    std::u8string second_out_labels;
+    /// Einsum strings of the slices, with explicit output.
+    std::u8string first_estr, second_estr;
+    std::size_t intermediate_rank;
+};
+
+[[nodiscard]] constexpr std::optional<step_fusion> fuse_steps(const pairwise_step& first,
+                                                              const pairwise_step& second) {
+    const auto intermediate_is_lhs = second.lhs_register == first.out_register;
+    if (not intermediate_is_lhs and second.rhs_register != first.out_register) {
+        return std::nullopt;
+    }
+
+    const auto& intermediate = intermediate_is_lhs ? second.lhs_labels : second.rhs_labels;
+    const auto& other        = intermediate_is_lhs ? second.rhs_labels : second.lhs_labels;
+    const auto first_out     = pairwise_output_labels(first.lhs_labels, first.rhs_labels);
+
+    auto f = step_fusion{ .second_out_labels =
+                              pairwise_output_labels(second.lhs_labels, second.rhs_labels) };
+
+    // Index order of the intermediate is the same in both alphabets.
+    for (const auto [i, c] : intermediate | rv::enumerate) {
+        if (not rn::contains(other, c)) {
+            f.first_outer_labels += first_out[static_cast<std::size_t>(i)];
+            f.second_outer_labels += c;
+        }
+    }
+    if (f.first_outer_labels.empty()) { return std::nullopt; }
+
+    const auto strip = [](const std::u8string_view labels, const std::u8string_view outer) {
+        auto stripped = std::u8string{};
+        for (const auto c : labels) {
+            if (not rn::contains(outer, c)) { stripped += c; }
+        }
+        return stripped;
+    };
+
+    const auto outer1 = std::u8string_view(f.first_outer_labels);
+    const auto outer2 = std::u8string_view(f.second_outer_labels);
+
+    f.first_estr = strip(first.lhs_labels, outer1) + u8"," + strip(first.rhs_labels, outer1)
+                   + u8"->" + strip(first_out, outer1);
+
+    const auto sliced_intermediate = strip(intermediate, outer2);
+    f.second_estr = (intermediate_is_lhs ? sliced_intermediate + u8"," + other
+                                         : other + u8"," + sliced_intermediate)
+                    + u8"->" + strip(f.second_out_labels, outer2);
+
+    f.intermediate_rank = rn::size(sliced_intermediate);
+    return f;
+}
+
+/// Cost model of loop fusion, in units of one multiply-add.
+namespace fusion_cost {
+
+/// Overhead of one iteration of the outer loop, i.e. two einsums on slices.
+inline constexpr std::size_t outer_iteration = 32uz;
+/// Writing and reading back one element of a materialized intermediate.
+inline constexpr std::size_t intermediate_element = 4uz;
+/// Slices larger than this are not kept in L1 (or registers), so fusion does not pay off.
+inline constexpr std::size_t max_slice_elements = 2048uz;
+
+/// Fusion never changes the number of multiply-adds, so only the traffic of
+/// the materialized intermediate is compared to the overhead of the outer loop.
+[[nodiscard]] constexpr bool pays_off(const std::size_t D,
+                                      const pairwise_step& first,
+                                      const step_fusion& f) {
+    const auto outer = rn::size(f.first_outer_labels);
+    return sstd::integer_pow(D, f.intermediate_rank) <= max_slice_elements
+           and intermediate_element * sstd::integer_pow(D, first.out_rank)
+                   > outer_iteration * sstd::integer_pow(D, outer);
+}
+
+} // namespace fusion_cost
+
+struct component_plan {
+    std::size_t rank;
+    /// Number of self contractions of one node component or number of steps otherwise.
+    std::size_t number_of_contractions;
+    /// Ordinal of the factor which corresponds to the one node connected component.
+    std::optional<std::size_t> one_node_factor_ordinal;
+    std::vector<pairwise_step> steps{};
+
+    [[nodiscard]] friend constexpr bool operator==(const component_plan&,
+                                                   const component_plan&) = default;
+};
+
+/// Pairwise contraction sequences of each connected component of an einsum.
+///
+/// Planning is done by the constructors taking einsum string
+/// and the other constructor exists to restore already done plans.
+///
+/// Factors can be marked constant (e.g. fixed operators of an iterative solver),
+/// in which case contractions between them are considered free by the planner
+/// and the corresponding steps are marked precontracted.
+class einsum_plan {
+    std::size_t dimension_{};
+    std::vector<component_plan> components_{};
+
+  public:
+    [[nodiscard]] constexpr einsum_plan(const std::size_t D, std::vector<component_plan> components)
+        : dimension_{ D },
+          components_{ std::move(components) } {}
+
+    [[nodiscard]] constexpr einsum_plan(const std::u8string_view estr, const std::size_t D)
+        : einsum_plan(estr, D, std::span<const std::size_t>{}) {}
+
+    /// \p constant_factors are ordinals of the factors which are constant.
+    [[nodiscard]] constexpr einsum_plan(const std::u8string_view estr,
+                                        const std::size_t D,
+                                        const std::span<const std::size_t> constant_factors)
+        : einsum_plan(parsed_einsum(estr), D, constant_factors) {}
+
+    /// Plans already parsed einsum, e.g. parsed_einsum_v of a compile-time einsum string.
+    [[nodiscard]] constexpr einsum_plan(const parsed_einsum& p,
+                                        const std::size_t D,
+                                        const std::span<const std::size_t> constant_factors = {})
+        : dimension_{ D } {
+        const auto [id_vec, net] = einsum_network(p);
+
+        auto constant_nodes = std::vector<tensor_network::node_id>{};
+        for (const auto f : constant_factors) {
+            if (f >= rn::size(id_vec)) {
+                throw std::logic_error{ "Constant factor out of range." };
+            }
+            constant_nodes.push_back(id_vec[f]);
+        }
+
+        for (const auto& cc : net.connected_components()) {
+            if (cc.size() == 1uz) {
+                // .value() should never throw.
+                const auto factor = alg::argfind(id_vec, cc.view_nodes()[0].id).value();
+                components_.push_back({ .rank                    = cc.rank(),
+                                        .number_of_contractions  = rn::size(cc.view_edges()),
+                                        .one_node_factor_ordinal = factor });
+                continue;
+            }
+
+            auto registers          = id_vec;
+            auto constant_registers = id_vec | rv::transform([&](const auto id) {
+                                          return rn::contains(constant_nodes, id);
+                                      })
+                                      | rn::to<std::vector>();
+            auto steps = std::vector<pairwise_step>{};
+
+            for (const auto& c : cc.pairwise_contraction_sequence(D, constant_nodes)) {
+                // These should always be found.
+                const auto lhs_reg = alg::argfind(registers, c.lhs_id()).value();
+                const auto rhs_reg = alg::argfind(registers, c.rhs_id()).value();
+
+                const auto precontracted =
+                    constant_registers[lhs_reg] and constant_registers[rhs_reg];
+                registers.push_back(c.out_id());
+                constant_registers.push_back(precontracted);
+
+                auto [lhs_str, rhs_str] = c.index_labels();
+                steps.push_back({ .lhs_register  = lhs_reg,
+                                  .rhs_register  = rhs_reg,
+                                  .out_register  = rn::size(registers) - 1uz,
+                                  .out_rank      = c.out_rank(),
+                                  .lhs_labels    = std::move(lhs_str),
+                                  .rhs_labels    = std::move(rhs_str),
+                                  .precontracted = precontracted });
+            }
+
+            // Fuse pairs of consecutive steps which the cost model favours.
+            // Precontracted intermediates are kept materialized, so they can be reused.
+            for (auto i = 0uz; i + 1uz < rn::size(steps); ++i) {
+                const auto f = fuse_steps(steps[i], steps[i + 1uz]);
+                if (f.has_value() and not steps[i].precontracted
+                    and fusion_cost::pays_off(D, steps[i], f.value())) {
+                    steps[i].fused_with_next = true;
+                    steps[i + 1uz].kernel    = contraction_kernel::fused_loop;
+                    ++i;
+                }
+            }
+
+            components_.push_back({ .rank                    = cc.rank(),
+                                    .number_of_contractions  = rn::size(steps),
+                                    .one_node_factor_ordinal = std::nullopt,
+                                    .steps                   = std::move(steps) });
+        }
+    }
+
+    [[nodiscard]] constexpr std::size_t dimension(this auto&& self) { return self.dimension_; }
+
+    [[nodiscard]] constexpr std::span<const component_plan> components(this auto&& self) {
+        return { self.components_ };
+    }
+
+    [[nodiscard]] friend constexpr bool operator==(const einsum_plan&,
+                                                   const einsum_plan&) = default;
+};
+
+/// Pairwise step in one register file of all components, which is used by executors
+/// keeping every intermediate (einsum_executor and einsum_dataflow).
+///
+/// First come the factors and then the outputs of the steps of all components
+/// in the order of the plan.
+struct register_step {
+    std::size_t component, out_register, out_rank, lhs_register, rhs_register;
+    bool precontracted;
+    /// Last step of the only component writes directly to out.
+    bool writes_out;
+    str::fixed_string einsum_str{ u8"to be replaced" };
+};
+
+struct register_component {
+    std::size_t rank;
+    std::size_t number_of_contractions;
+    std::optional<std::size_t> one_node_factor_ordinal;
+    /// Register of the output of the last step.
+    std::size_t out_register;
+
+    [[nodiscard]] constexpr bool case_A() const {
+        return one_node_factor_ordinal.has_value() and number_of_contractions == 0uz;
+    }
+
+    [[nodiscard]] constexpr bool case_B() const {
+        return one_node_factor_ordinal.has_value() and number_of_contractions != 0uz;
+    }
+};
+
+/// Steps and components of a plan in fixed size tables, see make_register_tables.
+///
+/// Each component has one step less than nodes, so there are at most
+/// max_steps = number of factors - 1 steps, of which the first number_of_steps are used.
+template<std::size_t max_steps, std::size_t number_of_components>
+struct register_tables {
+    std::size_t number_of_steps{ 0uz };
+    std::array<register_step, max_steps> steps{};
+    std::array<register_component, number_of_components> components{};
+};
+
+/// Renumbers the registers of \p plan of an einsum with \p number_of_factors factors,
+/// which are numbered from number_of_factors separately for each component, to one register file.
+template<std::size_t max_steps, std::size_t number_of_components>
+[[nodiscard]] constexpr register_tables<max_steps, number_of_components>
+    make_register_tables(const einsum_plan& plan, const std::size_t number_of_factors) {
+    if (rn::size(plan.components()) != number_of_components) {
+        throw std::logic_error{ "Wrong number of components for register tables." };
+    }
+
+    auto t = register_tables<max_steps, number_of_components>{};
+    for (const auto& [i, c] : plan.components() | rv::enumerate) {
+        const auto offset      = t.number_of_steps;
+        const auto to_register = [&](const std::size_t r) {
+            return r < number_of_factors ? r : r + offset;
+        };
+
+        for (const auto& [j, s] : c.steps | rv::enumerate) {
+            const auto last = static_cast<std::size_t>(j) + 1uz == rn::size(c.steps);
+            t.steps.at(t.number_of_steps++) = {
+                .component     = static_cast<std::size_t>(i),
+                .out_register  = to_register(s.out_register),
+                .out_rank      = s.out_rank,
+                .lhs_register  = to_register(s.lhs_register),
+                .rhs_register  = to_register(s.rhs_register),
+                .precontracted = s.precontracted,
+                .writes_out    = last and number_of_components == 1uz,
+                .einsum_str    = str::fixed_string(s.lhs_labels + u8"," + s.rhs_labels)
+            };
+        }
+        t.components[static_cast<std::size_t>(i)] = {
+            .rank                    = c.rank,
+            .number_of_contractions  = c.number_of_contractions,
+            .one_node_factor_ordinal = c.one_node_factor_ordinal,
+            .out_register            = number_of_factors + t.number_of_steps - 1uz
+        };
+    }
+    return t;
+}
+
+/// Registers of register \p tables of dimension \p D as mdspans: \p factors followed by
+/// the outputs of the steps, which are \p out for the step writing to out
+/// and \p buffers[i] for the other steps.
+template<const auto& tables, std::size_t D, typename OutMDS, typename Buffers, typename... MDS>
+[[nodiscard]] auto register_mdspans(OutMDS out, Buffers& buffers, MDS... factors) {
+    return std::tuple_cat(
+        std::tuple{ factors... },
+        std::invoke(
+            [&]<std::size_t... I>(std::index_sequence<I...>) {
+                const auto step_mdspan = [&]<std::size_t J>() {
+                    static constexpr auto s = tables.steps[J];
+                    if constexpr (s.writes_out) {
+                        return out;
+                    } else {
+                        return sstd::geometric_mdspan<typename OutMDS::element_type,
+                                                      s.out_rank,
+                                                      D>(buffers[J].data());
+                    }
+                };
+                return std::tuple{ step_mdspan.template operator()<I>()... };
+            },
+            std::make_index_sequence<tables.number_of_steps>()));
+}
+
+namespace plan_impl {
+
+/// Plan of "ij,jk,kl,l->i" with constant A and B precontracts A B,
+/// so each evaluation costs two contractions (C x and (A B) (C x)) instead of three.
+[[nodiscard]] constexpr bool precontracts_constant_chain(const std::size_t D) {
+    const auto constant_factors = std::array{ 0uz, 1uz };
+    const auto plan             = einsum_plan(u8"ij,jk,kl,l->i", D, constant_factors);
+    const auto& steps           = plan.components()[0].steps;
+    return rn::size(steps) == 3uz and rn::any_of(steps, [](const pairwise_step& s) {
+               return s.precontracted and s.lhs_register + s.rhs_register == 1uz;
+           });
+}
+
+static_assert(precontracts_constant_chain(2uz));
+static_assert(precontracts_constant_chain(16uz));
+
+} // namespace plan_impl
+
+} // namespace idg
@@ -0,0 +1,364 @@
+#pragma once
+/// @file Einsum of quantized int8 and int16 tensors.
+/*
+ * Screening passes tolerate quantized tensors, which cut the memory traffic
+ * of bandwidth bound contractions by 4-8x compared to double. Quantization is symmetric
+ * with one scale per tensor, i.e. element x is stored as round(x / scale):
+ *
+ * ```cpp
+ * const auto qA = idg::quantize(A, A8); // A8 is int8_t mdspan with the shape of A.
+ * const auto qx = idg::quantize(x, x8);
+ * idg::quantized_einsum<u8"ij,j->i">{}(out, qA, qx);
+ * ```
+ *
+ * Products are accumulated exactly in quantized_accumulator_t (int32 for int8,
+ * int64 for int16 whose products already need 31 bits) and scaled to the output type once.
+ *
+ * Einsums of the form "MK,NK->MN" with contiguous operands (e.g. matrix-vector products)
+ * are dot products over contiguous memory, which use integer dot-product instructions
+ * (AVX-VNNI, AVX-512 VNNI) chosen at runtime:
+ *
+ *  - int8: vpdpbusd multiplies unsigned and signed bytes, so the lhs is biased to unsigned,
+ *    sum_k a[k] b[k] = sum_k (a[k] + 128) b[k] - 128 sum_k b[k], which the compiler
+ *    vectorizes to vpdpbusd.
+ *  - int16: vpdpwssd sums pairs of products to int32 lanes. A pair already needs 31 bits,
+ *    so the lanes are widened to int64 after each instruction. This relies on quantize
+ *    never producing the lowest int16, whose squares would not fit.
+ *
+ * Other einsums use the direct loop of einsum with an integer output.
+ * Einsums of more than two factors would need requantization of the intermediates,
+ * so they are not supported.
+ **/
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <ranges>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <experimental/mdspan>
+
+#include "idg/cpu_dispatch.hpp"
+#include "idg/einsum.hpp"
+#include "idg/einsum_parser.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+
+#if IDG_X86_DISPATCH
+#    include <immintrin.h>
+#endif
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+
+template<typename Int>
+concept quantized_integer = std::same_as<Int, std::int8_t> or std::same_as<Int, std::int16_t>;
+
+/// Accumulator of products of quantized integers, which does not overflow in practice.
+template<typename... Int>
+    requires(quantized_integer<Int> and ...)
+using quantized_accumulator_t =
+    std::conditional_t<((sizeof(Int) == 1uz) and ...), std::int32_t, std::int64_t>;
+
+/// Quantized tensor, whose element x represents scale * x.
+template<typename MDS>
+    requires quantized_integer<std::remove_const_t<typename MDS::element_type>>
+struct quantized {
+    MDS values;
+    double scale{ 1.0 };
+};
+
+/// Quantizes \p in to \p out symmetrically with the largest absolute value mapped to
+/// the largest value of the integer type.
+template<sstd::contiguous_mdspan InMDS, sstd::contiguous_mdspan OutMDS>
+    requires quantized_integer<typename OutMDS::element_type>
+             and std::is_same_v<typename InMDS::extents_type, typename OutMDS::extents_type>
+[[nodiscard]] quantized<OutMDS> quantize(const InMDS in, const OutMDS out) {
+    using Int = typename OutMDS::element_type;
+
+    const auto values  = std::span(in.data_handle(), in.size());
+    const auto max_abs = rn::max(
+        values | rv::transform([](const auto x) { return std::abs(static_cast<double>(x)); }));
+
+    // Zero tensor is represented exactly with any scale.
+    const auto scale = max_abs == 0.0 ? 1.0 : max_abs / std::numeric_limits<Int>::max();
+    rn::transform(values, out.data_handle(), [&](const auto x) {
+        return static_cast<Int>(std::lround(static_cast<double>(x) / scale));
+    });
+    return { .values = out, .scale = scale };
+}
+
+/// Writes values represented by \p in to \p out.
+template<sstd::contiguous_mdspan InMDS, sstd::contiguous_mdspan OutMDS>
+    requires std::is_same_v<typename InMDS::extents_type, typename OutMDS::extents_type>
+void dequantize(const quantized<InMDS> in, const OutMDS out) {
+    using T = typename OutMDS::element_type;
+    rn::transform(std::span(in.values.data_handle(), in.values.size()),
+                  out.data_handle(),
+                  [&](const auto x) { return static_cast<T>(in.scale * static_cast<double>(x)); });
+}
+
+template<str::fixed_string estr>
+class quantized_einsum {
+    static constexpr const parsed_einsum& parser() { return parsed_einsum_v<estr>; }
+
+    /// Ranks of the labels in "MK,NK->MN" form of a two factor einsum.
+    struct dot_form {
+        bool applies{ false };
+        std::size_t m_rank{ 0uz }, n_rank{ 0uz }, k_rank{ 0uz };
+    };
+
+    static constexpr auto dot_form_of_estr = std::invoke([] {
+        const auto& p = parser();
+        if (p.number_of_factors() != 2uz) { return dot_form{}; }
+
+        const auto lhs = p.factor_index_labels()[0];
+        const auto rhs = p.factor_index_labels()[1];
+        const auto out = p.output_index_labels();
+
+        const auto m = static_cast<std::size_t>(
+            rn::count_if(lhs, [&](const auto& l) { return rn::contains(out, l); }));
+        if (m > rn::size(out) or m > rn::size(lhs)) { return dot_form{}; }
+
+        const auto n = rn::size(out) - m;
+        const auto k = rn::size(lhs) - m;
+        if (n + k != rn::size(rhs)) { return dot_form{}; }
+
+        const auto applies = rn::equal(lhs.first(m), out.first(m))
+                             and rn::equal(rhs.first(n), out.subspan(m))
+                             and rn::equal(lhs.subspan(m), rhs.subspan(n))
+                             and rn::none_of(lhs.subspan(m),
+                                             [&](const auto& l) { return rn::contains(out, l); });
+
+        return dot_form{ .applies = applies, .m_rank = m, .n_rank = n, .k_rank = k };
+    });
+
+    /// sum_k a[k] * b[k] accumulated exactly, with int8 \p a biased to unsigned (see the top).
+    template<std::size_t K, typename Int>
+    static quantized_accumulator_t<Int> dot(const Int* const a, const Int* const b) {
+        using accumulator = quantized_accumulator_t<Int>;
+        if constexpr (sizeof(Int) == 1uz) {
+            auto biased = accumulator{ 0 };
+            auto b_sum  = accumulator{ 0 };
+            for (const auto k : rv::iota(0uz, K)) {
+                // a[k] + 128 as unsigned byte, i.e. flipped sign bit.
+                biased += static_cast<accumulator>(static_cast<std::uint8_t>(a[k] ^ 0x80))
+                          * static_cast<accumulator>(b[k]);
+                b_sum += b[k];
+            }
+            return biased - 128 * b_sum;
+        } else {
+            auto acc = accumulator{ 0 };
+            for (const auto k : rv::iota(0uz, K)) {
+                acc += static_cast<accumulator>(a[k]) * static_cast<accumulator>(b[k]);
+            }
+            return acc;
+        }
+    }
+
+    /// out[m, n] = scale * sum_k a[m, k] * b[n, k] with contiguous k, using \p dot_product.
+    template<std::size_t M,
+             std::size_t N,
+             std::size_t K,
+             typename T,
+             typename Int,
+             auto dot_product = &dot<K, Int>>
+    static void dot_kernel(T* const out,
+                           const Int* const a,
+                           const Int* const b,
+                           const double scale) {
+        for (const auto m : rv::iota(0uz, M)) {
+            for (const auto n : rv::iota(0uz, N)) {
+                const auto acc = dot_product(a + m * K, b + n * K);
+                out[m * N + n] = static_cast<T>(scale * static_cast<double>(acc));
+            }
+        }
+    }
+
+#if IDG_X86_DISPATCH
+    // Variants of dot_kernel for runtime dispatch. For int8 the compiler vectorizes dot
+    // to vpdpbusd (checked with GCC 12 at -O3), int16 uses vpdpwssd explicitly.
+
+    /// int16 dot with vpdpwssd, whose int32 pair sums are widened to int64 right away.
+    template<std::size_t K>
+    [[gnu::target("avxvnni,avx2,fma")]]
+    static std::int64_t dot_int16_avx_vnni(const std::int16_t* const a,
+                                           const std::int16_t* const b) {
+        auto acc = _mm256_setzero_si256();
+        auto k   = 0uz;
+        for (; k + 16uz <= K; k += 16uz) {
+            const auto pairs = _mm256_dpwssd_avx_epi32(
+                _mm256_setzero_si256(),
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + k)),
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k)));
+            acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(pairs)));
+            acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(pairs, 1)));
+        }
+        auto lanes = std::array<std::int64_t, 4uz>{};
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes.data()), acc);
+
+        auto sum = std::reduce(lanes.begin(), lanes.end());
+        for (; k < K; ++k) { sum += static_cast<std::int32_t>(a[k]) * b[k]; }
+        return sum;
+    }
+
+    template<std::size_t K>
+    [[gnu::target("avx512vnni,avx512f,avx512bw,avx512vl,avx2,fma")]]
+    static std::int64_t dot_int16_avx512_vnni(const std::int16_t* const a,
+                                              const std::int16_t* const b) {
+        auto acc = _mm512_setzero_si512();
+        auto k   = 0uz;
+        for (; k + 32uz <= K; k += 32uz) {
+            const auto pairs = _mm512_dpwssd_epi32(
+                _mm512_setzero_si512(), _mm512_loadu_si512(a + k), _mm512_loadu_si512(b + k));
+            acc = _mm512_add_epi64(acc, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(pairs)));
+            acc = _mm512_add_epi64(acc,
+                                   _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(pairs, 1)));
+        }
+
+        auto sum = static_cast<std::int64_t>(_mm512_reduce_add_epi64(acc));
+        for (; k < K; ++k) { sum += static_cast<std::int32_t>(a[k]) * b[k]; }
+        return sum;
+    }
+
+    template<std::size_t M, std::size_t N, std::size_t K, typename T, typename Int>
+    [[gnu::target("avxvnni,avx2,fma"), gnu::flatten]]
+    static void dot_kernel_avx_vnni(T* const out,
+                                    const Int* const a,
+                                    const Int* const b,
+                                    const double scale) {
+        if constexpr (sizeof(Int) == 1uz) {
+            dot_kernel<M, N, K>(out, a, b, scale);
+        } else {
+            dot_kernel<M, N, K, T, Int, &dot_int16_avx_vnni<K>>(out, a, b, scale);
+        }
+    }
+
+    template<std::size_t M, std::size_t N, std::size_t K, typename T, typename Int>
+    [[gnu::target("avx512vnni,avx512f,avx512bw,avx512vl,avx2,fma"), gnu::flatten]]
+    static void dot_kernel_avx512_vnni(T* const out,
+                                       const Int* const a,
+                                       const Int* const b,
+                                       const double scale) {
+        if constexpr (sizeof(Int) == 1uz) {
+            dot_kernel<M, N, K>(out, a, b, scale);
+        } else {
+            dot_kernel<M, N, K, T, Int, &dot_int16_avx512_vnni<K>>(out, a, b, scale);
+        }
+    }
+#endif
+
+    /// Calls variant of dot_kernel for cpu::detected_dot_product_isa() chosen on the first call.
+    template<std::size_t M, std::size_t N, std::size_t K, typename T, typename Int>
+    static void dispatched_dot_kernel(T* const out,
+                                      const Int* const a,
+                                      const Int* const b,
+                                      const double scale) {
+        using kernel_ptr = void (*)(T*, const Int*, const Int*, double);
+        static const kernel_ptr kernel = []() -> kernel_ptr {
+#if IDG_X86_DISPATCH
+            switch (cpu::detected_dot_product_isa()) {
+                case cpu::dot_product_isa::avx512_vnni:
+                    return &dot_kernel_avx512_vnni<M, N, K, T, Int>;
+                case cpu::dot_product_isa::avx_vnni: return &dot_kernel_avx_vnni<M, N, K, T, Int>;
+                case cpu::dot_product_isa::none: break;
+            }
+#endif
+            // Portable variant is vectorized for the isa enabled at compile time.
+            return &dot_kernel<M, N, K, T, Int>;
+        }();
+        kernel(out, a, b, scale);
+    }
+
+    /// Executes einsum with the dispatched dot-product kernel if \p dispatch,
+    /// and with the portable one otherwise.
+    template<bool dispatch, typename OutMDS, typename... MDS>
+    static void execute(OutMDS out, const quantized<MDS>... factors) {
+        static constexpr auto D        = einsum<estr>::template deduce_dimension<OutMDS, MDS...>();
+        static constexpr auto out_rank = OutMDS::rank();
+
+        const auto scale = (1.0 * ... * factors.scale);
+
+        if constexpr (uses_dot_product_kernel<OutMDS, MDS...>()) {
+            static constexpr auto f = dot_form_of_estr;
+            static constexpr auto M = sstd::integer_pow(D, f.m_rank);
+            static constexpr auto N = sstd::integer_pow(D, f.n_rank);
+            static constexpr auto K = sstd::integer_pow(D, f.k_rank);
+            const auto operands     = std::tuple{ factors.values.data_handle()... };
+
+            if constexpr (dispatch) {
+                dispatched_dot_kernel<M, N, K>(
+                    out.data_handle(), std::get<0>(operands), std::get<1>(operands), scale);
+            } else {
+                dot_kernel<M, N, K>(
+                    out.data_handle(), std::get<0>(operands), std::get<1>(operands), scale);
+            }
+        } else {
+            using accumulator =
+                quantized_accumulator_t<std::remove_const_t<typename MDS::element_type>...>;
+
+            // Einsum with integer output accumulates the integer products exactly.
+            auto acc_buff = std::vector<accumulator>(sstd::integer_pow(D, out_rank));
+            const auto acc = sstd::geometric_mdspan<accumulator, out_rank, D>(acc_buff.data());
+            einsum<estr>{}(acc, factors.values...);
+
+            using T = typename OutMDS::element_type;
+            for (const auto [i, a] : acc_buff | rv::enumerate) {
+                auto idx = std::array<std::size_t, out_rank>{};
+                auto t   = static_cast<std::size_t>(i);
+                for (auto& j : idx | rv::reverse) {
+                    j = t % D;
+                    t /= D;
+                }
+                out[idx] = static_cast<T>(scale * static_cast<double>(a));
+            }
+        }
+    }
+
+  public:
+    /// Einsum is executed with the dot-product kernel for operands of types \p OutMDS, \p MDS...
+    template<typename OutMDS, typename... MDS>
+    [[nodiscard]] static constexpr bool uses_dot_product_kernel() {
+        if constexpr (sizeof...(MDS) != 2uz) {
+            return false;
+        } else {
+            return dot_form_of_estr.applies
+                   and (sstd::contiguous_mdspan<OutMDS> and ... and sstd::contiguous_mdspan<MDS>)
+                   and std::is_same_v<
+                       std::remove_const_t<
+                           typename std::tuple_element_t<0uz, std::tuple<MDS...>>::element_type>,
+                       std::remove_const_t<
+                           typename std::tuple_element_t<1uz, std::tuple<MDS...>>::element_type>>;
+        }
+    }
+
+    template<typename OutMDS, typename... MDS>
+        requires einsum_compatible<estr, OutMDS, MDS...> and (sizeof...(MDS) <= 2uz)
+                 and std::floating_point<typename OutMDS::element_type>
+    static void operator()(OutMDS out, const quantized<MDS>... factors) {
+        execute<true>(out, factors...);
+    }
+
+    /// Same as operator() but always with the portable dot-product kernel,
+    /// against which the dispatched kernels can be checked.
+    template<typename OutMDS, typename... MDS>
+        requires einsum_compatible<estr, OutMDS, MDS...> and (sizeof...(MDS) <= 2uz)
+                 and std::floating_point<typename OutMDS::element_type>
+    static void portable(OutMDS out, const quantized<MDS>... factors) {
+        execute<false>(out, factors...);
+    }
+};
+
+} // namespace idg
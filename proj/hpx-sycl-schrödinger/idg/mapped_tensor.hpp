@@ -0,0 +1,205 @@
+#pragma once
+/// @file Tensors stored in memory mapped files.
+/*
+ * mapped_storage maps a file of T elements and mapped_mdspan views it as a geometric tensor:
+ *
+ * ```cpp
+ * auto psi_file = idg::mapped_storage<double>::open("psi.bin", idg::map_mode::read_only);
+ * const auto psi = psi_file.mdspan<4, 256>();
+ * ```
+ *
+ * mapped_accessor behaves like std::default_accessor, but marks the data as file backed,
+ * so that out-of-core einsum (see idg/einsum_out_of_core.hpp) knows it can give
+ * madvise hints and drop pages which are not needed anymore.
+ **/
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <experimental/mdspan>
+
+#include "idg/sstd.hpp"
+
+namespace idg {
+
+template<typename T>
+struct mapped_accessor {
+    using offset_policy    = mapped_accessor;
+    using element_type     = T;
+    using reference        = T&;
+    using data_handle_type = T*;
+
+    constexpr mapped_accessor() noexcept = default;
+
+    template<typename U>
+        requires std::is_convertible_v<U (*)[], T (*)[]>
+    constexpr mapped_accessor(mapped_accessor<U>) noexcept {}
+
+    [[nodiscard]] constexpr reference access(const data_handle_type p,
+                                             const std::size_t i) const noexcept {
+        return p[i];
+    }
+
+    [[nodiscard]] constexpr data_handle_type offset(const data_handle_type p,
+                                                    const std::size_t i) const noexcept {
+        return p + i;
+    }
+};
+
+template<typename T, std::size_t rank, std::size_t dim>
+using mapped_mdspan = sstd::geometric_mdspan<T, rank, dim, std::layout_right, mapped_accessor<T>>;
+
+template<typename T>
+struct is_mapped_mdspan : std::false_type {};
+
+template<typename T, typename E, typename LP>
+struct is_mapped_mdspan<std::mdspan<T, E, LP, mapped_accessor<T>>> : std::true_type {};
+
+template<typename T>
+static constexpr bool is_mapped_mdspan_v = is_mapped_mdspan<T>::value;
+
+/// Gives \p advice (e.g. MADV_WILLNEED) for the pages overlapping \p n elements from \p first.
+///
+/// Advices are only hints, so errors are ignored.
+template<typename T>
+void advise_pages(const T* const first, const std::size_t n, const int advice) noexcept {
+    if (n == 0uz) { return; }
+    static const auto page_size = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+
+    const auto begin = reinterpret_cast<std::uintptr_t>(first) & ~(page_size - 1u);
+    const auto end   = reinterpret_cast<std::uintptr_t>(first + n);
+    ::madvise(reinterpret_cast<void*>(begin), end - begin, advice);
+}
+
+/// Gives \p advice for the elements spanned by mapped mdspan \p mds.
+template<typename MDS>
+    requires is_mapped_mdspan_v<MDS>
+void advise_pages(const MDS& mds, const int advice) noexcept {
+    advise_pages(mds.data_handle(), mds.mapping().required_span_size(), advice);
+}
+
+enum class map_mode { read_only, read_write };
+
+/// Memory mapped file of T elements.
+///
+/// Mapping is shared, so writes through read_write mappings end up in the file.
+template<typename T>
+    requires std::is_trivially_copyable_v<T>
+class mapped_storage {
+    T* data_{ nullptr };
+    std::size_t size_{ 0uz };
+
+    [[nodiscard]] mapped_storage(T* const data, const std::size_t size) noexcept
+        : data_{ data },
+          size_{ size } {}
+
+    [[nodiscard]] static mapped_storage
+        map(const int fd, const std::size_t bytes, const map_mode mode) {
+        if (bytes % sizeof(T) != 0uz) {
+            ::close(fd);
+            throw std::runtime_error{ "Mapped file size is not multiple of the element size." };
+        }
+        if (bytes == 0uz) {
+            ::close(fd);
+            return mapped_storage(nullptr, 0uz);
+        }
+
+        const auto prot = mode == map_mode::read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+        void* const ptr = ::mmap(nullptr, bytes, prot, MAP_SHARED, fd, 0);
+        const auto err  = errno;
+        ::close(fd);
+        if (ptr == MAP_FAILED) { throw std::system_error(err, std::generic_category(), "mmap"); }
+
+        return mapped_storage(static_cast<T*>(ptr), bytes / sizeof(T));
+    }
+
+    void unmap() noexcept {
+        if (data_ != nullptr) { ::munmap(data_, size_ * sizeof(T)); }
+        data_ = nullptr;
+        size_ = 0uz;
+    }
+
+  public:
+    /// Maps existing file \p path.
+    [[nodiscard]] static mapped_storage open(const std::filesystem::path& path,
+                                             const map_mode mode) {
+        const auto flags = mode == map_mode::read_only ? O_RDONLY : O_RDWR;
+        const auto fd    = ::open(path.c_str(), flags | O_CLOEXEC);
+        if (fd < 0) { throw std::system_error(errno, std::generic_category(), "open tensor file"); }
+
+        struct stat st {};
+        if (::fstat(fd, &st) != 0) {
+            const auto err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "fstat tensor file");
+        }
+        return map(fd, static_cast<std::size_t>(st.st_size), mode);
+    }
+
+    /// Creates (or truncates) file \p path for \p size elements and maps it for writing.
+    [[nodiscard]] static mapped_storage create(const std::filesystem::path& path,
+                                               const std::size_t size) {
+        const auto fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "create tensor file");
+        }
+        if (::ftruncate(fd, static_cast<off_t>(size * sizeof(T))) != 0) {
+            const auto err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "ftruncate tensor file");
+        }
+        return map(fd, size * sizeof(T), map_mode::read_write);
+    }
+
+    mapped_storage(const mapped_storage&)            = delete;
+    mapped_storage& operator=(const mapped_storage&) = delete;
+
+    mapped_storage(mapped_storage&& other) noexcept
+        : data_{ std::exchange(other.data_, nullptr) },
+          size_{ std::exchange(other.size_, 0uz) } {}
+
+    mapped_storage& operator=(mapped_storage&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0uz);
+        }
+        return *this;
+    }
+
+    ~mapped_storage() { unmap(); }
+
+    [[nodiscard]] T* data() const noexcept { return data_; }
+    [[nodiscard]] std::size_t size() const noexcept { return size_; }
+    [[nodiscard]] std::span<T> span() const noexcept { return { data_, size_ }; }
+
+    /// Views the storage as geometric tensor, throws if the size does not match.
+    template<std::size_t rank, std::size_t dim>
+    [[nodiscard]] mapped_mdspan<T, rank, dim> mdspan() const {
+        if (size_ != sstd::integer_pow(dim, rank)) {
+            throw std::runtime_error{ "Mapped storage size does not match the tensor shape." };
+        }
+        return mapped_mdspan<T, rank, dim>(data_);
+    }
+
+    /// Writes modified pages back to the file.
+    void flush() const {
+        if (data_ != nullptr and ::msync(data_, size_ * sizeof(T), MS_SYNC) != 0) {
+            throw std::system_error(errno, std::generic_category(), "msync tensor file");
+        }
+    }
+};
+
+} // namespace idg
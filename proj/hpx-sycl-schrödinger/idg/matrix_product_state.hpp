@@ -0,0 +1,300 @@
+#pragma once
+/// @file Matrix product states with cached environments for sweeps.
+/*
+ * Matrix product state (MPS) of n sites represents the n-index state vector
+ *
+ *     psi[p0, p1, ..., pn-1] = sum A0[0, p0, b1] A1[b1, p1, b2] ... An-1[bn-1, pn-1, 0]
+ *
+ * with one rank 3 site tensor A[l, p, r] per site, so memory is n D^3 instead of D^n.
+ * As everything in idg is geometric, bond and physical dimensions are both D and
+ * the open bonds at the ends of the chain are fixed to index 0.
+ *
+ * Left environment L_i is the contraction of the sites [0, i) of <psi|psi>
+ * and right environment R_i of the sites [i, n). They are contracted in the optimal
+ * order for chains, i.e. one site tensor at a time with cost D^4 per site:
+ *
+ *     L_i+1[b, d] = sum L_i[a, c] A_i[a, p, b] conj(A_i)[c, p, d]
+ *
+ * The pairwise steps are written out to reuse preallocated buffers. network() exposes
+ * <psi|psi> as tensor_network and a static_assert checks that sweeping the environments
+ * costs as much as its optimal pairwise_contraction_sequence.
+ *
+ * Environments are cached and invalidated when a site changes, so moving
+ * the active site of a sweep by one updates only one environment:
+ *
+ * ```cpp
+ * auto psi = idg::matrix_product_state<double, D>(n);
+ * for (const auto i : std::views::iota(0uz, n)) {
+ *     update(psi.site(i));                     // Invalidates L_j, j > i and R_j, j <= i.
+ *     e += psi.expectation_value(i, O);       // Reuses L_i and R_i+1.
+ * }
+ * ```
+ **/
+
+#include <algorithm>
+#include <complex>
+#include <cstddef>
+#include <ranges>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <experimental/mdspan>
+
+#include "idg/einsum.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+#include "idg/tensor_network.hpp"
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+
+namespace mps_impl {
+
+/// <psi|psi> of \p n sites as tensor network.
+///
+/// Nodes are L_0, the ket A_i and bra conj(A_i) of each site, in order of the sites, and R_n.
+/// Index p of A_i is connected to p of conj(A_i) and bonds to the neighbouring sites,
+/// so the network is closed.
+[[nodiscard]] constexpr connected_tensor_network chain_network(const std::size_t n) {
+    auto net        = tensor_network{};
+    const auto left = net.add_node(2uz);
+    auto ket        = tensor_network::index_location{ left, 0uz };
+    auto bra        = tensor_network::index_location{ left, 1uz };
+    for ([[maybe_unused]] const auto _ : rv::iota(0uz, n)) {
+        const auto a = net.add_node(3uz);
+        const auto b = net.add_node(3uz);
+        net.add_edge(ket, { a, 0uz });
+        net.add_edge(bra, { b, 0uz });
+        net.add_edge({ a, 1uz }, { b, 1uz });
+        ket = { a, 2uz };
+        bra = { b, 2uz };
+    }
+    const auto right = net.add_node(2uz);
+    net.add_edge(ket, { right, 0uz });
+    net.add_edge(bra, { right, 1uz });
+    return net.connected_components().front();
+}
+
+/// Whether contracting chain_network(\p n) by updating L_0 to L_n one site at a time,
+/// with two D^4 steps, and contracting L_n with R_n (see norm_squared) costs as much
+/// as its optimal pairwise_contraction_sequence.
+[[nodiscard]] constexpr bool sweep_is_optimal(const std::size_t n, const std::size_t D) {
+    const auto sweep_cost = 2uz * n * sstd::integer_pow(D, 4uz) + sstd::integer_pow(D, 2uz);
+    return contraction_cost(chain_network(n).pairwise_contraction_sequence(D), D) == sweep_cost;
+}
+
+} // namespace mps_impl
+
+template<typename T, std::size_t D>
+class matrix_product_state {
+  public:
+    using site_mdspan        = sstd::geometric_mdspan<T, 3uz, D>;
+    using const_site_mdspan  = sstd::geometric_mdspan<const T, 3uz, D>;
+    using environment_mdspan = sstd::geometric_mdspan<const T, 2uz, D>;
+    /// Single site operator O[q, p], i.e. <q|O|p>.
+    using one_site_operator_mdspan = sstd::geometric_mdspan<const T, 2uz, D>;
+    /// Nearest neighbour operator O[q, t, p, s], i.e. <q t|O|p s>.
+    using two_site_operator_mdspan = sstd::geometric_mdspan<const T, 4uz, D>;
+
+  private:
+    template<std::size_t rank>
+    using buffer_mdspan = sstd::geometric_mdspan<T, rank, D>;
+
+    template<str::fixed_string... estrs>
+    static constexpr auto flops = (einsum<estrs>::explain(D).flops + ...);
+
+    static_assert(flops<u8"ac,apb->cpb", u8"cpb,cpd->bd"> <= flops<u8"ac,apb,cpd->bd">,
+                  "Left environment is not updated in the planned order.");
+    static_assert(flops<u8"apb,bd->apd", u8"apd,cpd->ac"> <= flops<u8"apb,bd,cpd->ac">,
+                  "Right environment is not updated in the planned order.");
+    static_assert(mps_impl::sweep_is_optimal(2uz, D),
+                  "Sweeping the environments is not an optimal contraction sequence.");
+
+    std::vector<std::vector<T>> sites_;
+    /// Environments L_0, ..., L_n and R_0, ..., R_n, of which L_0 and R_n are trivial.
+    std::vector<std::vector<T>> left_;
+    std::vector<std::vector<T>> right_;
+    /// L_i is valid for i <= left_valid_ and R_i for i >= right_valid_.
+    std::size_t left_valid_;
+    std::size_t right_valid_;
+    /// Number of L and R updates computed so far, one for each site an environment is moved by.
+    std::size_t environment_updates_;
+
+    /// Intermediates of the contractions, allocated once.
+    std::vector<T> bra_;
+    std::vector<T> scratch_a_;
+    std::vector<T> scratch_b_;
+
+    [[nodiscard]] static constexpr T conj(const T x) {
+        if constexpr (sstd::is_complex_v<T>) {
+            return std::conj(x);
+        } else {
+            return x;
+        }
+    }
+
+    template<std::size_t rank>
+    [[nodiscard]] static buffer_mdspan<rank> view(std::vector<T>& buff) {
+        return buffer_mdspan<rank>(buff.data());
+    }
+
+    /// conj(A_i) to bra_.
+    [[nodiscard]] buffer_mdspan<3uz> bra(this matrix_product_state& self, const std::size_t i) {
+        rn::transform(self.sites_[i], self.bra_.begin(), [](const T x) { return conj(x); });
+        return view<3uz>(self.bra_);
+    }
+
+    void check_site(this const matrix_product_state& self, const std::size_t i) {
+        if (i >= self.size()) { throw std::out_of_range{ "MPS site index out of range." }; }
+    }
+
+  public:
+    /// Product state |0 0 ... 0> of \p n sites.
+    explicit matrix_product_state(const std::size_t n)
+        : sites_(n, std::vector<T>(sstd::integer_pow(D, 3uz))),
+          left_(n + 1uz, std::vector<T>(sstd::integer_pow(D, 2uz))),
+          right_(n + 1uz, std::vector<T>(sstd::integer_pow(D, 2uz))),
+          left_valid_{ 0uz },
+          right_valid_{ n },
+          environment_updates_{ 0uz },
+          bra_(sstd::integer_pow(D, 3uz)),
+          scratch_a_(sstd::integer_pow(D, 4uz)),
+          scratch_b_(sstd::integer_pow(D, 4uz)) {
+        if (n == 0uz) { throw std::logic_error{ "MPS has to have at least one site." }; }
+        for (auto& s : sites_) { view<3uz>(s)[0uz, 0uz, 0uz] = T{ 1 }; }
+        view<2uz>(left_.front())[0uz, 0uz] = T{ 1 };
+        view<2uz>(right_.back())[0uz, 0uz] = T{ 1 };
+    }
+
+    [[nodiscard]] std::size_t size(this const matrix_product_state& self) {
+        return rn::size(self.sites_);
+    }
+
+    /// <psi|psi> as tensor network, see mps_impl::chain_network.
+    [[nodiscard]] connected_tensor_network network(this const matrix_product_state& self) {
+        return mps_impl::chain_network(self.size());
+    }
+
+    /// Number of single site updates of L and R environments computed so far.
+    ///
+    /// Moving the active site of a sweep by one and changing it adds one update.
+    [[nodiscard]] std::size_t environment_updates(this const matrix_product_state& self) {
+        return self.environment_updates_;
+    }
+
+    [[nodiscard]] const_site_mdspan site(this const matrix_product_state& self,
+                                         const std::size_t i) {
+        self.check_site(i);
+        return const_site_mdspan(self.sites_[i].data());
+    }
+
+    /// Mutable site tensor i, which invalidates the environments depending on it.
+    [[nodiscard]] site_mdspan site(this matrix_product_state& self, const std::size_t i) {
+        self.check_site(i);
+        self.left_valid_  = std::min(self.left_valid_, i);
+        self.right_valid_ = std::max(self.right_valid_, i + 1uz);
+        return view<3uz>(self.sites_[i]);
+    }
+
+    /// L_i, i.e. <psi|psi> contracted over sites [0, i), computed from the last valid one.
+    [[nodiscard]] environment_mdspan left_environment(this matrix_product_state& self,
+                                                      const std::size_t i) {
+        if (i > self.size()) { throw std::out_of_range{ "MPS environment out of range." }; }
+        for (; self.left_valid_ < i; ++self.left_valid_) {
+            const auto j = self.left_valid_;
+            const auto x = view<3uz>(self.scratch_a_);
+            einsum<u8"ac,apb->cpb">{}(x, view<2uz>(self.left_[j]), view<3uz>(self.sites_[j]));
+            einsum<u8"cpb,cpd->bd">{}(view<2uz>(self.left_[j + 1uz]), x, self.bra(j));
+            ++self.environment_updates_;
+        }
+        return environment_mdspan(self.left_[i].data());
+    }
+
+    /// R_i, i.e. <psi|psi> contracted over sites [i, n), computed from the last valid one.
+    [[nodiscard]] environment_mdspan right_environment(this matrix_product_state& self,
+                                                       const std::size_t i) {
+        if (i > self.size()) { throw std::out_of_range{ "MPS environment out of range." }; }
+        for (; self.right_valid_ > i; --self.right_valid_) {
+            const auto j = self.right_valid_ - 1uz;
+            const auto y = view<3uz>(self.scratch_a_);
+            einsum<u8"apb,bd->apd">{}(
+                y, view<3uz>(self.sites_[j]), view<2uz>(self.right_[j + 1uz]));
+            einsum<u8"apd,cpd->ac">{}(view<2uz>(self.right_[j]), y, self.bra(j));
+            ++self.environment_updates_;
+        }
+        return environment_mdspan(self.right_[i].data());
+    }
+
+    /// <psi|psi>, contracted at the boundary of the valid environments.
+    [[nodiscard]] T norm_squared(this matrix_product_state& self) {
+        // Any i works, at left_valid_ only the invalid right environments are computed.
+        const auto i = self.left_valid_;
+        auto out     = T{};
+        einsum<u8"ac,ac->">{}(sstd::geometric_mdspan<T, 0uz, D>(&out),
+                              self.left_environment(i),
+                              self.right_environment(i));
+        return out;
+    }
+
+    /// <psi|O_i|psi> / <psi|psi> of single site operator \p op at site \p i.
+    ///
+    /// <psi|psi> is contracted from the same L_i A_i R_i+1 chain with identity in place of O.
+    [[nodiscard]] T expectation_value(this matrix_product_state& self,
+                                      const std::size_t i,
+                                      const one_site_operator_mdspan op) {
+        self.check_site(i);
+        const auto l = self.left_environment(i);
+        const auto r = self.right_environment(i + 1uz);
+
+        const auto x = view<3uz>(self.scratch_a_);
+        const auto y = view<3uz>(self.scratch_b_);
+        einsum<u8"ac,apb->cpb">{}(x, l, view<3uz>(self.sites_[i]));
+        einsum<u8"cpb,bd->cpd">{}(y, x, r);
+        const auto bra = self.bra(i);
+
+        auto norm = T{};
+        einsum<u8"cpd,cpd->">{}(sstd::geometric_mdspan<T, 0uz, D>(&norm), y, bra);
+
+        einsum<u8"qp,cpd->cqd">{}(x, op, y);
+        auto out = T{};
+        einsum<u8"cqd,cqd->">{}(sstd::geometric_mdspan<T, 0uz, D>(&out), x, bra);
+        return out / norm;
+    }
+
+    /// <psi|O_i,i+1|psi> / <psi|psi> of nearest neighbour operator \p op at sites i, i + 1.
+    ///
+    /// <psi|psi> is contracted from the same L_i A_i A_i+1 R_i+2 chain
+    /// with identity in place of O.
+    [[nodiscard]] T expectation_value(this matrix_product_state& self,
+                                      const std::size_t i,
+                                      const two_site_operator_mdspan op) {
+        self.check_site(i + 1uz);
+        const auto l = self.left_environment(i);
+        const auto r = self.right_environment(i + 2uz);
+
+        const auto x3 = view<3uz>(self.scratch_b_);
+        const auto x4 = view<4uz>(self.scratch_a_);
+        const auto w4 = view<4uz>(self.scratch_b_);
+        einsum<u8"ac,apb->cpb">{}(x3, l, view<3uz>(self.sites_[i]));
+        einsum<u8"cpb,bse->cpse">{}(x4, x3, view<3uz>(self.sites_[i + 1uz]));
+        einsum<u8"cpse,ef->cpsf">{}(w4, x4, r);
+
+        // Contracts ket with the bra sites using z as the intermediate.
+        const auto close = [&](const auto ket, const buffer_mdspan<3uz> z) {
+            einsum<u8"cqtf,dtf->cqd">{}(z, ket, self.bra(i + 1uz));
+            auto out = T{};
+            einsum<u8"cqd,cqd->">{}(sstd::geometric_mdspan<T, 0uz, D>(&out), z, self.bra(i));
+            return out;
+        };
+        const auto norm = close(w4, view<3uz>(self.scratch_a_));
+
+        const auto y4 = view<4uz>(self.scratch_a_);
+        einsum<u8"qtps,cpsf->cqtf">{}(y4, op, w4);
+        return close(y4, view<3uz>(self.scratch_b_)) / norm;
+    }
+};
+
+} // namespace idg
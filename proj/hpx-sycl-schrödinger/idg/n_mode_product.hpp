@@ -0,0 +1,270 @@
+#pragma once
+/// @file n-mode products of geometric tensors, i.e. separable operators on rank-d grids.
+/*
+ * n-mode product applies matrix op along one axis of a geometric tensor,
+ * e.g. for rank 3 and axis 1 it is the einsum "ak,ikj->iaj":
+ *
+ *     out[i, a, j] = sum_k op[a, k] * in[i, k, j]
+ *
+ * Tensors are viewed as [outer][D][inner] with outer = D^axis and inner = D^(rank - axis - 1).
+ * The inner index is split to blocks whose input and output rows fit to L1 cache and the
+ * innermost loop is an axpy over a block of contiguous memory, which is vectorized
+ * by the kernel variants of runtime dispatch. For the last axis (inner = 1) rows of op
+ * and in are contiguous, so the kernel is dot products of them.
+ *
+ * Separable operators (e.g. the kinetic energy in a tensor product basis) apply
+ * one matrix along each axis. n_mode_workspace does that with one preallocated
+ * intermediate tensor, which is ping-ponged with out:
+ *
+ * ```cpp
+ * auto ws = idg::n_mode_workspace<double, 3, D>{};
+ * ws.apply_all_axes(out, psi, Tx, Ty, Tz); // out = (Tx ⊗ Ty ⊗ Tz) psi
+ * ```
+ **/
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <ranges>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <experimental/mdspan>
+
+#include "idg/cpu_dispatch.hpp"
+#include "idg/einsum.hpp"
+#include "idg/sstd.hpp"
+#include "idg/tensor_allocator.hpp"
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+
+/// Contiguous out and in of rank r with static extents D and contiguous D x D matrix op.
+template<typename OutMDS, typename OpMDS, typename InMDS>
+concept n_mode_compatible =
+    (sstd::contiguous_mdspan<OutMDS> and sstd::contiguous_mdspan<OpMDS>
+     and sstd::contiguous_mdspan<InMDS>)
+    and (static_extent_mdspan<OutMDS> and static_extent_mdspan<OpMDS>
+         and static_extent_mdspan<InMDS>)
+    and (OpMDS::rank() == 2uz) and (OutMDS::rank() == InMDS::rank()) and (OutMDS::rank() != 0uz)
+    and (einsum_consistent_geometric_dimentions<OutMDS, OpMDS, InMDS>());
+
+namespace n_mode_impl {
+
+/// Bytes of input and output rows of one block, i.e. a typical L1 data cache.
+inline constexpr auto block_bytes = 32uz * 1024uz;
+
+/// Tensors smaller than this many elements per thread are not split further.
+inline constexpr auto min_elements_per_thread = 1uz << 16uz;
+
+/// Length of the blocks of the inner index, multiple of a cache line if possible.
+template<std::size_t D, std::size_t inner, typename T>
+[[nodiscard]] consteval std::size_t block_length() {
+    constexpr auto line = std::max(1uz, 64uz / sizeof(T));
+    const auto fitting  = std::max(1uz, block_bytes / (2uz * D * sizeof(T)));
+    const auto aligned  = fitting >= line ? fitting / line * line : fitting;
+    return std::min(aligned, inner);
+}
+
+/// Computes tiles [first, last) of out, where tile t is the inner block t % blocks
+/// of the outer index t / blocks.
+template<std::size_t outer, std::size_t D, std::size_t inner, typename T, typename U, typename V>
+void tiles(const std::size_t first,
+           const std::size_t last,
+           T* const out,
+           const U* const op,
+           const V* const in) {
+    static constexpr auto B      = block_length<D, inner, T>();
+    static constexpr auto blocks = (inner + B - 1uz) / B;
+
+    for (const auto t : rv::iota(first, last)) {
+        const auto o     = t / blocks;
+        const auto out_o = out + o * D * inner;
+        const auto in_o  = in + o * D * inner;
+
+        if constexpr (inner == 1uz) {
+            for (const auto a : rv::iota(0uz, D)) {
+                auto acc = T{};
+                for (const auto k : rv::iota(0uz, D)) { acc += op[a * D + k] * in_o[k]; }
+                out_o[a] = acc;
+            }
+        } else {
+            const auto b0  = (t % blocks) * B;
+            const auto len = std::min(B, inner - b0);
+
+            for (const auto a : rv::iota(0uz, D)) {
+                std::fill_n(out_o + a * inner + b0, len, T{});
+            }
+            for (const auto k : rv::iota(0uz, D)) {
+                const auto in_row = in_o + k * inner + b0;
+                for (const auto a : rv::iota(0uz, D)) {
+                    const auto c       = op[a * D + k];
+                    const auto out_row = out_o + a * inner + b0;
+                    for (const auto j : rv::iota(0uz, len)) { out_row[j] += c * in_row[j]; }
+                }
+            }
+        }
+    }
+}
+
+#if IDG_X86_DISPATCH
+// Variants of tiles for runtime dispatch, flatten inlines the loops to them.
+
+template<std::size_t outer, std::size_t D, std::size_t inner, typename T, typename U, typename V>
+[[gnu::target("sse4.2"), gnu::flatten]]
+void tiles_sse4_2(const std::size_t first,
+                  const std::size_t last,
+                  T* const out,
+                  const U* const op,
+                  const V* const in) {
+    tiles<outer, D, inner>(first, last, out, op, in);
+}
+
+template<std::size_t outer, std::size_t D, std::size_t inner, typename T, typename U, typename V>
+[[gnu::target("avx2,fma"), gnu::flatten]]
+void tiles_avx2(const std::size_t first,
+                const std::size_t last,
+                T* const out,
+                const U* const op,
+                const V* const in) {
+    tiles<outer, D, inner>(first, last, out, op, in);
+}
+
+template<std::size_t outer, std::size_t D, std::size_t inner, typename T, typename U, typename V>
+[[gnu::target("avx512f,avx512bw,avx512vl,avx2,fma"), gnu::flatten]]
+void tiles_avx512(const std::size_t first,
+                  const std::size_t last,
+                  T* const out,
+                  const U* const op,
+                  const V* const in) {
+    tiles<outer, D, inner>(first, last, out, op, in);
+}
+#endif
+
+/// Variant of tiles for cpu::detected_isa() chosen on the first call.
+template<std::size_t outer, std::size_t D, std::size_t inner, typename T, typename U, typename V>
+[[nodiscard]] auto dispatched_tiles() {
+    using kernel_ptr = void (*)(std::size_t, std::size_t, T*, const U*, const V*);
+    static const kernel_ptr kernel = []() -> kernel_ptr {
+#if IDG_X86_DISPATCH
+        switch (cpu::detected_isa()) {
+            case cpu::isa::avx512: return &tiles_avx512<outer, D, inner, T, U, V>;
+            case cpu::isa::avx2: return &tiles_avx2<outer, D, inner, T, U, V>;
+            case cpu::isa::sse4_2: return &tiles_sse4_2<outer, D, inner, T, U, V>;
+            case cpu::isa::portable: break;
+        }
+#endif
+        return &tiles<outer, D, inner, T, U, V>;
+    }();
+    return kernel;
+}
+
+/// n-mode product along \p axis of contiguous rank \p rank tensors of dimension \p D.
+template<std::size_t axis, std::size_t rank, std::size_t D, typename T, typename U, typename V>
+void apply(const std::size_t threads, T* const out, const U* const op, const V* const in) {
+    static constexpr auto outer  = sstd::integer_pow(D, axis);
+    static constexpr auto inner  = sstd::integer_pow(D, rank - axis - 1uz);
+    static constexpr auto blocks = (inner + block_length<D, inner, T>() - 1uz)
+                                   / block_length<D, inner, T>();
+    static constexpr auto max_threads =
+        std::max(1uz, sstd::integer_pow(D, rank) / min_elements_per_thread);
+
+    const auto t = std::min(threads == 0uz ? default_number_of_threads() : threads, max_threads);
+
+    const auto kernel = dispatched_tiles<outer, D, inner, T, U, V>();
+    parallel_blocks(outer * blocks, t, [&](const std::size_t first, const std::size_t last) {
+        kernel(first, last, out, op, in);
+    });
+}
+
+/// Memory of \p a and \p b overlaps.
+template<typename A, typename B>
+[[nodiscard]] bool overlaps(const A& a, const B& b) {
+    const auto a_first = static_cast<const void*>(a.data_handle());
+    const auto a_last  = static_cast<const void*>(a.data_handle() + a.size());
+    const auto b_first = static_cast<const void*>(b.data_handle());
+    const auto b_last  = static_cast<const void*>(b.data_handle() + b.size());
+    return std::less<>{}(a_first, b_last) and std::less<>{}(b_first, a_last);
+}
+
+} // namespace n_mode_impl
+
+/// Writes n-mode product of \p op along \p axis of \p in to \p out using \p threads.
+///
+/// \p out may not overlap \p op or \p in.
+/// If \p threads is zero, default_number_of_threads() is used.
+template<std::size_t axis, typename OutMDS, typename OpMDS, typename InMDS>
+    requires n_mode_compatible<OutMDS, OpMDS, InMDS> and (axis < OutMDS::rank())
+void n_mode_product(const std::size_t threads, OutMDS out, OpMDS op, InMDS in) {
+    static constexpr auto D = OpMDS::static_extent(0uz);
+
+    if (n_mode_impl::overlaps(out, in) or n_mode_impl::overlaps(out, op)) {
+        throw std::logic_error{ "Output of n-mode product overlaps its operands." };
+    }
+    n_mode_impl::apply<axis, OutMDS::rank(), D>(
+        threads, out.data_handle(), op.data_handle(), in.data_handle());
+}
+
+/// Writes n-mode product of \p op along \p axis of \p in to \p out using all threads.
+template<std::size_t axis, typename OutMDS, typename OpMDS, typename InMDS>
+    requires n_mode_compatible<OutMDS, OpMDS, InMDS> and (axis < OutMDS::rank())
+void n_mode_product(OutMDS out, OpMDS op, InMDS in) {
+    n_mode_product<axis>(0uz, out, op, in);
+}
+
+/// Intermediate tensor for applying separable operators, allocated once and reused.
+template<typename T, std::size_t rank, std::size_t dim>
+class n_mode_workspace {
+    tensor_buffer<T> buffer_ = make_tensor_buffer<T, rank, dim>();
+
+  public:
+    /// Writes (ops[0] ⊗ ops[1] ⊗ ...) \p in to \p out, i.e. applies ops[i] along axis i,
+    /// using \p threads.
+    ///
+    /// Steps alternate between out and the workspace such that the last one writes to out,
+    /// so no memory is allocated. \p out may not overlap \p in or \p ops.
+    /// If \p threads is zero, default_number_of_threads() is used.
+    template<typename OutMDS, typename InMDS, typename... OpMDS>
+        requires(sizeof...(OpMDS) == rank) and (OutMDS::rank() == rank)
+                and std::is_same_v<typename OutMDS::element_type, T>
+                and (n_mode_compatible<OutMDS, OpMDS, InMDS> and ...)
+                and (OutMDS::static_extent(0uz) == dim)
+    void apply_all_axes(const std::size_t threads, OutMDS out, InMDS in, OpMDS... ops) {
+        if (n_mode_impl::overlaps(out, in) or (n_mode_impl::overlaps(out, ops) or ...)) {
+            throw std::logic_error{ "Output of n-mode product overlaps its operands." };
+        }
+
+        T* const ws = buffer_.data();
+        const auto step = [&]<std::size_t axis>(const auto* const src, const auto* const op) {
+            // Last step (rank - 1) writes to out.
+            T* const dst = (rank - 1uz - axis) % 2uz == 0uz ? out.data_handle() : ws;
+            n_mode_impl::apply<axis, rank, dim>(threads, dst, op, src);
+            return static_cast<const T*>(dst);
+        };
+
+        const auto ops_data = std::tuple{ ops.data_handle()... };
+        std::invoke(
+            [&]<std::size_t... I>(std::index_sequence<I...>) {
+                // Axis 0 reads in, the others read the output of the previous axis.
+                auto src = step.template operator()<0uz>(in.data_handle(), std::get<0uz>(ops_data));
+                ((src = step.template operator()<I + 1uz>(src, std::get<I + 1uz>(ops_data))), ...);
+            },
+            std::make_index_sequence<rank - 1uz>());
+    }
+
+    /// Writes (ops[0] ⊗ ops[1] ⊗ ...) \p in to \p out using all threads.
+    template<typename OutMDS, typename InMDS, typename... OpMDS>
+        requires(sizeof...(OpMDS) == rank) and (OutMDS::rank() == rank)
+                and std::is_same_v<typename OutMDS::element_type, T>
+                and (n_mode_compatible<OutMDS, OpMDS, InMDS> and ...)
+                and (OutMDS::static_extent(0uz) == dim)
+    void apply_all_axes(OutMDS out, InMDS in, OpMDS... ops) {
+        apply_all_axes(0uz, out, in, ops...);
+    }
+};
+
+} // namespace idg
@@ -0,0 +1,715 @@
+#pragma once
+/// @file Persisted einsum plans which are memory-mapped at startup.
+/*
+ * Planning done by pairwise_contraction_sequence can take seconds for large networks,
+ * so plans of a known catalogue of einsum strings can be written to a binary file
+ * and loaded at startup with mapped_plan_cache, which skips planning on warm starts.
+ *
+ * Loaded plans are executed at runtime by execute_plan, which interprets the pairwise steps
+ * with a generic loop over contiguous geometric tensors.
+ *
+ * File layout (all integers are little endian):
+ *
+ *     header:  magic "IDGPLAN\0", u32 version, u32 number of entries
+ *     entries: u64 key, u64 payload offset, u64 payload size (sorted by key)
+ *     payloads
+ *
+ * Key is a hash, so each payload starts with the einsum string (without whitespace)
+ * and the extents it was planned for, which are compared on lookup:
+ *
+ *     u16 einsum string length, einsum string, u8 number of extents, u64 extents
+ *
+ * followed by the plan:
+ *
+ *     u64 dimension, u32 number of components
+ *     for each component:
+ *         u32 rank, u32 number of contractions, u32 one node factor ordinal or ~0, u32 steps
+ *         for each step:
+ *             u32 lhs register, u32 rhs register, u32 out register, u32 out rank, u8 kernel,
+ *             u8 precontracted, u8 fused with next,
+ *             u8 lhs label count, lhs labels, u8 rhs label count, rhs labels
+ **/
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <experimental/mdspan>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "idg/einsum_parser.hpp"
+#include "idg/einsum_plan.hpp"
+#include "idg/sstd.hpp"
+#include "idg/string_manipulation.hpp"
+
+namespace idg {
+
+namespace rn = std::ranges;
+namespace rv = std::views;
+
+/// Key of einsum string \p estr with factor extents \p extents (FNV-1a hash).
+[[nodiscard]] constexpr std::uint64_t plan_key(const std::u8string_view estr,
+                                               const std::span<const std::size_t> extents) {
+    auto hash       = std::uint64_t{ 14695981039346656037u };
+    const auto feed = [&](const std::uint8_t byte) {
+        hash ^= byte;
+        hash *= std::uint64_t{ 1099511628211u };
+    };
+
+    for (const auto c : estr) {
+        if (not str::is_whitespace(c)) { feed(static_cast<std::uint8_t>(c)); }
+    }
+    // Separates extents from the string so "ab" + {1} and "a" + {...} do not collide trivially.
+    feed(0xffu);
+    for (const auto e : extents) {
+        for (const auto i : rv::iota(0uz, 8uz)) {
+            feed(static_cast<std::uint8_t>(static_cast<std::uint64_t>(e) >> (8uz * i)));
+        }
+    }
+    return hash;
+}
+
+namespace plan_cache_impl {
+
+inline constexpr auto magic = std::array<char, 8>{ 'I', 'D', 'G', 'P', 'L', 'A', 'N', '\0' };
+inline constexpr std::uint32_t version   = 4;
+inline constexpr std::size_t header_size = 16uz;
+inline constexpr std::size_t entry_size  = 24uz;
+inline constexpr auto no_factor          = static_cast<std::uint32_t>(-1);
+
+/// Dimension of geometric \p extents (all extents are the same).
+[[nodiscard]] inline std::size_t
+geometric_dimension(const std::span<const std::size_t> extents) {
+    const auto D = rn::empty(extents) ? 1uz : extents.front();
+    if (rn::any_of(extents, [&](const std::size_t e) { return e != D; })) {
+        throw std::logic_error{ "Einsum plans require geometric extents." };
+    }
+    return D;
+}
+
+/// \p estr without whitespace, which is what plan_key hashes.
+[[nodiscard]] inline std::u8string
+normalized(const std::u8string_view estr) {
+    return estr | rv::filter([](const char8_t c) { return not str::is_whitespace(c); })
+           | rn::to<std::u8string>();
+}
+
+template<std::unsigned_integral T>
+void
+write_int(std::vector<std::byte>& out, const T x) {
+    for (const auto i : rv::iota(0uz, sizeof(T))) {
+        out.push_back(static_cast<std::byte>(static_cast<std::uint64_t>(x) >> (8uz * i)));
+    }
+}
+
+/// Bounds checked little endian reader of a payload.
+class reader {
+    std::span<const std::byte> data_;
+
+  public:
+    explicit reader(const std::span<const std::byte> data) : data_{ data } {}
+
+    template<std::unsigned_integral T>
+    [[nodiscard]] T read_int() {
+        if (data_.size() < sizeof(T)) { throw std::runtime_error{ "Truncated einsum plan." }; }
+        auto x = std::uint64_t{ 0 };
+        for (const auto i : rv::iota(0uz, sizeof(T))) {
+            x |= static_cast<std::uint64_t>(data_[i]) << (8uz * i);
+        }
+        data_ = data_.subspan(sizeof(T));
+        return static_cast<T>(x);
+    }
+
+    [[nodiscard]] std::u8string read_labels() {
+        const auto n = read_int<std::uint8_t>();
+        if (data_.size() < n) { throw std::runtime_error{ "Truncated einsum plan." }; }
+        auto labels = std::u8string(n, u8' ');
+        std::memcpy(labels.data(), data_.data(), n);
+        data_ = data_.subspan(n);
+        return labels;
+    }
+
+    [[nodiscard]] std::u8string read_string() {
+        const auto n = read_int<std::uint16_t>();
+        if (data_.size() < n) { throw std::runtime_error{ "Truncated einsum plan." }; }
+        auto s = std::u8string(n, u8' ');
+        std::memcpy(s.data(), data_.data(), n);
+        data_ = data_.subspan(n);
+        return s;
+    }
+
+    [[nodiscard]] std::span<const std::byte> rest() const { return data_; }
+};
+
+/// Throws if \p steps of a component are not a valid pairwise contraction sequence,
+/// i.e. out registers are not sequential, an operand is not computed before the step
+/// or labels do not match the ranks of the registers produced by earlier steps.
+inline void
+check_steps(const std::span<const pairwise_step> steps) {
+    const auto invalid = [](const char* what) {
+        throw std::runtime_error{ std::string{ "Invalid einsum plan: " } + what };
+    };
+    if (rn::empty(steps)) { return; }
+
+    const auto first_out = steps.front().out_register;
+    for (const auto [i, s] : steps | rv::enumerate) {
+        if (s.out_register != first_out + static_cast<std::size_t>(i)) {
+            invalid("out registers are not sequential.");
+        }
+        if (s.lhs_register >= s.out_register or s.rhs_register >= s.out_register
+            or s.lhs_register == s.rhs_register) {
+            invalid("operand register is not computed before the step.");
+        }
+        if (s.kernel != contraction_kernel::generic_loop
+            and s.kernel != contraction_kernel::fused_loop) {
+            invalid("unknown pairwise contraction kernel.");
+        }
+        if (rn::size(pairwise_output_labels(s.lhs_labels, s.rhs_labels)) != s.out_rank) {
+            invalid("out rank does not match the labels.");
+        }
+        for (const auto [r, labels] : { std::pair{ s.lhs_register, &s.lhs_labels },
+                                        std::pair{ s.rhs_register, &s.rhs_labels } }) {
+            if (r >= first_out and rn::size(*labels) != steps[r - first_out].out_rank) {
+                invalid("labels do not match the rank of the operand.");
+            }
+        }
+    }
+}
+
+/// Throws if \p plan is not a plan of einsum \p p.
+inline void
+check_plan_of(const einsum_plan& plan, const einsum_parser& p) {
+    const auto invalid = [](const char* what) {
+        throw std::runtime_error{ std::string{ "Einsum plan does not match einsum: " } + what };
+    };
+    const auto factors = p.factor_index_labels();
+    const auto n       = rn::size(factors);
+
+    auto rank = 0uz;
+    for (const auto& c : plan.components()) {
+        rank += c.rank;
+        if (c.one_node_factor_ordinal) {
+            if (*c.one_node_factor_ordinal >= n) { invalid("factor ordinal out of range."); }
+            continue;
+        }
+        if (rn::empty(c.steps) or c.steps.front().out_register != n) {
+            invalid("registers of steps do not follow the factors.");
+        }
+        for (const auto& s : c.steps) {
+            if ((s.lhs_register < n and rn::size(s.lhs_labels) != rn::size(factors[s.lhs_register]))
+                or (s.rhs_register < n
+                    and rn::size(s.rhs_labels) != rn::size(factors[s.rhs_register]))) {
+                invalid("labels do not match the rank of the factor.");
+            }
+        }
+        if (c.steps.back().out_rank != c.rank) { invalid("rank of a component."); }
+    }
+    if (rank != rn::size(p.free_index_labels())) { invalid("rank of the output."); }
+}
+
+/// Writes einsum "labels[0],labels[1],...->out_labels" of contiguous geometric tensors
+/// \p operands with dimension \p D to \p out, as one loop over all labels.
+template<typename T>
+void
+contract(const std::size_t D,
+         const std::u8string_view out_labels,
+         const std::span<T> out,
+         const std::span<const std::u8string> labels,
+         const std::type_identity_t<std::span<const std::span<const T>>> operands) {
+    // Loop labels are the output labels followed by the contracted ones, the last one innermost.
+    auto loop_labels = std::u8string(out_labels);
+    for (const auto& ls : labels) {
+        for (const auto c : ls) {
+            if (not rn::contains(loop_labels, c)) { loop_labels += c; }
+        }
+    }
+    const auto n = rn::size(loop_labels);
+
+    // Stride of each loop label in a tensor, summed if the label repeats (self contraction).
+    const auto strides_of = [&](const std::u8string_view ls) {
+        auto strides = std::vector<std::size_t>(n, 0uz);
+        auto stride  = 1uz;
+        for (const auto c : ls | rv::reverse) {
+            strides[static_cast<std::size_t>(rn::find(loop_labels, c) - loop_labels.begin())] +=
+                stride;
+            stride *= D;
+        }
+        return strides;
+    };
+    const auto out_strides     = strides_of(out_labels);
+    const auto operand_strides = labels | rv::transform(strides_of) | rn::to<std::vector>();
+
+    auto index           = std::vector<std::size_t>(n, 0uz);
+    auto out_offset      = 0uz;
+    auto operand_offsets = std::vector<std::size_t>(rn::size(operands), 0uz);
+
+    rn::fill(out, T{});
+    for ([[maybe_unused]] const auto _ : rv::iota(0uz, sstd::integer_pow(D, n))) {
+        auto product = T{ 1 };
+        for (const auto [k, op] : operands | rv::enumerate) {
+            product *= op[operand_offsets[static_cast<std::size_t>(k)]];
+        }
+        out[out_offset] += product;
+
+        for (auto l = n; l-- > 0uz;) {
+            out_offset += out_strides[l];
+            for (const auto k : rv::iota(0uz, rn::size(operands))) {
+                operand_offsets[k] += operand_strides[k][l];
+            }
+            if (++index[l] < D) { break; }
+            index[l] = 0uz;
+            out_offset -= D * out_strides[l];
+            for (const auto k : rv::iota(0uz, rn::size(operands))) {
+                operand_offsets[k] -= D * operand_strides[k][l];
+            }
+        }
+    }
+}
+
+/// Executes \p plan of einsum \p estr, see execute_plan.
+template<typename T>
+void
+execute(const einsum_plan& plan,
+        const std::u8string_view estr,
+        const std::span<T> out,
+        const std::span<const std::span<const T>> factors) {
+    const auto p = einsum_parser(estr);
+    check_plan_of(plan, p);
+
+    const auto D          = plan.dimension();
+    const auto to_string  = [](const auto& ls) { return ls | rn::to<std::u8string>(); };
+    const auto labels     = p.factor_index_labels() | rv::transform(to_string)
+                        | rn::to<std::vector>();
+    const auto out_labels = to_string(p.output_index_labels());
+
+    if (rn::size(factors) != rn::size(labels)) {
+        throw std::logic_error{ "Number of factors does not match the einsum string." };
+    }
+    for (const auto [f, ls] : labels | rv::enumerate) {
+        if (rn::size(factors[static_cast<std::size_t>(f)]) != sstd::integer_pow(D, rn::size(ls))) {
+            throw std::logic_error{ "Factor does not match the dimension of the plan." };
+        }
+    }
+    if (rn::size(out) != sstd::integer_pow(D, rn::size(out_labels))) {
+        throw std::logic_error{ "Output does not match the dimension of the plan." };
+    }
+
+    // As einsum, which executes these as one loop without the plan.
+    if (rn::size(labels) <= 2uz or rn::empty(p.contractions())) {
+        contract(D, out_labels, out, std::span{ labels }, factors);
+        return;
+    }
+
+    // Buffers of the step outputs. Moving the vectors keeps the spans to them valid.
+    auto buffers = std::vector<std::vector<T>>{};
+    auto outputs = std::vector<std::span<const T>>{};
+
+    for (const auto& c : plan.components()) {
+        if (c.one_node_factor_ordinal and c.number_of_contractions == 0uz) {
+            outputs.push_back(factors[*c.one_node_factor_ordinal]);
+        } else if (c.one_node_factor_ordinal) {
+            const auto& ls = labels[*c.one_node_factor_ordinal];
+            auto& buff     = buffers.emplace_back(sstd::integer_pow(D, c.rank));
+            contract(D,
+                     pairwise_output_labels(ls, u8""),
+                     std::span{ buff },
+                     std::span{ &ls, 1uz },
+                     factors.subspan(*c.one_node_factor_ordinal, 1uz));
+            outputs.push_back(buff);
+        } else {
+            auto registers = factors | rn::to<std::vector>();
+            for (const auto& s : c.steps) {
+                const auto step_labels = std::array{ s.lhs_labels, s.rhs_labels };
+                const auto operands    = std::array{ registers[s.lhs_register],
+                                                  registers[s.rhs_register] };
+                auto& buff = buffers.emplace_back(sstd::integer_pow(D, s.out_rank));
+                contract(D,
+                         pairwise_output_labels(s.lhs_labels, s.rhs_labels),
+                         std::span{ buff },
+                         std::span{ step_labels },
+                         std::span{ operands });
+                registers.push_back(buff);
+            }
+            outputs.push_back(registers.back());
+        }
+    }
+
+    if (rn::size(outputs) == 1uz) {
+        rn::copy(outputs.front(), out.begin());
+        return;
+    }
+
+    // Outer product of the components, which are assigned free labels in order.
+    auto component_labels = std::vector<std::u8string>{};
+    auto next_label       = 0uz;
+    for (const auto& c : plan.components()) {
+        component_labels.push_back(to_string(p.free_index_labels().subspan(next_label, c.rank)));
+        next_label += c.rank;
+    }
+    contract(D, out_labels, out, std::span{ component_labels }, outputs);
+}
+
+} // namespace plan_cache_impl
+
+[[nodiscard]] inline std::vector<std::byte>
+serialize_plan(const einsum_plan& plan) {
+    using namespace plan_cache_impl;
+    auto out = std::vector<std::byte>{};
+
+    const auto to_u32 = [](const std::size_t x) {
+        if (x >= no_factor) { throw std::logic_error{ "Too large value to serialize." }; }
+        return static_cast<std::uint32_t>(x);
+    };
+
+    const auto write_labels = [&](const std::u8string& labels) {
+        if (labels.size() > 0xffuz) { throw std::logic_error{ "Too many index labels." }; }
+        write_int(out, static_cast<std::uint8_t>(labels.size()));
+        for (const auto c : labels) { out.push_back(static_cast<std::byte>(c)); }
+    };
+
+    write_int(out, static_cast<std::uint64_t>(plan.dimension()));
+    write_int(out, to_u32(rn::size(plan.components())));
+
+    for (const auto& c : plan.components()) {
+        write_int(out, to_u32(c.rank));
+        write_int(out, to_u32(c.number_of_contractions));
+        write_int(out,
+                  c.one_node_factor_ordinal ? to_u32(*c.one_node_factor_ordinal) : no_factor);
+        write_int(out, to_u32(rn::size(c.steps)));
+
+        for (const auto& s : c.steps) {
+            write_int(out, to_u32(s.lhs_register));
+            write_int(out, to_u32(s.rhs_register));
+            write_int(out, to_u32(s.out_register));
+            write_int(out, to_u32(s.out_rank));
+            write_int(out, static_cast<std::uint8_t>(s.kernel));
+            write_int(out, static_cast<std::uint8_t>(s.precontracted));
+            write_int(out, static_cast<std::uint8_t>(s.fused_with_next));
+            write_labels(s.lhs_labels);
+            write_labels(s.rhs_labels);
+        }
+    }
+    return out;
+}
+
+[[nodiscard]] inline einsum_plan
+deserialize_plan(const std::span<const std::byte> payload) {
+    using namespace plan_cache_impl;
+    auto r = reader{ payload };
+
+    const auto D            = static_cast<std::size_t>(r.read_int<std::uint64_t>());
+    const auto n_components = r.read_int<std::uint32_t>();
+
+    auto components = std::vector<component_plan>{};
+    components.reserve(n_components);
+
+    for ([[maybe_unused]] const auto _ : rv::iota(0u, n_components)) {
+        const auto rank    = r.read_int<std::uint32_t>();
+        const auto n       = r.read_int<std::uint32_t>();
+        const auto factor  = r.read_int<std::uint32_t>();
+        const auto n_steps = r.read_int<std::uint32_t>();
+
+        auto steps = std::vector<pairwise_step>{};
+        steps.reserve(n_steps);
+        for ([[maybe_unused]] const auto _ : rv::iota(0u, n_steps)) {
+            auto& s           = steps.emplace_back();
+            s.lhs_register    = r.read_int<std::uint32_t>();
+            s.rhs_register    = r.read_int<std::uint32_t>();
+            s.out_register    = r.read_int<std::uint32_t>();
+            s.out_rank        = r.read_int<std::uint32_t>();
+            s.kernel          = static_cast<contraction_kernel>(r.read_int<std::uint8_t>());
+            s.precontracted   = r.read_int<std::uint8_t>() != 0;
+            s.fused_with_next = r.read_int<std::uint8_t>() != 0;
+            s.lhs_labels      = r.read_labels();
+            s.rhs_labels      = r.read_labels();
+        }
+        if ((factor == no_factor) == rn::empty(steps)) {
+            throw std::runtime_error{ "Invalid einsum plan: component has no steps or node." };
+        }
+        check_steps(steps);
+
+        components.push_back({ .rank                   = rank,
+                               .number_of_contractions = n,
+                               .one_node_factor_ordinal =
+                                   factor == no_factor ? std::nullopt
+                                                       : std::optional<std::size_t>{ factor },
+                               .steps = std::move(steps) });
+    }
+
+    if (not rn::empty(r.rest())) { throw std::runtime_error{ "Trailing bytes in einsum plan." }; }
+
+    return einsum_plan(D, std::move(components));
+}
+
+/// Collects plans and writes them to a plan cache file.
+class plan_cache_writer {
+    struct entry {
+        std::u8string estr;
+        std::vector<std::size_t> extents;
+        std::vector<std::byte> plan;
+    };
+    std::map<std::uint64_t, entry> entries_{};
+
+  public:
+    /// Adds \p plan of \p estr for \p extents.
+    ///
+    /// Throws if a different einsum string or extents hash to the same key.
+    void add(const std::u8string_view estr,
+             const std::span<const std::size_t> extents,
+             const einsum_plan& plan) {
+        auto e = entry{ .estr    = plan_cache_impl::normalized(estr),
+                        .extents = extents | rn::to<std::vector>(),
+                        .plan    = serialize_plan(plan) };
+        if (e.estr.size() > 0xffffuz or e.extents.size() > 0xffuz) {
+            throw std::logic_error{ "Too long einsum string to cache." };
+        }
+
+        const auto key = plan_key(estr, extents);
+        if (const auto it = entries_.find(key);
+            it != entries_.end()
+            and (it->second.estr != e.estr or it->second.extents != e.extents)) {
+            throw std::logic_error{ "Einsum plan cache key collision." };
+        }
+        entries_.insert_or_assign(key, std::move(e));
+    }
+
+    /// Plans \p estr for geometric \p extents and adds the plan.
+    void add(const std::u8string_view estr, const std::span<const std::size_t> extents) {
+        const auto D = plan_cache_impl::geometric_dimension(extents);
+        add(estr, extents, einsum_plan(estr, D));
+    }
+
+    void write(const std::filesystem::path& path) const {
+        using namespace plan_cache_impl;
+        auto out = std::vector<std::byte>{};
+
+        for (const auto c : magic) { out.push_back(static_cast<std::byte>(c)); }
+        write_int(out, version);
+        write_int(out, static_cast<std::uint32_t>(entries_.size()));
+
+        const auto payload_size = [](const entry& e) {
+            return 2uz + e.estr.size() + 1uz + 8uz * e.extents.size() + e.plan.size();
+        };
+
+        // std::map iterates in key order, so the entry table is sorted.
+        auto offset = header_size + entry_size * entries_.size();
+        for (const auto& [key, e] : entries_) {
+            write_int(out, key);
+            write_int(out, static_cast<std::uint64_t>(offset));
+            write_int(out, static_cast<std::uint64_t>(payload_size(e)));
+            offset += payload_size(e);
+        }
+        for (const auto& [_, e] : entries_) {
+            write_int(out, static_cast<std::uint16_t>(e.estr.size()));
+            for (const auto c : e.estr) { out.push_back(static_cast<std::byte>(c)); }
+            write_int(out, static_cast<std::uint8_t>(e.extents.size()));
+            for (const auto x : e.extents) { write_int(out, static_cast<std::uint64_t>(x)); }
+            out.insert(out.end(), e.plan.begin(), e.plan.end());
+        }
+
+        auto file = std::ofstream(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(out.data()),
+                   static_cast<std::streamsize>(out.size()));
+        if (not file) { throw std::runtime_error{ "Could not write einsum plan cache." }; }
+    }
+};
+
+/// Read only memory-mapped plan cache file.
+///
+/// Lookups binary search the mapped entry table and only deserialize the found plan.
+class mapped_plan_cache {
+    const std::byte* data_{ nullptr };
+    std::size_t size_{ 0uz };
+    std::size_t number_of_entries_{ 0uz };
+
+    mapped_plan_cache(const std::byte* data, const std::size_t size)
+        : data_{ data },
+          size_{ size } {
+        using namespace plan_cache_impl;
+        if (size_ < header_size
+            or not std::equal(magic.begin(), magic.end(), reinterpret_cast<const char*>(data_))) {
+            throw std::runtime_error{ "Not an einsum plan cache file." };
+        }
+
+        auto r = reader{ std::span{ data_, size_ }.subspan(magic.size()) };
+        if (r.read_int<std::uint32_t>() != version) {
+            throw std::runtime_error{ "Unsupported einsum plan cache version." };
+        }
+        number_of_entries_ = r.read_int<std::uint32_t>();
+
+        if (size_ < header_size + entry_size * number_of_entries_) {
+            throw std::runtime_error{ "Truncated einsum plan cache entry table." };
+        }
+    }
+
+    void unmap() noexcept {
+        if (data_ != nullptr) { ::munmap(const_cast<std::byte*>(data_), size_); }
+        data_ = nullptr;
+        size_ = number_of_entries_ = 0uz;
+    }
+
+    [[nodiscard]] std::uint64_t read_entry(const std::size_t i, const std::size_t field) const {
+        using namespace plan_cache_impl;
+        const auto offset = header_size + i * entry_size + 8uz * field;
+        auto r            = reader{ std::span{ data_, size_ }.subspan(offset, 8uz) };
+        return r.read_int<std::uint64_t>();
+    }
+
+  public:
+    /// Maps \p path or returns empty optional if it does not exist (cold start).
+    ///
+    /// Throws if the file exists but is not a valid plan cache.
+    [[nodiscard]] static std::optional<mapped_plan_cache> open(const std::filesystem::path& path) {
+        const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno == ENOENT) { return std::nullopt; }
+            throw std::system_error(errno, std::generic_category(), "open einsum plan cache");
+        }
+
+        struct stat st {};
+        if (::fstat(fd, &st) != 0) {
+            const auto err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "fstat einsum plan cache");
+        }
+
+        const auto size = static_cast<std::size_t>(st.st_size);
+        void* const ptr =
+            size == 0uz ? MAP_FAILED : ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED) { throw std::runtime_error{ "Could not map einsum plan cache." }; }
+
+        // Lookups touch the entry table first and then random payloads.
+        ::madvise(ptr, size, MADV_WILLNEED);
+
+        try {
+            return mapped_plan_cache(static_cast<const std::byte*>(ptr), size);
+        } catch (...) {
+            ::munmap(ptr, size);
+            throw;
+        }
+    }
+
+    mapped_plan_cache(const mapped_plan_cache&)            = delete;
+    mapped_plan_cache& operator=(const mapped_plan_cache&) = delete;
+
+    mapped_plan_cache(mapped_plan_cache&& other) noexcept
+        : data_{ std::exchange(other.data_, nullptr) },
+          size_{ std::exchange(other.size_, 0uz) },
+          number_of_entries_{ std::exchange(other.number_of_entries_, 0uz) } {}
+
+    mapped_plan_cache& operator=(mapped_plan_cache&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            data_              = std::exchange(other.data_, nullptr);
+            size_              = std::exchange(other.size_, 0uz);
+            number_of_entries_ = std::exchange(other.number_of_entries_, 0uz);
+        }
+        return *this;
+    }
+
+    ~mapped_plan_cache() { unmap(); }
+
+    [[nodiscard]] std::size_t size() const noexcept { return number_of_entries_; }
+
+    /// Plan of \p estr for \p extents or empty optional if there is none.
+    ///
+    /// Entries whose einsum string or extents differ (hash collisions) are not returned.
+    /// Throws if the stored plan is invalid or does not match \p estr.
+    [[nodiscard]] std::optional<einsum_plan>
+        find(const std::u8string_view estr, const std::span<const std::size_t> extents) const {
+        using namespace plan_cache_impl;
+        const auto key = plan_key(estr, extents);
+
+        auto first = 0uz;
+        auto last  = number_of_entries_;
+        while (first < last) {
+            const auto mid = first + (last - first) / 2uz;
+            if (read_entry(mid, 0uz) < key) {
+                first = mid + 1uz;
+            } else {
+                last = mid;
+            }
+        }
+        if (first == number_of_entries_ or read_entry(first, 0uz) != key) { return std::nullopt; }
+
+        const auto offset = read_entry(first, 1uz);
+        const auto size   = read_entry(first, 2uz);
+        if (offset > size_ or size > size_ - offset) {
+            throw std::runtime_error{ "Einsum plan cache entry out of bounds." };
+        }
+
+        auto r = reader{ std::span{ data_ + offset, static_cast<std::size_t>(size) } };
+        if (r.read_string() != normalized(estr)) { return std::nullopt; }
+        const auto n_extents = r.read_int<std::uint8_t>();
+        if (n_extents != rn::size(extents)) { return std::nullopt; }
+        for (const auto e : extents) {
+            if (r.read_int<std::uint64_t>() != e) { return std::nullopt; }
+        }
+
+        auto plan = deserialize_plan(r.rest());
+        if (plan.dimension() != geometric_dimension(extents)) {
+            throw std::runtime_error{ "Einsum plan does not match the extents." };
+        }
+        check_plan_of(plan, einsum_parser(estr));
+        return plan;
+    }
+};
+
+/// Returns plan from \p cache if there is one, otherwise plans \p estr.
+[[nodiscard]] inline einsum_plan
+cached_einsum_plan(const std::optional<mapped_plan_cache>& cache,
+                   const std::u8string_view estr,
+                   const std::span<const std::size_t> extents) {
+    if (cache) {
+        if (auto plan = cache->find(estr, extents)) { return std::move(plan).value(); }
+    }
+
+    return einsum_plan(estr, plan_cache_impl::geometric_dimension(extents));
+}
+
+/// Executes \p plan of einsum \p estr, e.g. loaded from mapped_plan_cache, at runtime.
+///
+/// Each pairwise step is one generic loop over the step labels, so this is slower than
+/// einsum<estr> but does not need the einsum string at compile time.
+/// Precontracted steps are recomputed on each call.
+/// Throws if \p plan is not a plan of \p estr or the extents do not match its dimension.
+template<sstd::contiguous_mdspan OutMDS, sstd::contiguous_mdspan... MDS>
+    requires(std::is_same_v<std::remove_const_t<typename MDS::element_type>,
+                            typename OutMDS::element_type>
+             and ...)
+void
+execute_plan(const einsum_plan& plan,
+             const std::u8string_view estr,
+             const OutMDS out,
+             const MDS... factors) {
+    using T           = typename OutMDS::element_type;
+    const auto spans  = std::array<std::span<const T>, sizeof...(MDS)>{ std::span<const T>(
+        factors.data_handle(), factors.size())... };
+    plan_cache_impl::execute(plan,
+                             estr,
+                             std::span<T>(out.data_handle(), out.size()),
+                             std::span<const std::span<const T>>{ spans });
+}
+
+} // namespace idg
@@ -6,6 +6,7 @@
  **/
 #include <algorithm>
 #include <array>
+#include <complex>
 #include <functional>
 #include <numeric>
 #include <optional>
@@ -47,6 +48,22 @@ struct is_mdspan<std::mdspan<T, E, LP, AP>> : std::true_type {};
 template<typename T>
 static constexpr bool is_mdspan_v = is_mdspan<T>::value;
 
+template<typename T>
+struct is_complex : std::false_type {};
+
+template<typename T>
+struct is_complex<std::complex<T>> : std::true_type {};
+
+template<typename T>
+static constexpr bool is_complex_v = is_complex<T>::value;
+
+/// Contiguous mdspan whose elements can be accessed through data_handle() as a span.
+template<typename MDS>
+concept contiguous_mdspan =
+    is_mdspan_v<MDS> and std::is_same_v<typename MDS::layout_type, std::layout_right>
+    and std::is_same_v<typename MDS::accessor_type,
+                       std::default_accessor<typename MDS::element_type>>;
+
 /// Range adaptor to iterate over mdspan indeceis in arbitrary order
 struct md_indecies_type : std::ranges::range_adaptor_closure<md_indecies_type> {
     template<typename T>
@@ -219,6 +236,89 @@ template<typename T,
          typename AccessorPolicy = std::default_accessor<T>>
 using geometric_mdspan = std::mdspan<T, geometric_extents<rank, dim>, LayoutPolicy, AccessorPolicy>;
 
+/// Layout like std::layout_stride, but the innermost stride is known to be one.
+///
+/// Kernels instantiated with it index the innermost dimension contiguously,
+/// which they can not assume of layout_stride even if the stride happens to be one.
+struct layout_unit_inner_stride {
+    template<typename Extents>
+    class mapping {
+      public:
+        using extents_type = Extents;
+        using index_type   = typename Extents::index_type;
+        using size_type    = typename Extents::size_type;
+        using rank_type    = typename Extents::rank_type;
+        using layout_type  = layout_unit_inner_stride;
+
+      private:
+        static constexpr auto rank_ = Extents::rank();
+
+        extents_type extents_{};
+        std::array<index_type, rank_ == 0uz ? 0uz : rank_ - 1uz> outer_strides_{};
+
+      public:
+        constexpr mapping() noexcept = default;
+
+        /// Innermost stride of \p other has to be one.
+        constexpr explicit mapping(const std::layout_stride::mapping<Extents>& other) noexcept
+            : extents_{ other.extents() } {
+            for (const auto r : std::views::iota(0uz, outer_strides_.size())) {
+                outer_strides_[r] = other.stride(r);
+            }
+        }
+
+        [[nodiscard]] constexpr const extents_type& extents() const noexcept { return extents_; }
+
+        [[nodiscard]] constexpr index_type stride(const rank_type r) const noexcept {
+            return r + 1uz == rank_ ? index_type{ 1 } : outer_strides_[r];
+        }
+
+        template<typename... Indices>
+            requires(sizeof...(Indices) == rank_)
+        [[nodiscard]] constexpr index_type operator()(const Indices... indices) const noexcept {
+            return std::invoke(
+                [&]<std::size_t... R>(std::index_sequence<R...>) {
+                    return ((static_cast<index_type>(indices) * stride(R)) + ... + index_type{ 0 });
+                },
+                std::make_index_sequence<rank_>());
+        }
+
+        [[nodiscard]] constexpr index_type required_span_size() const noexcept {
+            auto size = index_type{ 1 };
+            for (const auto r : std::views::iota(0uz, rank_)) {
+                if (extents_.extent(r) == 0) { return 0; }
+                size += (extents_.extent(r) - 1) * stride(r);
+            }
+            return size;
+        }
+
+        [[nodiscard]] static constexpr bool is_always_unique() noexcept { return true; }
+        [[nodiscard]] static constexpr bool is_always_exhaustive() noexcept { return false; }
+        [[nodiscard]] static constexpr bool is_always_strided() noexcept { return true; }
+
+        [[nodiscard]] static constexpr bool is_unique() noexcept { return true; }
+        [[nodiscard]] static constexpr bool is_strided() noexcept { return true; }
+
+        [[nodiscard]] constexpr bool is_exhaustive() const noexcept {
+            auto size = index_type{ 1 };
+            for (const auto r : std::views::iota(0uz, rank_)) { size *= extents_.extent(r); }
+            return required_span_size() == size;
+        }
+
+        [[nodiscard]] friend constexpr bool operator==(const mapping&, const mapping&) = default;
+    };
+};
+
+/// Views \p mds with layout_unit_inner_stride, innermost stride of \p mds has to be one.
+template<typename T, typename E, typename A>
+[[nodiscard]] constexpr auto
+    with_unit_inner_stride(const std::mdspan<T, E, std::layout_stride, A>& mds) noexcept {
+    return std::mdspan<T, E, layout_unit_inner_stride, A>(
+        mds.data_handle(),
+        layout_unit_inner_stride::mapping<E>(mds.mapping()),
+        mds.accessor());
+}
+
 template<std::size_t rank, std::size_t D>
 [[nodiscard]] consteval auto geometric_index_space() {
     namespace rv = std::ranges::views;
@@ -245,6 +345,8 @@ class natural_polynomial {
 
     [[nodiscard]] constexpr natural_polynomial(std::vector<std::size_t> coeffs) {
         coeffs_ = std::move(coeffs);
+        // Trailing zeros are trimmed, so degree() and operator== do not depend on them.
+        while (not coeffs_.empty() and coeffs_.back() == 0uz) { coeffs_.pop_back(); }
     }
 
   public:
@@ -256,13 +358,23 @@ class natural_polynomial {
         coeffs_[exponent] = 1uz;
     }
 
+    /// Largest exponent with non-zero coefficient, zero polynomial has degree 0.
+    ///
+    /// Coefficients are kept trimmed, so this is the index of the last coefficient.
+    [[nodiscard]] constexpr std::size_t degree(this auto&& self) {
+        return self.coeffs_.empty() ? 0uz : self.coeffs_.size() - 1uz;
+    }
+
+    /// i:th coefficient corresponds to x^i.
+    [[nodiscard]] constexpr std::span<const std::size_t> coefficients(this auto&& self) {
+        return { self.coeffs_ };
+    }
+
+    /// Evaluates the polynomial at \p x with Horner's method.
     [[nodiscard]] constexpr std::size_t evalf(this auto&& self, const std::size_t x) {
-        namespace rv = std::views;
-        const auto vals =
-            self.coeffs_ | rv::enumerate | rv::transform([x](const auto t) {
-                return std::get<1>(t) * integer_pow(x, static_cast<std::size_t>(std::get<0>(t)));
-            });
-        return std::reduce(vals.begin(), vals.end(), 0uz);
+        auto result = 0uz;
+        for (const auto c : self.coeffs_ | std::views::reverse) { result = result * x + c; }
+        return result;
     }
 
     [[nodiscard]] friend constexpr natural_polynomial operator+(const natural_polynomial& lhs,
@@ -291,16 +403,12 @@ class natural_polynomial {
         auto new_coeffs =
             std::vector<std::size_t>(1uz + (lhs.coeffs_.size() - 1uz) + (rhs.coeffs_.size() - 1uz));
 
-        auto cart = std::views::cartesian_product(lhs.coeffs_ | std::views::enumerate,
-                                                  rhs.coeffs_ | std::views::enumerate);
-
-        for (const auto [l, r] : cart) {
-            const auto lhs_c   = std::get<1>(l);
-            const auto rhs_c   = std::get<1>(r);
-            const auto lhs_exp = std::get<0>(l);
-            const auto rhs_exp = std::get<0>(r);
-
-            new_coeffs[lhs_exp + rhs_exp] = lhs_c * rhs_c;
+        // Every pair of terms with the same sum of exponents contributes to the same coefficient.
+        for (const auto i : std::views::iota(0uz, lhs.coeffs_.size())) {
+            if (lhs.coeffs_[i] == 0uz) { continue; }
+            for (const auto j : std::views::iota(0uz, rhs.coeffs_.size())) {
+                new_coeffs[i + j] += lhs.coeffs_[i] * rhs.coeffs_[j];
+            }
         }
 
         return natural_polynomial(std::move(new_coeffs));
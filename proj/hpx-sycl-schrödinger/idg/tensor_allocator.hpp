@@ -0,0 +1,214 @@
+#pragma once
+/// @file Huge page backed and NUMA aware storage of large tensors.
+/*
+ * Large D^k tensors suffer from TLB misses with 4 KiB pages and on multi-socket machines
+ * their pages end up on the NUMA node of the thread which happened to touch them first.
+ *
+ * hugepage_allocator maps allocations of at least huge_page_size bytes with huge pages
+ * (transparent ones by default, explicit MAP_HUGETLB ones if requested and available)
+ * and touches them first in parallel with the same block partitioning as parallel_blocks.
+ * So when a loop over the leading index of a tensor is partitioned with parallel_blocks,
+ * each thread finds its rows on its own NUMA node (assuming threads are not migrated):
+ *
+ * ```cpp
+ * auto A = idg::make_tensor_buffer<double, 3, D>();
+ * idg::parallel_blocks(D, 0uz, [&](const std::size_t first, const std::size_t last) {
+ *     // Rows [first, last) of A are on the NUMA node of this thread.
+ * });
+ * ```
+ *
+ * Elements are default initialized by the allocator, so std::vector does not touch the
+ * memory again on the constructing thread. Memory of a new allocation is zero.
+ *
+ * Loops of einsum and einsum_executor are single-threaded, so their workspaces are touched
+ * by one thread. parallel_einsum partitions output elements instead of rows, and its
+ * make_out_buffer touches the output with that partitioning.
+ **/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <new>
+#include <ranges>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include <experimental/mdspan>
+
+#include "idg/sstd.hpp"
+
+namespace idg {
+
+/// Contiguous block [first, last) of part \p i when \p n items are split to \p parts parts.
+///
+/// Sizes of the blocks differ at most by one.
+[[nodiscard]] constexpr std::pair<std::size_t, std::size_t>
+    block_partition(const std::size_t n, const std::size_t parts, const std::size_t i) {
+    const auto base  = n / parts;
+    const auto rest  = n % parts;
+    const auto first = i * base + std::min(i, rest);
+    return { first, first + base + (i < rest ? 1uz : 0uz) };
+}
+
+/// Number of threads used when zero threads is requested.
+[[nodiscard]] inline std::size_t default_number_of_threads() noexcept {
+    return std::max(1uz, static_cast<std::size_t>(std::thread::hardware_concurrency()));
+}
+
+/// Calls \p f(first, last) for each block_partition of \p n items on its own thread.
+///
+/// If \p threads is zero, default_number_of_threads() is used.
+template<typename F>
+void parallel_blocks(const std::size_t n, std::size_t threads, F&& f) {
+    if (threads == 0uz) { threads = default_number_of_threads(); }
+    threads = std::min(threads, std::max(n, 1uz));
+
+    if (threads == 1uz) {
+        std::invoke(f, 0uz, n);
+        return;
+    }
+
+    auto workers = std::vector<std::jthread>{};
+    workers.reserve(threads - 1uz);
+    for (const auto i : std::views::iota(1uz, threads)) {
+        const auto [first, last] = block_partition(n, threads, i);
+        workers.emplace_back([&f, first, last] { std::invoke(f, first, last); });
+    }
+    const auto [first, last] = block_partition(n, threads, 0uz);
+    std::invoke(f, first, last);
+}
+
+inline constexpr std::size_t huge_page_size = 2uz * 1024uz * 1024uz;
+
+enum class huge_pages { transparent, explicit_ };
+
+struct tensor_allocation_policy {
+    huge_pages pages{ huge_pages::transparent };
+    /// Threads which touch the allocation first, zero means default_number_of_threads().
+    std::size_t threads{ 0uz };
+    /// Allocation is partitioned to threads as rows (i.e. leading index) of a tensor.
+    /// Zero means that elements are partitioned.
+    std::size_t rows{ 0uz };
+};
+
+/// Allocator of huge page backed memory with parallel first touch.
+///
+/// Allocations smaller than huge_page_size are served by operator new.
+/// All allocations are zeroed and construct default initializes, so elements of a new
+/// std::vector are zero, but elements appended later by resize are indeterminate.
+template<typename T>
+class hugepage_allocator {
+    template<typename U>
+    friend class hugepage_allocator;
+
+    tensor_allocation_policy policy_{};
+
+    [[nodiscard]] static constexpr std::size_t mapped_bytes(const std::size_t n) {
+        const auto bytes = n * sizeof(T);
+        return (bytes + huge_page_size - 1uz) / huge_page_size * huge_page_size;
+    }
+
+    [[nodiscard]] static constexpr bool is_mapped(const std::size_t n) {
+        return n * sizeof(T) >= huge_page_size;
+    }
+
+    /// Zeroes rows of [p, p + n) on the threads which will later process them.
+    void first_touch(std::byte* const p, const std::size_t n) const {
+        const auto rows = policy_.rows != 0uz and n % policy_.rows == 0uz ? policy_.rows : n;
+        const auto row_bytes = n / rows * sizeof(T);
+        const auto touch     = [&](const std::size_t first, const std::size_t last) {
+            std::memset(p + first * row_bytes, 0, (last - first) * row_bytes);
+        };
+        parallel_blocks(rows, policy_.threads, touch);
+    }
+
+  public:
+    using value_type = T;
+
+    hugepage_allocator() noexcept = default;
+
+    explicit hugepage_allocator(const tensor_allocation_policy policy) noexcept
+        : policy_{ policy } {}
+
+    template<typename U>
+    hugepage_allocator(const hugepage_allocator<U>& other) noexcept
+        : policy_{ other.policy_ } {}
+
+    [[nodiscard]] T* allocate(const std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length{};
+        }
+        if (not is_mapped(n)) {
+            void* const p = ::operator new(n * sizeof(T), std::align_val_t{ alignof(T) });
+            std::memset(p, 0, n * sizeof(T));
+            return static_cast<T*>(p);
+        }
+
+        const auto bytes = mapped_bytes(n);
+        void* p          = MAP_FAILED;
+        if (policy_.pages == huge_pages::explicit_) {
+            p = ::mmap(nullptr,
+                       bytes,
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                       -1,
+                       0);
+        }
+        if (p == MAP_FAILED) {
+            // Explicit huge pages are not reserved (vm.nr_hugepages), so use transparent ones.
+            p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) { throw std::bad_alloc{}; }
+            ::madvise(p, bytes, MADV_HUGEPAGE);
+        }
+
+        first_touch(static_cast<std::byte*>(p), n);
+        return static_cast<T*>(p);
+    }
+
+    /// Default initializes instead of value initializing, which would touch all pages
+    /// of the allocation again on the calling thread.
+    template<typename U, typename... Args>
+    void construct(U* const p, Args&&... args) {
+        if constexpr (sizeof...(Args) == 0uz) {
+            ::new (static_cast<void*>(p)) U;
+        } else {
+            std::construct_at(p, std::forward<Args>(args)...);
+        }
+    }
+
+    void deallocate(T* const p, const std::size_t n) noexcept {
+        if (not is_mapped(n)) {
+            ::operator delete(p, n * sizeof(T), std::align_val_t{ alignof(T) });
+            return;
+        }
+        ::munmap(p, mapped_bytes(n));
+    }
+
+    /// Any instance can deallocate memory of any other instance.
+    [[nodiscard]] friend bool operator==(const hugepage_allocator&,
+                                         const hugepage_allocator&) noexcept {
+        return true;
+    }
+};
+
+template<typename T>
+using tensor_buffer = std::vector<T, hugepage_allocator<T>>;
+
+/// Huge page backed storage of geometric tensor, first touched by rows of the leading index.
+template<typename T, std::size_t rank, std::size_t dim>
+[[nodiscard]] tensor_buffer<T>
+    make_tensor_buffer(const std::size_t threads = 0uz,
+                       const huge_pages pages    = huge_pages::transparent) {
+    const auto policy = tensor_allocation_policy{ .pages   = pages,
+                                                  .threads = threads,
+                                                  .rows    = rank == 0uz ? 0uz : dim };
+    return tensor_buffer<T>(sstd::integer_pow(dim, rank), hugepage_allocator<T>(policy));
+}
+
+} // namespace idg
@@ -1,10 +1,19 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <functional>
 #include <iterator>
 #include <numeric>
+#include <optional>
 #include <ranges>
+#include <span>
 #include <stdexcept>
+#include <string_view>
+#include <thread>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -159,6 +168,11 @@ class pairwise_contraction_type {
         return sstd::integer_pow(D, self.lhs_.rank + self.rhs_.rank - rn::size(self.edges_));
     }
 
+    /// Cost as polynomial of the dimension D.
+    [[nodiscard]] constexpr sstd::natural_polynomial cost_polynomial(this auto&& self) {
+        return sstd::natural_polynomial(self.lhs_.rank + self.rhs_.rank - rn::size(self.edges_));
+    }
+
     [[nodiscard]] constexpr tensor_network::node_id lhs_id(this auto&& self) {
         return self.lhs_.id;
     }
@@ -179,6 +193,9 @@ class pairwise_contraction_type {
         return self.out_.value().rank;
     }
 
+    [[nodiscard]] friend constexpr bool operator==(const pairwise_contraction_type&,
+                                                   const pairwise_contraction_type&) = default;
+
     [[nodiscard]] constexpr std::pair<std::u8string, std::u8string> index_labels(this auto&& self) {
         auto lhs_str = std::u8string(self.lhs_.rank, u8' ');
         auto rhs_str = std::u8string(self.rhs_.rank, u8' ');
@@ -226,6 +243,194 @@ template<rn::input_range R>
     return std::reduce(pcs_view.begin(), pcs_view.end());
 }
 
+/// Pairwise contraction sequence with its cost as polynomial of the dimension D.
+struct symbolic_contraction_sequence {
+    std::vector<pairwise_contraction_type> sequence{};
+    sstd::natural_polynomial cost{};
+};
+
+/// Optimal pairwise contraction sequences of a network for every dimension D.
+///
+/// Sequence ranges()[i].sequence is optimal for dimensions from ranges()[i].first_dimension
+/// until the first dimension of the next range. The last range extends to infinity.
+class contraction_sequence_table {
+  public:
+    struct dimension_range {
+        std::size_t first_dimension;
+        /// Index of the sequence in sequences().
+        std::size_t sequence;
+
+        [[nodiscard]] friend constexpr bool operator==(const dimension_range&,
+                                                       const dimension_range&) = default;
+    };
+
+  private:
+    std::vector<symbolic_contraction_sequence> sequences_{};
+    std::vector<dimension_range> ranges_{};
+
+  public:
+    [[nodiscard]] constexpr contraction_sequence_table(
+        std::vector<symbolic_contraction_sequence> sequences,
+        std::vector<dimension_range> ranges)
+        : sequences_{ std::move(sequences) },
+          ranges_{ std::move(ranges) } {}
+
+    [[nodiscard]] constexpr std::span<const symbolic_contraction_sequence>
+        sequences(this auto&& self) {
+        return { self.sequences_ };
+    }
+
+    [[nodiscard]] constexpr std::span<const dimension_range> ranges(this auto&& self) {
+        return { self.ranges_ };
+    }
+
+    /// Optimal sequence for dimension \p D, found with a binary search of the ranges.
+    [[nodiscard]] constexpr const symbolic_contraction_sequence&
+        optimal(this auto&& self, const std::size_t D) {
+        const auto it = rn::upper_bound(self.ranges_, D, {}, &dimension_range::first_dimension);
+        if (it == self.ranges_.begin()) {
+            throw std::logic_error{ "Dimension is smaller than the first tabulated one." };
+        }
+        return self.sequences_[rn::prev(it)->sequence];
+    }
+};
+
+/// Vertex choice of the greedy elimination ordering.
+enum class elimination_heuristic { min_fill, min_degree };
+
+[[nodiscard]] constexpr std::string_view to_string_view(const elimination_heuristic h) {
+    switch (h) {
+        case elimination_heuristic::min_fill: return "min_fill";
+        case elimination_heuristic::min_degree: return "min_degree";
+    }
+    throw std::logic_error{ "Unknown elimination heuristic." };
+}
+
+namespace elimination_impl {
+
+/// Graph as adjacency bitsets, which makes neighbourhood intersections word operations.
+class bitset_graph {
+    std::size_t words_;
+    std::vector<std::vector<std::uint64_t>> adjacency_;
+
+  public:
+    [[nodiscard]] constexpr explicit bitset_graph(const std::size_t vertices)
+        : words_{ (vertices + 63uz) / 64uz },
+          adjacency_(vertices, std::vector<std::uint64_t>(words_, 0u)) {}
+
+    constexpr void connect(this bitset_graph& self, const std::size_t a, const std::size_t b) {
+        if (a == b) { return; }
+        self.adjacency_[a][b / 64uz] |= std::uint64_t{ 1 } << (b % 64uz);
+        self.adjacency_[b][a / 64uz] |= std::uint64_t{ 1 } << (a % 64uz);
+    }
+
+    [[nodiscard]] constexpr std::vector<std::size_t> neighbours(this const bitset_graph& self,
+                                                                const std::size_t v) {
+        auto n = std::vector<std::size_t>{};
+        for (const auto [w, word] : self.adjacency_[v] | rv::enumerate) {
+            for (auto bits = word; bits != 0u; bits &= bits - 1u) {
+                n.push_back(static_cast<std::size_t>(w) * 64uz
+                            + static_cast<std::size_t>(std::countr_zero(bits)));
+            }
+        }
+        return n;
+    }
+
+    [[nodiscard]] constexpr std::size_t
+        common_neighbours(this const bitset_graph& self, const std::size_t a, const std::size_t b) {
+        auto count = 0uz;
+        for (const auto w : rv::iota(0uz, self.words_)) {
+            count += static_cast<std::size_t>(
+                std::popcount(self.adjacency_[a][w] & self.adjacency_[b][w]));
+        }
+        return count;
+    }
+
+    /// Connects neighbours of \p v to each other and removes \p v.
+    constexpr void eliminate(this bitset_graph& self, const std::size_t v) {
+        const auto n = self.neighbours(v);
+        for (const auto a : n) {
+            for (const auto b : n) { self.connect(a, b); }
+            self.adjacency_[a][v / 64uz] &= ~(std::uint64_t{ 1 } << (v % 64uz));
+        }
+        rn::fill(self.adjacency_[v], 0u);
+    }
+};
+
+/// Elimination ordering of the line graph of a network with edges \p edges.
+///
+/// Vertices of the line graph are the edges of the network, which are adjacent
+/// if they share a node. Returns indices of \p edges in the elimination order.
+[[nodiscard]] constexpr std::vector<std::size_t>
+    line_graph_elimination_order(const std::span<const tensor_network::edge> edges,
+                                 const elimination_heuristic heuristic) {
+    const auto V = rn::size(edges);
+
+    auto graph = bitset_graph(V);
+    for (const auto a : rv::iota(0uz, V)) {
+        for (const auto b : rv::iota(a + 1uz, V)) {
+            const auto ea = edges[a];
+            const auto eb = edges[b];
+            if (ea.left.id == eb.left.id or ea.left.id == eb.right.id
+                or ea.right.id == eb.left.id or ea.right.id == eb.right.id) {
+                graph.connect(a, b);
+            }
+        }
+    }
+
+    const auto score = [&](const std::size_t v) {
+        const auto n = graph.neighbours(v);
+        if (heuristic == elimination_heuristic::min_degree) { return rn::size(n); }
+
+        // Each missing edge between two neighbours is counted from both ends.
+        auto fill = 0uz;
+        for (const auto u : n) { fill += rn::size(n) - 1uz - graph.common_neighbours(u, v); }
+        return fill / 2uz;
+    };
+
+    // Min-heap of (score, vertex), so ties go to the smallest vertex. Eliminating a vertex
+    // changes only the degrees of its neighbours, and fills of them and their neighbours,
+    // so only those are rescored and outdated entries are skipped when popped.
+    auto scores = rv::iota(0uz, V) | rv::transform(score) | rn::to<std::vector>();
+    auto heap   = rv::iota(0uz, V)
+                | rv::transform([&](const std::size_t v) { return std::pair{ scores[v], v }; })
+                | rn::to<std::vector>();
+    rn::make_heap(heap, rn::greater{});
+
+    auto eliminated = std::vector<bool>(V, false);
+    auto order      = std::vector<std::size_t>{};
+    order.reserve(V);
+    while (rn::size(order) < V) {
+        rn::pop_heap(heap, rn::greater{});
+        const auto [s, v] = heap.back();
+        heap.pop_back();
+        if (eliminated[v] or s != scores[v]) { continue; }
+
+        auto affected = graph.neighbours(v);
+        graph.eliminate(v);
+        eliminated[v] = true;
+        order.push_back(v);
+
+        if (heuristic == elimination_heuristic::min_fill) {
+            const auto neighbours = affected;
+            for (const auto u : neighbours) {
+                rn::copy(graph.neighbours(u), std::back_inserter(affected));
+            }
+            rn::sort(affected);
+            affected.erase(rn::unique(affected).begin(), affected.end());
+        }
+        // Eliminated vertices are not neighbours of any vertex anymore.
+        for (const auto u : affected) {
+            scores[u] = score(u);
+            heap.push_back({ scores[u], u });
+            rn::push_heap(heap, rn::greater{});
+        }
+    }
+    return order;
+}
+
+} // namespace elimination_impl
+
 class connected_tensor_network : public tensor_network {
     friend class tensor_network;
 
@@ -233,6 +438,59 @@ class connected_tensor_network : public tensor_network {
     using tensor_network::add_node;
     using tensor_network::add_edge;
 
+    /// Cost of a search which found no sequence within its budget.
+    static constexpr auto unbounded_cost = static_cast<std::size_t>(-1);
+
+    [[nodiscard]] static constexpr std::size_t saturating_add(const std::size_t a,
+                                                              const std::size_t b) {
+        return a > unbounded_cost - b ? unbounded_cost : a + b;
+    }
+
+    [[nodiscard]] static constexpr std::size_t saturating_pow(const std::size_t base,
+                                                              const std::size_t exp) {
+        auto x = 1uz;
+        for ([[maybe_unused]] const auto _ : rv::iota(0uz, exp)) {
+            if (base != 0uz and x > unbounded_cost / base) { return unbounded_cost; }
+            x *= base;
+        }
+        return x;
+    }
+
+    /// Admissible lower bound of the cost of contracting the network left after
+    /// contracting \p lhs with \p rhs, so heads which can not lead to a cheaper sequence
+    /// are skipped without searching their tails.
+    ///
+    /// Rank of the network does not change in contractions and the last contraction
+    /// contracts at least one edge, so it costs at least D^(rank + 1). Other contractions
+    /// cost at least D, except those between constant nodes, which are free. Contraction of
+    /// two variable nodes removes one variable node, and constant nodes have to be joined
+    /// with a variable node at least once.
+    [[nodiscard]] constexpr std::size_t
+        tail_cost_lower_bound(this auto&& self,
+                              const std::size_t D,
+                              const std::vector<node_id>& constant_nodes,
+                              const node lhs,
+                              const node rhs) {
+        const auto is_constant = [&](const node_id id) { return rn::contains(constant_nodes, id); };
+
+        auto constants =
+            static_cast<std::size_t>(rn::count_if(self.nodes_, is_constant, &node::id));
+        auto variables = self.size() - constants;
+
+        // Output of the head is constant only if both of its inputs are.
+        if (is_constant(lhs.id) or is_constant(rhs.id)) {
+            --constants;
+        } else {
+            --variables;
+        }
+
+        if (variables == 0uz or variables + constants == 1uz) { return 0uz; }
+
+        const auto costly_contractions = variables - 1uz + (constants == 0uz ? 0uz : 1uz);
+        return saturating_add(saturating_pow(D, self.rank() + 1uz),
+                              (costly_contractions - 1uz) * D);
+    }
+
     /// Each element corresponds to all edges contracted in pairwise contraction.
     ///
     /// There is a group for all node pairs which have connecting edge,
@@ -418,16 +676,440 @@ class connected_tensor_network : public tensor_network {
         return new_node_id;
     }
 
+    /// Contracts greedily pairs of nodes whose output rank is at most the rank of either one.
+    ///
+    /// These are pairs sharing most of their indices, e.g. a vector absorbed into a matrix,
+    /// two matrices of a chain or two tensors joined by enough parallel edges. Such a contraction
+    /// never creates a tensor larger than its inputs, so it is done before the search, which is
+    /// exponential in the number of nodes. Of the candidates the cheapest one is contracted first.
+    ///
+    /// It is a heuristic and not optimal for all networks, so it is opt-in
+    /// (see simplified_pairwise_contraction_sequence). Requiring the output to be no larger than
+    /// the smaller input, and not only the larger one, keeps it from absorbing a matrix into
+    /// one of the tensors of "abcdx,abcdy,xy->", which costs D^6 + D^5 instead of D^6 + D^2,
+    /// or a vector into its neighbour of "ijkl,i,jkl->", which costs D^4 + D^3 instead of D^4 + D.
+    /// network_impl checks that the simplified cost equals the searched one for example networks.
+    ///
+    /// Contractions between two of \p constant_nodes are free (see pairwise_contraction_sequence),
+    /// so they are done first. A constant node is never contracted with a variable one,
+    /// as that would lose the precontractions the constant node takes part in,
+    /// e.g. for "ij,jk,kl,l->i" with constant A and B, absorbing C into B would make
+    /// A B (C x) cost three contractions per evaluation instead of two for (A B) (C x).
+    ///
+    /// Returns the contractions in the order they were done. Outputs of contractions between
+    /// \p constant_nodes are appended to them.
+    constexpr std::vector<pairwise_contraction_type>
+        simplify(this connected_tensor_network& self, std::vector<node_id>& constant_nodes) {
+        auto sequence = std::vector<pairwise_contraction_type>{};
+
+        const auto is_constant = [&](const node_id id) { return rn::contains(constant_nodes, id); };
+
+        while (self.size() > 1uz) {
+            const auto [node_pairs, edge_groups] = self.group_edges_pairwise();
+
+            auto best          = std::optional<std::size_t>{};
+            auto best_exponent = 0uz;
+            for (const auto i : rv::iota(0uz, rn::size(node_pairs))) {
+                const auto [lhs, rhs] = node_pairs[i];
+                const auto edges      = rn::size(edge_groups[i]);
+                if (is_constant(lhs.id) != is_constant(rhs.id)) { continue; }
+
+                // Edges of a group are contracted, so they remove two indices each.
+                const auto out_rank = lhs.rank + rhs.rank - 2uz * edges;
+                const auto exponent = is_constant(lhs.id) ? 0uz : lhs.rank + rhs.rank - edges;
+                if (out_rank <= std::min(lhs.rank, rhs.rank)
+                    and (not best or exponent < best_exponent)) {
+                    best          = i;
+                    best_exponent = exponent;
+                }
+            }
+            if (not best) { break; }
+
+            const auto [lhs, rhs] = node_pairs[*best];
+            auto contraction      = pairwise_contraction_type(lhs, rhs, edge_groups[*best]);
+            const auto id         = self.pairwise_contraction(lhs.id, rhs.id);
+            contraction.store_out(*rn::find(self.view_nodes(), id, &node::id));
+            sequence.push_back(std::move(contraction));
+
+            if (is_constant(lhs.id)) { constant_nodes.push_back(id); }
+        }
+        return sequence;
+    }
+
     /// Optimized sequence based on the given dimension \p D.
     [[nodiscard]] constexpr rn::range auto pairwise_contraction_sequence(this auto&& self,
                                                                          const std::size_t D) {
-        // These will be initialized by the first group because of the ~ infinite cost.
+        return self.search_pairwise_contraction_sequence(D, std::vector<node_id>{}).first;
+    }
+
+    /// Optimized sequence based on the given dimension \p D, when \p constant_nodes are constant.
+    ///
+    /// Contractions between constant nodes are precomputed once and not on every evaluation,
+    /// so they are considered to be free and their outputs are constant nodes as well.
+    [[nodiscard]] constexpr rn::range auto
+        pairwise_contraction_sequence(this auto&& self,
+                                      const std::size_t D,
+                                      const std::vector<node_id>& constant_nodes) {
+        return self.search_pairwise_contraction_sequence(D, constant_nodes).first;
+    }
+
+    /// Same as pairwise_contraction_sequence, but the network is simplified before the search.
+    ///
+    /// Simplification (see simplify) shrinks the search space of large networks, but it is
+    /// a heuristic, so it is opt-in and einsum plans are searched exhaustively.
+    [[nodiscard]] constexpr std::vector<pairwise_contraction_type>
+        simplified_pairwise_contraction_sequence(this auto&& self,
+                                                 const std::size_t D,
+                                                 const std::vector<node_id>& constant_nodes = {}) {
+        auto simplified          = connected_tensor_network(self);
+        auto simplified_constant = constant_nodes;
+        auto sequence            = simplified.simplify(simplified_constant);
+
+        // no rv::concat in gcc 14 :(
+        rn::copy(simplified.search_pairwise_contraction_sequence(D, simplified_constant).first,
+                 std::back_inserter(sequence));
+        return sequence;
+    }
+
+    /// Same sequence as pairwise_contraction_sequence, searched with \p threads threads.
+    ///
+    /// Branches of the search starting with different pairwise contractions are independent,
+    /// so they are run in parallel. If \p threads is zero, all hardware threads are used.
+    [[nodiscard]] std::vector<pairwise_contraction_type>
+        parallel_pairwise_contraction_sequence(this auto&& self,
+                                               const std::size_t D,
+                                               const std::vector<node_id>& constant_nodes = {},
+                                               const std::size_t threads = 0uz) {
+        return self.parallel_search_pairwise_contraction_sequence(D, constant_nodes, threads);
+    }
+
+    /// Sequences which are optimal for some dimension D and the ranges of D where they are.
+    ///
+    /// Costs of the sequences are polynomials in D, whose coefficients count the steps
+    /// of each cost exponent. With n nodes there are n - 1 steps, so the coefficients of
+    /// a difference of two costs are at most n - 1 in absolute value and by the Cauchy bound
+    /// all crossover points are below n. So optimal sequences are tabulated exactly
+    /// by searching with D = 1..n and the sequence optimal at n is optimal for all D >= n.
+    [[nodiscard]] constexpr contraction_sequence_table
+        pairwise_contraction_sequence_table(this auto&& self,
+                                            const std::vector<node_id>& constant_nodes = {}) {
+        const auto max_dimension = std::max(2uz, self.size());
+        auto sequences = self.search_symbolic_contraction_sequences(max_dimension, constant_nodes);
+
+        auto ranges = std::vector<contraction_sequence_table::dimension_range>{};
+        for (const auto D : rv::iota(1uz, max_dimension + 1uz)) {
+            const auto costs = sequences | rv::transform([&](const auto& s) {
+                                   return s.cost.evalf(D);
+                               });
+            const auto best = static_cast<std::size_t>(rn::distance(
+                rn::begin(costs), rn::min_element(costs)));
+
+            if (ranges.empty() or ranges.back().sequence != best) {
+                ranges.push_back({ .first_dimension = D, .sequence = best });
+            }
+        }
+        return contraction_sequence_table(std::move(sequences), std::move(ranges));
+    }
+
+    /// Sequence from a greedy elimination ordering of the line graph, for large networks.
+    ///
+    /// Indices are eliminated in the order chosen by \p heuristic and eliminating an index
+    /// contracts the two nodes it connects. This is polynomial in the size of the network,
+    /// so networks with hundreds of nodes, where search is infeasible, are planned fast.
+    /// If \p try_both_heuristics, the order of the other heuristic is computed as well
+    /// and the cheaper sequence for \p D is used.
+    [[nodiscard]] constexpr std::vector<pairwise_contraction_type>
+        elimination_contraction_sequence(
+            this auto&& self,
+            const std::size_t D,
+            const elimination_heuristic heuristic = elimination_heuristic::min_fill,
+            const bool try_both_heuristics        = true) {
+        if (self.size() == 1uz) { return {}; }
+
+        const auto edges    = self.view_edges() | rn::to<std::vector>();
+        const auto sequence = [&](const elimination_heuristic h) {
+            return self.sequence_from_elimination_order(
+                edges, elimination_impl::line_graph_elimination_order(edges, h));
+        };
+        // Costs of large networks do not fit to std::size_t, so they are compared as doubles.
+        const auto cost = [&](const std::vector<pairwise_contraction_type>& pcs) {
+            auto c = 0.0;
+            for (const auto& pc : pcs) {
+                auto step = 1.0;
+                for ([[maybe_unused]] const auto _ :
+                     rv::iota(0uz, pc.lhs_.rank + pc.rhs_.rank - rn::size(pc.edges_))) {
+                    step *= static_cast<double>(D);
+                }
+                c += step;
+            }
+            return c;
+        };
+
+        auto best = sequence(heuristic);
+        if (try_both_heuristics) {
+            auto other = sequence(heuristic == elimination_heuristic::min_fill
+                                      ? elimination_heuristic::min_degree
+                                      : elimination_heuristic::min_fill);
+            if (cost(other) < cost(best)) { best = std::move(other); }
+        }
+        return best;
+    }
+
+    /// Whether \p sequence contracts the network to one node.
+    ///
+    /// Each step has to contract two existing nodes over all edges between them,
+    /// so every edge of the network is contracted exactly once.
+    [[nodiscard]] constexpr bool
+        is_valid_contraction_sequence(this auto&& self,
+                                      const std::span<const pairwise_contraction_type> sequence) {
+        auto net = connected_tensor_network(self);
+        for (const auto& pc : sequence) {
+            if (pc.lhs_.id == pc.rhs_.id or not rn::contains(net.nodes_, pc.lhs_)
+                or not rn::contains(net.nodes_, pc.rhs_)) {
+                return false;
+            }
+
+            const auto between = [&](const edge& e) {
+                return (e.left.id == pc.lhs_.id or e.left.id == pc.rhs_.id)
+                       and (e.right.id == pc.lhs_.id or e.right.id == pc.rhs_.id);
+            };
+            if (static_cast<std::size_t>(rn::count_if(net.edges_, between)) != rn::size(pc.edges_)
+                or not rn::all_of(pc.edges_, [&](const edge& e) {
+                       return rn::contains(net.edges_, e);
+                   })) {
+                return false;
+            }
+
+            const auto id = net.pairwise_contraction(pc.lhs_.id, pc.rhs_.id);
+            if (pc.out_.has_value() and pc.out_->id != id) { return false; }
+        }
+        return net.size() == 1uz and rn::empty(net.edges_);
+    }
+
+  private:
+    /// Returns sequences which are optimal for some dimension in [1, max_dimension].
+    ///
+    /// Tail of a sequence optimal for D is optimal for D as well,
+    /// so it is enough to combine each head with the tails returned for the contracted network.
+    [[nodiscard]] constexpr std::vector<symbolic_contraction_sequence>
+        search_symbolic_contraction_sequences(this auto&& self,
+                                              const std::size_t max_dimension,
+                                              const std::vector<node_id>& constant_nodes) {
+        if (self.size() == 1uz) {
+            // Threre can not be pairwise contractions for one node.
+            return { symbolic_contraction_sequence{} };
+        }
+
+        // i:th element is the cost of the best sequence so far for dimension i + 1.
+        auto best_costs = std::vector<std::size_t>(max_dimension, static_cast<std::size_t>(-1));
+        auto candidates = std::vector<symbolic_contraction_sequence>{};
+
+        const auto [node_pairs, edge_groups] = self.group_edges_pairwise();
+
+        for (const auto i : rv::iota(0uz, rn::size(node_pairs))) {
+            const auto lhs = node_pairs[i].first;
+            const auto rhs = node_pairs[i].second;
+
+            const auto precomputed =
+                rn::contains(constant_nodes, lhs.id) and rn::contains(constant_nodes, rhs.id);
+
+            auto head = pairwise_contraction_type(lhs, rhs, std::move(edge_groups[i]));
+            const auto head_cost =
+                precomputed ? sstd::natural_polynomial{} : head.cost_polynomial();
+
+            // Head has to be cheaper than the best sequence for some dimension.
+            if (rn::none_of(rv::iota(1uz, max_dimension + 1uz), [&](const std::size_t D) {
+                    return head_cost.evalf(D) < best_costs[D - 1uz];
+                })) {
+                continue;
+            }
+
+            auto contracted_cnet = self;
+            const auto id        = contracted_cnet.pairwise_contraction(lhs.id, rhs.id);
+            head.store_out(*rn::find(contracted_cnet.view_nodes(), id, &node::id));
+
+            auto tail_constant_nodes = constant_nodes;
+            if (precomputed) { tail_constant_nodes.push_back(id); }
+
+            for (auto& tail : contracted_cnet.search_symbolic_contraction_sequences(
+                     max_dimension,
+                     tail_constant_nodes)) {
+                const auto cost = head_cost + tail.cost;
+
+                auto improves = false;
+                for (const auto D : rv::iota(1uz, max_dimension + 1uz)) {
+                    const auto c = cost.evalf(D);
+                    if (c < best_costs[D - 1uz]) {
+                        best_costs[D - 1uz] = c;
+                        improves            = true;
+                    }
+                }
+
+                if (improves) {
+                    auto sequence = std::vector{ head };
+                    rn::copy(tail.sequence, std::back_inserter(sequence));
+                    candidates.push_back({ .sequence = std::move(sequence), .cost = cost });
+                }
+            }
+        }
+
+        // Keep the first candidate which is optimal for each dimension.
+        auto optimal = std::vector<bool>(rn::size(candidates), false);
+        for (const auto D : rv::iota(1uz, max_dimension + 1uz)) {
+            const auto it = rn::find_if(candidates, [&](const auto& c) {
+                return c.cost.evalf(D) == best_costs[D - 1uz];
+            });
+            optimal[static_cast<std::size_t>(rn::distance(candidates.begin(), it))] = true;
+        }
+
+        auto sequences = std::vector<symbolic_contraction_sequence>{};
+        for (const auto i : rv::iota(0uz, rn::size(candidates))) {
+            if (optimal[i]) { sequences.push_back(std::move(candidates[i])); }
+        }
+        return sequences;
+    }
+
+    /// Contracts the end nodes of \p edges in \p order, skipping edges already contracted.
+    [[nodiscard]] constexpr std::vector<pairwise_contraction_type>
+        sequence_from_elimination_order(this auto&& self,
+                                        const std::span<const edge> edges,
+                                        const std::span<const std::size_t> order) {
+        auto net      = connected_tensor_network(self);
+        auto sequence = std::vector<pairwise_contraction_type>{};
+
+        // Node of the original network to the node containing it in net.
+        auto current = self.view_nodes()
+                       | rv::transform([](const node& n) { return std::pair{ n.id, n.id }; })
+                       | rn::to<std::vector>();
+        const auto current_id = [&](const node_id id) {
+            return rn::find(current, id, &std::pair<node_id, node_id>::first)->second;
+        };
+        const auto node_of = [&](const node_id id) {
+            return *rn::find(net.view_nodes(), id, &node::id);
+        };
+
+        for (const auto v : order) {
+            const auto a = current_id(edges[v].left.id);
+            const auto b = current_id(edges[v].right.id);
+            if (a == b) { continue; }
+
+            const auto group = net.view_edges() | rv::filter([&](const edge& e) {
+                                   return (e.left.id == a or e.left.id == b)
+                                          and (e.right.id == a or e.right.id == b);
+                               })
+                               | rn::to<std::vector>();
+
+            auto contraction = pairwise_contraction_type(node_of(a), node_of(b), group);
+            const auto id    = net.pairwise_contraction(a, b);
+            contraction.store_out(node_of(id));
+            sequence.push_back(std::move(contraction));
+
+            for (auto& [_, c] : current) {
+                if (c == a or c == b) { c = id; }
+            }
+        }
+        return sequence;
+    }
+
+    /// search_pairwise_contraction_sequence with the top level branches run on \p threads threads.
+    ///
+    /// Threads take the next branch from a shared counter and prune with the cheapest cost
+    /// found by any thread so far. Branches as costly as the best one are still searched,
+    /// so the branch with the smallest index wins ties as in the sequential search.
+    [[nodiscard]] std::vector<pairwise_contraction_type>
+        parallel_search_pairwise_contraction_sequence(this auto&& self,
+                                                      const std::size_t D,
+                                                      const std::vector<node_id>& constant_nodes,
+                                                      const std::size_t threads) {
+        if (self.size() == 1uz) { return {}; }
+
+        const auto [node_pairs, edge_groups] = self.group_edges_pairwise();
+        const auto branches                  = rn::size(node_pairs);
+
+        struct branch_result {
+            std::vector<pairwise_contraction_type> sequence{};
+            std::size_t cost{ unbounded_cost };
+        };
+        auto results     = std::vector<branch_result>(branches);
+        auto best_cost   = std::atomic<std::size_t>{ unbounded_cost };
+        auto next_branch = std::atomic<std::size_t>{ 0uz };
+
+        const auto search_branches = [&] {
+            for (auto i = next_branch.fetch_add(1uz); i < branches;
+                 i      = next_branch.fetch_add(1uz)) {
+                const auto lhs = node_pairs[i].first;
+                const auto rhs = node_pairs[i].second;
+
+                const auto precomputed =
+                    rn::contains(constant_nodes, lhs.id) and rn::contains(constant_nodes, rhs.id);
+
+                auto head            = pairwise_contraction_type(lhs, rhs, edge_groups[i]);
+                const auto head_cost = precomputed ? 0uz : head.cost(D);
+
+                const auto budget = best_cost.load(std::memory_order_relaxed);
+                const auto bound  = self.tail_cost_lower_bound(D, constant_nodes, lhs, rhs);
+                if (saturating_add(head_cost, bound) > budget) { continue; }
+
+                auto contracted_cnet = connected_tensor_network(self);
+                const auto id        = contracted_cnet.pairwise_contraction(lhs.id, rhs.id);
+                head.store_out(*rn::find(contracted_cnet.view_nodes(), id, &node::id));
+
+                auto tail_constant_nodes = constant_nodes;
+                if (precomputed) { tail_constant_nodes.push_back(id); }
+
+                // Budget one larger finds tails as costly as the best sequence too.
+                const auto tail_budget =
+                    budget == unbounded_cost ? unbounded_cost : budget - head_cost + 1uz;
+                const auto [tail, tail_cost] = contracted_cnet.search_pairwise_contraction_sequence(
+                    D, tail_constant_nodes, tail_budget);
+                if (tail_cost == unbounded_cost) { continue; }
+
+                auto& r    = results[i];
+                r.cost     = head_cost + tail_cost;
+                r.sequence = std::vector{ head };
+                rn::copy(tail, std::back_inserter(r.sequence));
+
+                auto current = best_cost.load(std::memory_order_relaxed);
+                while (r.cost < current
+                       and not best_cost.compare_exchange_weak(current,
+                                                               r.cost,
+                                                               std::memory_order_relaxed)) {}
+            }
+        };
+
+        {
+            const auto hardware = std::max(1u, std::thread::hardware_concurrency());
+            const auto t = std::min(threads == 0uz ? std::size_t{ hardware } : threads, branches);
+
+            auto workers = std::vector<std::jthread>{};
+            workers.reserve(t - 1uz);
+            for ([[maybe_unused]] const auto _ : rv::iota(1uz, t)) {
+                workers.emplace_back(search_branches);
+            }
+            search_branches();
+        }
+
+        const auto best = rn::min_element(results, {}, &branch_result::cost);
+        return std::move(best->sequence);
+    }
+
+  public:
+    /// Returns optimized sequence and its cost.
+    ///
+    /// Only sequences cheaper than \p budget are considered. If there are none,
+    /// empty sequence and unbounded_cost are returned.
+    [[nodiscard]] constexpr std::pair<std::vector<pairwise_contraction_type>, std::size_t>
+        search_pairwise_contraction_sequence(this auto&& self,
+                                             const std::size_t D,
+                                             const std::vector<node_id>& constant_nodes,
+                                             const std::size_t budget = unbounded_cost) {
+        // These will be initialized by the first group cheaper than the budget.
         auto best_sequence      = std::vector<pairwise_contraction_type>{};
-        auto best_sequence_cost = static_cast<std::size_t>(-1);
+        auto best_sequence_cost = budget;
 
         if (self.size() == 1uz) {
             // Threre can not be pairwise contractions for one node.
-            return best_sequence;
+            return { best_sequence, 0uz };
         }
 
         const auto [node_pairs, edge_groups] = self.group_edges_pairwise();
@@ -436,16 +1118,24 @@ class connected_tensor_network : public tensor_network {
             const auto lhs = node_pairs[i].first;
             const auto rhs = node_pairs[i].second;
 
+            const auto precomputed =
+                rn::contains(constant_nodes, lhs.id) and rn::contains(constant_nodes, rhs.id);
+
             auto head            = pairwise_contraction_type(lhs, rhs, std::move(edge_groups[i]));
-            const auto head_cost = head.cost(D);
+            const auto head_cost = precomputed ? 0uz : head.cost(D);
+            const auto bound     = self.tail_cost_lower_bound(D, constant_nodes, lhs, rhs);
 
-            if (head_cost < best_sequence_cost) {
+            if (saturating_add(head_cost, bound) < best_sequence_cost) {
                 auto contracted_cnet = self;
                 const auto id        = contracted_cnet.pairwise_contraction(lhs.id, rhs.id);
                 head.store_out(*rn::find(contracted_cnet.view_nodes(), id, &node::id));
 
-                const auto tail      = contracted_cnet.pairwise_contraction_sequence(D);
-                const auto tail_cost = contraction_cost(tail, D);
+                auto tail_constant_nodes = constant_nodes;
+                if (precomputed) { tail_constant_nodes.push_back(id); }
+
+                const auto [tail, tail_cost] = contracted_cnet.search_pairwise_contraction_sequence(
+                    D, tail_constant_nodes, best_sequence_cost - head_cost);
+                if (tail_cost == unbounded_cost) { continue; }
 
                 const auto head_tail_cost = head_cost + tail_cost;
 
@@ -459,7 +1149,8 @@ class connected_tensor_network : public tensor_network {
             }
         }
 
-        return best_sequence;
+        if (best_sequence.empty()) { return { best_sequence, unbounded_cost }; }
+        return { best_sequence, best_sequence_cost };
     }
 };
 
@@ -504,4 +1195,132 @@ class connected_tensor_network : public tensor_network {
     return components;
 }
 
+namespace network_impl {
+
+/// Connected network of nodes with \p ranks, where edge {a, i, b, j} connects
+/// index i of node a to index j of node b.
+[[nodiscard]] constexpr connected_tensor_network
+    example_network(const std::span<const std::size_t> ranks,
+                    const std::span<const std::array<std::size_t, 4>> edges) {
+    auto net = tensor_network{};
+    auto ids = std::vector<tensor_network::node_id>{};
+    for (const auto r : ranks) { ids.push_back(net.add_node(r)); }
+    for (const auto [a, i, b, j] : edges) { net.add_edge({ ids[a], i }, { ids[b], j }); }
+    return net.connected_components().front();
+}
+
+/// Tabulated sequences are optimal: for each of \p dimensions the table gives a valid sequence,
+/// whose cost polynomial is its cost and equals the cost of the sequence found by the search.
+[[nodiscard]] constexpr bool table_matches_search(const connected_tensor_network& net,
+                                                  const std::span<const std::size_t> dimensions) {
+    const auto table = net.pairwise_contraction_sequence_table();
+    return rn::all_of(dimensions, [&](const std::size_t D) {
+        const auto& optimal  = table.optimal(D);
+        const auto [_, cost] = net.search_pairwise_contraction_sequence(D, {});
+        return net.is_valid_contraction_sequence(optimal.sequence)
+               and optimal.cost.evalf(D) == cost and contraction_cost(optimal.sequence, D) == cost;
+    });
+}
+
+/// Elimination orders of both heuristics, alone or tried with the other one, give valid sequences.
+[[nodiscard]] constexpr bool elimination_is_valid(const connected_tensor_network& net,
+                                                  const std::size_t D) {
+    return rn::all_of(std::array{ elimination_heuristic::min_fill,
+                                  elimination_heuristic::min_degree },
+                      [&](const elimination_heuristic h) {
+                          return net.is_valid_contraction_sequence(
+                                     net.elimination_contraction_sequence(D, h, false))
+                                 and net.is_valid_contraction_sequence(
+                                     net.elimination_contraction_sequence(D, h, true));
+                      });
+}
+
+/// Simplified sequence is valid and as cheap as the searched one for each of \p dimensions.
+[[nodiscard]] constexpr bool
+    simplification_is_exact(const connected_tensor_network& net,
+                            const std::span<const std::size_t> dimensions) {
+    return rn::all_of(dimensions, [&](const std::size_t D) {
+        const auto simplified = net.simplified_pairwise_contraction_sequence(D);
+        const auto [_, cost]  = net.search_pairwise_contraction_sequence(D, {});
+        return net.is_valid_contraction_sequence(simplified)
+               and contraction_cost(simplified, D) == cost;
+    });
+}
+
+/// "ij,jk,kl,l->i": matrix chain applied to a vector.
+[[nodiscard]] constexpr connected_tensor_network chain() {
+    const auto ranks = std::array{ 2uz, 2uz, 2uz, 1uz };
+    const auto edges = std::array{ std::array{ 0uz, 1uz, 1uz, 0uz },
+                                   std::array{ 1uz, 1uz, 2uz, 0uz },
+                                   std::array{ 2uz, 1uz, 3uz, 0uz } };
+    return example_network(ranks, edges);
+}
+
+/// "ac,apb,cqd,pq,bd->": one site of a matrix product state expectation value.
+[[nodiscard]] constexpr connected_tensor_network mps_site() {
+    const auto ranks = std::array{ 2uz, 3uz, 3uz, 2uz, 2uz };
+    const auto edges = std::array{ std::array{ 0uz, 0uz, 1uz, 0uz },
+                                   std::array{ 0uz, 1uz, 2uz, 0uz },
+                                   std::array{ 1uz, 1uz, 3uz, 0uz },
+                                   std::array{ 2uz, 1uz, 3uz, 1uz },
+                                   std::array{ 1uz, 2uz, 4uz, 0uz },
+                                   std::array{ 2uz, 2uz, 4uz, 1uz } };
+    return example_network(ranks, edges);
+}
+
+/// "ab,bc,cd,da->": ring of matrices.
+[[nodiscard]] constexpr connected_tensor_network ring() {
+    const auto ranks = std::array{ 2uz, 2uz, 2uz, 2uz };
+    const auto edges = std::array{ std::array{ 0uz, 1uz, 1uz, 0uz },
+                                   std::array{ 1uz, 1uz, 2uz, 0uz },
+                                   std::array{ 2uz, 1uz, 3uz, 0uz },
+                                   std::array{ 3uz, 1uz, 0uz, 0uz } };
+    return example_network(ranks, edges);
+}
+
+/// "abcdx,abcdy,xy->": tensors sharing four edges, joined by a matrix.
+///
+/// Absorbing the matrix first does not grow either tensor, but costs D^6 + D^5
+/// instead of D^6 + D^2.
+[[nodiscard]] constexpr connected_tensor_network parallel_edges() {
+    const auto ranks = std::array{ 5uz, 5uz, 2uz };
+    const auto edges = std::array{ std::array{ 0uz, 0uz, 1uz, 0uz },
+                                   std::array{ 0uz, 1uz, 1uz, 1uz },
+                                   std::array{ 0uz, 2uz, 1uz, 2uz },
+                                   std::array{ 0uz, 3uz, 1uz, 3uz },
+                                   std::array{ 0uz, 4uz, 2uz, 0uz },
+                                   std::array{ 1uz, 4uz, 2uz, 1uz } };
+    return example_network(ranks, edges);
+}
+
+/// "ijkl,i,jkl->": vector on a tensor sharing three edges with another one.
+///
+/// Absorbing the vector first does not grow the tensor, but costs D^4 + D^3 instead of D^4 + D.
+[[nodiscard]] constexpr connected_tensor_network leaf_vector() {
+    const auto ranks = std::array{ 4uz, 1uz, 3uz };
+    const auto edges = std::array{ std::array{ 0uz, 0uz, 1uz, 0uz },
+                                   std::array{ 0uz, 1uz, 2uz, 0uz },
+                                   std::array{ 0uz, 2uz, 2uz, 1uz },
+                                   std::array{ 0uz, 3uz, 2uz, 2uz } };
+    return example_network(ranks, edges);
+}
+
+inline constexpr auto checked_dimensions = std::array{ 1uz, 2uz, 3uz, 4uz, 5uz, 8uz, 64uz };
+
+static_assert(table_matches_search(chain(), checked_dimensions));
+static_assert(table_matches_search(mps_site(), checked_dimensions));
+static_assert(table_matches_search(ring(), checked_dimensions));
+
+static_assert(simplification_is_exact(chain(), checked_dimensions));
+static_assert(simplification_is_exact(mps_site(), checked_dimensions));
+static_assert(simplification_is_exact(ring(), checked_dimensions));
+static_assert(simplification_is_exact(parallel_edges(), checked_dimensions));
+static_assert(simplification_is_exact(leaf_vector(), checked_dimensions));
+
+static_assert(elimination_is_valid(chain(), 4uz));
+static_assert(elimination_is_valid(mps_site(), 4uz));
+static_assert(elimination_is_valid(ring(), 4uz));
+
+} // namespace network_impl
+
 } // namespace idg